@@ -0,0 +1,94 @@
+/*
+ * The AppendOnlyArray class is an array that only grows and can be read without a lock while
+ * it grows. Elements never move: they live in chunks of 2^ChunkBits, allocated as needed and
+ * reached through a fixed table of MaxChunks chunk pointers, so a reader holding an index never
+ * sees a reallocation.
+ * Appends must be serialized by the caller (the ShaderManager appends under its mutex). An
+ * element is filled in through append() and only becomes visible to readers, through size()
+ * and the indices handed out, once publish() is called.
+ * Like ShaderManager this has no dependence on Orbiter headers.
+ */
+
+#pragma once
+
+// Local
+#include "Platform.h" // for the Win32 types
+
+// std
+#include <atomic>
+
+namespace ClientUtils {
+
+template<typename T, UINT ChunkBits = 6, UINT MaxChunks = 1024>
+class AppendOnlyArray
+{
+public:
+    static const UINT sChunkSize = 1 << ChunkBits;
+    static const UINT sCapacity = sChunkSize * MaxChunks;
+
+    AppendOnlyArray()
+        : m_size(0)
+    {
+        for (UINT chunk = 0; chunk < MaxChunks; ++chunk) {
+            m_chunks[chunk].store(nullptr, std::memory_order_relaxed);
+        }
+    }
+
+    ~AppendOnlyArray()
+    {
+        for (UINT chunk = 0; chunk < MaxChunks; ++chunk) {
+            delete[] m_chunks[chunk].load(std::memory_order_relaxed);
+        }
+    }
+
+    // Published elements only, any thread
+    UINT size() const { return m_size.load(std::memory_order_acquire); }
+
+    // index must be below size(), any thread
+    T& operator[](UINT index)
+    {
+        return m_chunks[index >> ChunkBits].load(std::memory_order_acquire)[index & (sChunkSize - 1)];
+    }
+    const T& operator[](UINT index) const
+    {
+        return m_chunks[index >> ChunkBits].load(std::memory_order_acquire)[index & (sChunkSize - 1)];
+    }
+
+    /*
+     * Writer only. The default constructed element after the published ones, to fill in
+     * before publish(). Null if the array is full. Calling it again before publish() gives
+     * the same element.
+     */
+    T * append()
+    {
+        UINT index = m_size.load(std::memory_order_relaxed);
+        if (index >= sCapacity) {
+            return nullptr;
+        }
+        auto& chunk = m_chunks[index >> ChunkBits];
+        T *elements = chunk.load(std::memory_order_relaxed);
+        if (!elements) {
+            elements = new T[sChunkSize];
+            chunk.store(elements, std::memory_order_release);
+        }
+        return &elements[index & (sChunkSize - 1)];
+    }
+
+    // Writer only. Makes the element from append() visible and returns its index
+    UINT publish()
+    {
+        UINT index = m_size.load(std::memory_order_relaxed);
+        m_size.store(index + 1, std::memory_order_release);
+        return index;
+    }
+
+private:
+    // Not copyable, readers may hold references into the chunks
+    AppendOnlyArray(const AppendOnlyArray&);
+    AppendOnlyArray& operator=(const AppendOnlyArray&);
+
+    std::atomic<T*> m_chunks[MaxChunks];
+    std::atomic<UINT> m_size;
+};
+
+} // namespace ClientUtils
@@ -8,8 +8,16 @@
 // Local
 #include "D3D11Client.h"
 #include "DxTypes.h"
-#include "D3D11Utils.h" // For shader compiles
 #include "Scene.h"
+#include "ShaderManager.h"
+#include "MappedFile.h"
+#include "StarVertexCache.h"
+#include "WorkerPool.h"
+
+// std
+#include <algorithm>
+#include <memory>
+#include <vector>
 
 using namespace Rendering;
 
@@ -18,9 +26,12 @@ CelSphere::CelSphere(D3D11Client &gc)
     , m_d3dDevice(gc.getConfig().getD3DDevice())
     , m_d3dImmContext(gc.getConfig().getD3DDeviceContext())
     , m_Config(gc.getConfig())  // so we dont have to get it everytime
+    , m_bufStars(nullptr)
     , m_bufConstellationLines(nullptr)  // this is valid C++11
     , m_bufLatGrid(nullptr)
     , m_bufLngGrid(nullptr)
+    , m_pipelineStar(nullptr)
+    , m_pipelineLine(nullptr)
     , m_fCelSphereRadius(1e3f)  // From D3D9 :
                                 // the actual render distance for the celestial sphere
                                 // is irrelevant, since it is rendered without z-buffer,
@@ -40,18 +51,9 @@ CelSphere::~CelSphere()
     // Release D3D objects used for rendering
     ReleaseCOM(cb_VS_Star_Line);
     ReleaseCOM(cb_PS_Line);
-    ReleaseCOM(m_ILCVertex);
-    ReleaseCOM(m_VSStarLine);
-    ReleaseCOM(m_PSStar);
-    ReleaseCOM(m_PSLine);
-
-    // Release the star ID3D11Buffers that were allocated during loadStars
-    for ( auto starBuffer : m_vecStarBuffers ) {
-        ReleaseCOM( starBuffer );
-    }
-    // The vector can be cleared out now
-    m_vecStarBuffers.clear();
 
+    // Release the star buffer that was allocated during loadStars
+    ReleaseCOM(m_bufStars);
     ReleaseCOM(m_bufConstellationLines);
     ReleaseCOM(m_bufLatGrid);
     ReleaseCOM(m_bufLngGrid);
@@ -60,51 +62,30 @@ CelSphere::~CelSphere()
 void CelSphere::initCelSphereEffect()  // fix this
 {
     //shaders:
-    ID3DBlob *shaderBlob = NULL;
-
-    // Create VS for stars and (constellation)lines
+    // Input layout for the VS for stars and (constellation)lines
     D3D11_INPUT_ELEMENT_DESC ilDesc[ ] = {
         { "POSITION", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, 0, D3D11_INPUT_PER_VERTEX_DATA, 0 },
         { "COLOR", 0, DXGI_FORMAT_R32_FLOAT, 0, 12, D3D11_INPUT_PER_VERTEX_DATA, 0 } };
 
-	if ( ClientUtils::CompileShaderChkErrors(
-	        "Modules\\D3D11Shaders\\CelSphere.fx",
-	        "VS_Star_Line",
-	        m_Config.VSVersion,
-	        m_Config.iShaderCompileFlag,
-	        &shaderBlob) ) {
-	    // Why this IL ? TODO
-        HR( m_d3dDevice->CreateInputLayout(ilDesc, 2, shaderBlob->GetBufferPointer(), shaderBlob->GetBufferSize(),
-			                               &m_ILCVertex) );
-        HR( m_d3dDevice->CreateVertexShader(shaderBlob->GetBufferPointer(), shaderBlob->GetBufferSize(), NULL,
-                                            &m_VSStarLine) );
-	}
-    ReleaseCOM( shaderBlob );
-
-    // Create separate PS for stars
-    if (ClientUtils::CompileShaderChkErrors(
-            "Modules\\D3D11Shaders\\CelSphere.fx",
-            "PS_Star",
-            m_Config.PSVersion,
-            m_Config.iShaderCompileFlag,
-            &shaderBlob) ) {
-        // Input layout needed only for VS
-        HR( m_d3dDevice->CreatePixelShader(shaderBlob->GetBufferPointer(), shaderBlob->GetBufferSize(), NULL,
-                                           &m_PSStar) );
+    // The ShaderManager caches the shaders (warmed up at startup) and shares the VS and its
+    // input layout between both pipelines
+    ShaderPipelineDesc pipelineDesc;
+    pipelineDesc.purpose = "CelSphere";
+    pipelineDesc.vertexEntryPoint = "VS_Star_Line";
+    pipelineDesc.layout = ilDesc;
+    pipelineDesc.numElements = ARRAYSIZE(ilDesc);
+
+    // Separate PS for stars
+    pipelineDesc.pixelEntryPoint = "PS_Star";
+    if (!m_GraphicsClient.getShaderManager()->getPipeline(pipelineDesc, m_pipelineStar)) {
+        oapiWriteLogV("CelSphere::initCelSphereEffect: could not load the star shaders");
     }
-	ReleaseCOM(shaderBlob);
 
     // And another for constellation lines
-    if (ClientUtils::CompileShaderChkErrors(
-            "Modules\\D3D11Shaders\\CelSphere.fx",
-            "PS_Line",
-            m_Config.PSVersion,
-            m_Config.iShaderCompileFlag,
-            &shaderBlob) ) {
-        HR( m_d3dDevice->CreatePixelShader(shaderBlob->GetBufferPointer(), shaderBlob->GetBufferSize(), NULL,
-                                           &m_PSLine) );
+    pipelineDesc.pixelEntryPoint = "PS_Line";
+    if (!m_GraphicsClient.getShaderManager()->getPipeline(pipelineDesc, m_pipelineLine)) {
+        oapiWriteLogV("CelSphere::initCelSphereEffect: could not load the line shaders");
     }
-	ReleaseCOM(shaderBlob);
 
     // Const buffer for VS contains the world-view-projection matrix float4 * 16 = 64 bytes
     D3D11_BUFFER_DESC desc;
@@ -130,108 +111,92 @@ void CelSphere::initCelSphereEffect()  // fix this
 
 void CelSphere::loadStars()
 {
-	const DWORD bsize = 8;
-	double a, b, xz;
-
 	// Do not load stars lower than prm->mag_lo, so set prm->mag_lo first
 	StarRenderPrm *prm = (StarRenderPrm*)m_GraphicsClient.GetConfigParam( CFGPRM_STARRENDERPRM );
-
-	if( prm->mag_lo > prm->mag_hi ) {
-		if( prm->map_log )
-			a = -log( prm->brt_min )/(prm->mag_lo - prm->mag_hi);
-		else {
-			a = (1.0 - prm->brt_min)/(prm->mag_hi - prm->mag_lo);
-			b = prm->brt_min - prm->mag_lo*a;
-		}
-	}
-	else {
+	StarVertexBuilder builder( m_fCelSphereRadius, prm->mag_lo, prm->mag_hi, prm->brt_min, prm->map_log != 0 );
+	if( !builder.isConsistent() ) {
 		oapiWriteLog( "Inconsistent magnitude limits for background stars" );
 	}
 
-    // Star brightness levels
-	int lvl, plvl = 256;
-	StarRec *data = new StarRec [MAXSTARVERTEX];
-	STARVERTEX *idata = new STARVERTEX [MAXSTARVERTEX];
-	FILE *file;
-	DWORD index, k, numVertices, idx = 0;
+	DWORD index;
 	D3D11_BUFFER_DESC desc;
-	D3D11_SUBRESOURCE_DATA sdata;
-
-	// The stellar database
-	if( !(file = fopen( "Star.bin", "rb" )) ) {
-		return;
-	}
 
 	m_dwNumStarVertices = 0;
-	// Stars are read from file in decreasing magnitude order
-	while( numVertices = fread( data, sizeof(StarRec), MAXSTARVERTEX, file ) ) {
-
-	    // Out of the total stars read, not all may be bright enough to be shown
-	    // Find out how many are - since the stars are in decreasing order of magnitude
-	    // a simple linear search from the beginning will get us to the last star
-	    // that can be shown. Perfect candidate for a std::for_each to quickly
-	    // get to the cutoff - maybe try lambda in such cases ?
-	    for ( index = 0; index < numVertices; ++index ) {
-			if( data[index].mag > prm->mag_lo ) {
-				numVertices = index;
-				break;
-			}
-	    }
-
-	    // numVertices now has the number of stars satisfying mag < = prm->mag_lo
-		if( numVertices ) {
-		    // We have some valid stars to show in this iteration/bunch
-
-			for ( index = 0; index < numVertices; ++index ) {
-				StarRec &rec = data[index];
-				STARVERTEX &v = idata[index];
-
-				xz = m_fCelSphereRadius*cos(rec.lat);
-				v.pos.x = (float)(xz*cos(rec.lng));
-				v.pos.y = (float)(xz*sin(rec.lng));
-				v.pos.z = (float)(m_fCelSphereRadius*sin(rec.lat));
-
-				// TODO: What is going on here ? m_lvlid ?
-				if( prm->map_log )	v.col = (float)min( 1.0, max( prm->brt_min, exp( -(rec.mag - prm->mag_hi)*a ) ) );
-				else				v.col = (float)min( 1.0, max( prm->brt_min, a*rec.mag + b ) );
-
-				lvl = (int)(v.col*256.0*0.5);
-				lvl = (lvl > 255 ? 255 : lvl);
+	for( index = 0; index < 256; ++index )
+		m_lvlid[index] = 0;
 
-				for( k = lvl; k < (DWORD)plvl; k++ )
-					m_lvlid[k] = idx;
-				plvl = lvl;
-				idx++;
-			}
+	// The stellar database, mapped and used in place as an array of StarRec. The mapping
+	// only lives till the vertices are made.
+	ClientUtils::MappedFile starFile;
+	if( !starFile.open( "Star.bin" ) ) {
+		return;
+	}
+	const StarRec *stars = (const StarRec*)starFile.data();
+	DWORD numStars = (DWORD)(starFile.size()/sizeof(StarRec));
+
+	// Stars are stored in increasing order of magnitude (decreasing brightness), so the ones
+	// bright enough to show, mag <= prm->mag_lo, are the front of the array up to the first
+	// fainter one
+	const StarRec *visibleEnd = std::upper_bound( stars, stars + numStars, prm->mag_lo,
+		[]( double mag, const StarRec &rec ) { return mag < rec.mag; } );
+	DWORD numVertices = (DWORD)(visibleEnd - stars);
+	if( !numVertices ) {
+		return;
+	}
 
-			ZeroMemory( &desc, sizeof(desc) );
-			desc.BindFlags = D3D11_BIND_VERTEX_BUFFER;
-			desc.ByteWidth = 16*numVertices;
-			desc.CPUAccessFlags = 0;
-			desc.MiscFlags = 0;
-			desc.StructureByteStride = 0;
-			desc.Usage = D3D11_USAGE_IMMUTABLE;
+	// One buffer takes every visible star, the faintest are dropped if the catalogue would
+	// go over what a D3D11 resource may hold
+	const DWORD maxVertices = (DWORD)(D3D11_REQ_RESOURCE_SIZE_IN_MEGABYTES_EXPRESSION_A_TERM*1024*1024/sizeof(STARVERTEX));
+	if( numVertices > maxVertices ) {
+		oapiWriteLogV( "CelSphere::loadStars: only the %u brightest of %u stars fit in the vertex buffer", maxVertices, numVertices );
+		numVertices = maxVertices;
+	}
 
-			ZeroMemory( &sdata, sizeof(sdata) );
-			sdata.pSysMem = idata;
+	// Vertices made at an earlier launch from the same stars with the same settings are
+	// used as they are, straight from the mapped cache file
+	StarVertexCache vertexCache( ShaderManager::getDiskCacheDirectory() );
+	ClientUtils::Hash128 cacheKey = StarVertexCache::makeKey( stars, numVertices, m_fCelSphereRadius,
+		prm->mag_lo, prm->mag_hi, prm->brt_min, prm->map_log != 0 );
+	std::vector<STARVERTEX> builtVertices;
+	const STARVERTEX *vertices;
+	if( vertexCache.open( cacheKey ) ) {
+		vertices = vertexCache.vertices();
+		CopyMemory( m_lvlid, vertexCache.levels(), sizeof(m_lvlid) );
+	}
+	else {
+		// Big catalogues are converted on all cores, the pool only lives for the load
+		std::unique_ptr<ClientUtils::WorkerPool> pool;
+		if( numVertices > STARPOOLMIN ) {
+			pool.reset( new ClientUtils::WorkerPool() );
+		}
+		builtVertices.resize( numVertices );
+		builder.build( stars, numVertices, builtVertices.data(), pool.get() );
+		vertices = builtVertices.data();
 
-			ID3D11Buffer *newStarBuffer;
-			HR( m_d3dDevice->CreateBuffer( &desc, &sdata, &newStarBuffer ) );
-			m_vecStarBuffers.push_back(newStarBuffer);
+		// The number of stars brighter than each brightness level, renderStars() cuts off
+		// against the background with it
+		builder.fillLevelTable( stars, numVertices, m_lvlid );
 
-			m_dwNumStarVertices += numVertices;
+		if( !vertexCache.store( cacheKey, vertices, numVertices, m_lvlid ) ) {
+			oapiWriteLogV( "CelSphere::loadStars: could not write %s", vertexCache.getFileName().c_str() );
 		}
-		if( numVertices < MAXSTARVERTEX )
-			break;
 	}
-	fclose( file );
 
-	delete [ ] data;
-	delete [ ] idata;
+	// The vertices never change, the buffer is immutable. Neither the built vertices nor
+	// the mapping outlive this function.
+	ZeroMemory( &desc, sizeof(desc) );
+	desc.BindFlags = D3D11_BIND_VERTEX_BUFFER;
+	desc.ByteWidth = sizeof(STARVERTEX)*numVertices;
+	desc.Usage = D3D11_USAGE_IMMUTABLE;
 
-	// TODO: What ??
-	for( index = 0; index < (DWORD)plvl; ++index )
-		m_lvlid[index] = idx;
+	D3D11_SUBRESOURCE_DATA data;
+	ZeroMemory( &data, sizeof(data) );
+	data.pSysMem = vertices;
+	if( FAILED( m_d3dDevice->CreateBuffer( &desc, &data, &m_bufStars ) ) ) {
+		oapiWriteLogV( "CelSphere::loadStars: could not create the star vertex buffer" );
+		return;
+	}
+	m_dwNumStarVertices = numVertices;
 }
 
 void CelSphere::loadConstellationLines()
@@ -362,6 +327,10 @@ void CelSphere::createGrid()
 
 void CelSphere::renderCelestialSphere( D3DXMATRIX *VP, float skybrt, const D3DXVECTOR3 *bgcol )
 {
+    if (!m_pipelineStar || !m_pipelineLine) {
+        // Shaders failed to load, already logged
+        return;
+    }
 
     // Renders stars, constellations, labels.
 
@@ -370,8 +339,6 @@ void CelSphere::renderCelestialSphere( D3DXMATRIX *VP, float skybrt, const D3DXV
 	m_d3dImmContext->IASetPrimitiveTopology( D3D11_PRIMITIVE_TOPOLOGY_LINESTRIP );
 	// This does not set the value, only indicates the array of const buffers to use, only 1 in this case for WVP matrix
 	m_d3dImmContext->VSSetConstantBuffers( 0, 1, &cb_VS_Star_Line );
-	m_d3dImmContext->IASetInputLayout( m_ILCVertex );
-	m_d3dImmContext->VSSetShader( m_VSStarLine, NULL, NULL );
 	
 	Rendering::Scene *pScene = m_GraphicsClient.getScene();
 	DWORD planetariumMode = pScene->getPlanetariumFlag();
@@ -381,9 +348,9 @@ void CelSphere::renderCelestialSphere( D3DXMATRIX *VP, float skybrt, const D3DXV
 		// Must update the VS const buffer with the WVP matrix
 		m_d3dImmContext->UpdateSubresource( cb_VS_Star_Line, 0, NULL, pScene->getViewProjection(), 0, 0 );
 
-		// Use m_PSLine which can read the color from cb_PS_Line that is set here
+		// Use m_pipelineLine whose PS can read the color from cb_PS_Line that is set here
 		// For planetarium mode we need colors to be set from plugin
-		m_d3dImmContext->PSSetShader( m_PSLine, NULL, NULL );
+		m_pipelineLine->bind( m_d3dImmContext );
 		m_d3dImmContext->PSSetConstantBuffers( 1, 1, &cb_PS_Line );
 
 		// Ecliptic grid - this is aligned with the orbital plane of the solar system
@@ -435,10 +402,10 @@ void CelSphere::renderCelestialSphere( D3DXMATRIX *VP, float skybrt, const D3DXV
 		}
 	}
 
-	// Stars - use m_PSStar which uses the color passed from m_VSStarLine
+	// Stars - use m_pipelineStar whose PS uses the color passed from the VS
 	m_d3dImmContext->UpdateSubresource( cb_VS_Star_Line, 0, NULL, pScene->getViewProjection(), 0, 0 );
 	m_d3dImmContext->IASetPrimitiveTopology( D3D11_PRIMITIVE_TOPOLOGY_POINTLIST );
-	m_d3dImmContext->PSSetShader( m_PSStar, NULL, NULL );
+	m_pipelineStar->bind( m_d3dImmContext );
 	renderStars( bgcol );
 
 	const oapi::GraphicsClient::LABELLIST *cmlist;
@@ -473,21 +440,21 @@ void CelSphere::renderCelestialMarkers( D3DXMATRIX *VP )
 
 void CelSphere::renderStars( const D3DXVECTOR3 *bgcol )
 {
-	//nmax = -1;
-	DWORD j, i, nmax = m_dwNumStarVertices;
+	DWORD nmax = m_dwNumStarVertices;
 	const UINT CVertexStride = 16, Offset = 0;
 	
-	// TODO: Mysterious stuff going on here !!
+	// The stars are sorted by brightness, the ones that show against the background are the
+	// front of the buffer
 	if( bgcol ) {
 		int bglvl = min( 255, (int)((min( bgcol->x, 1.0f ) + min( bgcol->y, 1.0f ) + min( bgcol->z, 1.0f ))*128.0f));
 		nmax = min( nmax, (DWORD)m_lvlid[bglvl] );
 	}
-
-	// Render each buffer allocated in loadStars()
-	for( i = j = 0; i < nmax; i += MAXSTARVERTEX, ++j ) {
-		m_d3dImmContext->IASetVertexBuffers( 0, 1, &m_vecStarBuffers[j], &CVertexStride, &Offset );
-		m_d3dImmContext->Draw( min( nmax-i, MAXSTARVERTEX ), 0 );
+	if( !nmax ) {
+		return;
 	}
+
+	m_d3dImmContext->IASetVertexBuffers( 0, 1, &m_bufStars, &CVertexStride, &Offset );
+	m_d3dImmContext->Draw( nmax, 0 );
 }
 
 void CelSphere::renderConstellations()
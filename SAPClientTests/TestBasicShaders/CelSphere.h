@@ -17,22 +17,15 @@
 
 // Local
 #include "D3D11Client.h"
+#include "StarVertexBuilder.h"
 
-#define MAXSTARVERTEX 32768
+#define STARPOOLMIN 32768	// catalogues up to this many stars are converted on one thread
 #define NSEG 64
 
 
 namespace Rendering {
 
-// Used to read in star data
-struct StarRec {
-	float lng, lat, mag;
-};
-
-struct STARVERTEX {
-	D3DXVECTOR3 pos;
-	float col;			//16
-};
+struct ShaderPipeline;
 
 // Render the Celestial Sphere
 class CelSphere {
@@ -67,7 +60,7 @@ private:
 	// Simple D3D11_PRIMITIVE_TOPOLOGY_LINELIST render of constellations
 	void renderConstellations();
 
-	// Renders each buffer in m_vecStarBuffers allocated in loadStars()
+	// Renders the stars brighter than the background from m_bufStars in one draw
 	void renderStars( const D3DXVECTOR3 *bgcol );
 
 	// TODO
@@ -75,7 +68,9 @@ private:
 
 	/*
 	 * For some strange reason we load the star file manually and do
-	 * not use the LoadStars() provided by the Orbiter API
+	 * not use the LoadStars() provided by the Orbiter API. Star.bin is
+	 * memory mapped and read in place, only the stars up to the
+	 * prm->mag_lo cutoff are touched.
 	 */
 	void loadStars();
 
@@ -93,24 +88,22 @@ private:
 	 * rendering loop & used often, so did not use smart pointers
 	 * here.
 	 */
-	// The buffers used by m_VSStarLine for the WVP matrix
-	// and by m_PSLine to read the color respectively
+	// The buffers used by the star/line VS for the WVP matrix
+	// and by the line PS to read the color respectively
     ID3D11Buffer *cb_VS_Star_Line, *cb_PS_Line;
-    // The input layout for VS - has pos & color, C for Celestial/Colored Vertex ?
-    ID3D11InputLayout *m_ILCVertex;
-    // Star and (constellation)line VS - same for both
-    ID3D11VertexShader *m_VSStarLine;
-    /* m_PSStar for star, gets color from VS with input color * 3
-     * m_PSLine for planetarium stuff gets color from cb_PS_Line which is
+    /* Both use the star and (constellation)line VS and its input layout which has pos & color.
+     * m_pipelineStar for stars, its PS gets color from VS with input color * 3
+     * m_pipelineLine for planetarium stuff, its PS gets color from cb_PS_Line which is
      * set from plugin - see impl.
+     * Owned by the ShaderManager.
      */
-    ID3D11PixelShader *m_PSStar, *m_PSLine;
+    const ShaderPipeline *m_pipelineStar, *m_pipelineLine;
 
 
-	/* Each pointer in this vector points to an allocated buffer which
-	 * must be released in the dtor.
+	/* All stars up to prm->mag_lo in one immutable vertex buffer, in
+	 * the Star.bin order of decreasing brightness.
 	 */
-	std::vector<ID3D11Buffer*> m_vecStarBuffers;
+	ID3D11Buffer *m_bufStars;
 	// No smart ptrs here as we want max speed
 	ID3D11Buffer *m_bufConstellationLines, *m_bufLatGrid, *m_bufLngGrid;
 	DWORD m_dwNumStarVertices, nmax, m_dwNumConstellationLines;
@@ -118,7 +111,8 @@ private:
 	// Celestial sphere radius
 	double m_fCelSphereRadius;
 
-	// TODO : Not sure what this is - star brightness level ?
+	// m_lvlid[k] is the number of stars at the front of m_bufStars
+	// brighter than brightness level k, renderStars() draws that many
 	int m_lvlid[256];
 
 	// References to the unique objects used everywhere
@@ -10,6 +10,8 @@
 #include "Scene.h"
 #include "D3D11Utils.h"  // for make_unique<>()
 #include "ShaderManager.h"
+#include "D3DShaderCompiler.h"
+#include "D3DShaderObjectFactory.h"
 
 
 HINSTANCE hDLL;
@@ -142,16 +144,29 @@ D3D11Client::clbkCreateRenderWindow()
     // The config was changed above, some dependent properties may need updating
     m_Config.applyConfig();
 
-    // Initialize shader version strings
+    // Pick the shader profiles for the feature level
     m_Config.initShaderLevels();
 
+    // The ShaderManager compiles with the profiles of the device's feature level
+    InitShaderProfiles(m_Config.shaderLevel);
+
+    // Create ShaderManager before the scene, its objects get their shaders on creation
+    // The D3DX11 compiler and shader objects on the device, the ShaderManager itself does
+    // not depend on either
+	m_pShaderManager = ClientUtils::make_unique<Rendering::ShaderManager>(
+	    ClientUtils::make_unique<Rendering::D3DShaderCompiler>(),
+	    ClientUtils::make_unique<Rendering::D3DShaderObjectFactory>(m_Config.getD3DDevice()),
+	    m_Config.iShaderCompileFlag,
+	    m_Config.iShaderCacheSizeMB);
+
+    // Load the shaders needed early on while still on the splash screen
+    progressString("Loading shaders", 2);
+    m_pShaderManager->warmUp(Rendering::ShaderCatalog::m_expectedPermutations);
+
     // Create the Scene & initialize it
     m_pScene = ClientUtils::make_unique<Rendering::Scene>(*this);
     m_pScene->init3D();
 
-    // Create ShaderManager now that scene rendering is about to begin
-	m_pShaderManager = ClientUtils::make_unique<Rendering::ShaderManager>(m_Config.getD3DDevice());
-
 	// TODO: See how this works !
     progressString("Scene Allocated", 2);   
 
@@ -316,6 +331,14 @@ void D3D11Client::clbkRefreshVideoData()
 void D3D11Client::clbkCloseSession( bool fastclose )
 {
     WLOG2( "D3D11Client::clbkCloseSession" );
+    if (m_pShaderManager) {
+        // Shader cache effectiveness and load times for the session
+        std::vector<std::string> lines;
+        m_pShaderManager->getStatsReport(lines);
+        for (const auto& line : lines) {
+            oapiWriteLogV("%s", line.c_str());
+        }
+    }
     oapi::GraphicsClient::clbkCloseSession( fastclose );
 }
 
@@ -8,6 +8,7 @@
 
 // std
 #include <memory>
+#include <future>
 
 // D3D11
 #include <d3dx11.h>
@@ -27,6 +28,7 @@
 namespace Rendering {
 	class Scene;
 	class ShaderManager;
+	template<typename T> struct ShaderHandle;
 }
 
 class D3D11Config;
@@ -133,6 +135,7 @@ public:
     D3D11Config& getConfig() { return m_Config; }
     const D3D11Config& getConfig() const { return m_Config; }
     Rendering::Scene * getScene(void) { return m_pScene.get(); }
+    Rendering::ShaderManager * getShaderManager(void) { return m_pShaderManager.get(); }
 
     void progressString( const char *line, DWORD _color );
 
@@ -141,37 +144,50 @@ public:
      * Its templated for various shader types
      */
     template <typename T>
-    bool getShader(const std::string fileName,
-                   const std::string entryPoint,
+    bool getShader(const std::string& fileName,
+                   const std::string& entryPoint,
                    ID3D11PixelShader& result,
                    const D3D10_SHADER_MACRO* pDefines = nullptr)
     {
 		return m_pShaderManager->getShader<T>(fileName, entryPoint, result, pDefines);
     }
 
+    // Register once and keep the handle for shaders needed every frame
+    template <typename T>
+    Rendering::ShaderHandle<T> registerShader(const std::string& purpose,
+                                              const std::string& entryPoint,
+                                              const Rendering::ShaderDefines& defines = Rendering::ShaderDefines())
+    {
+        return m_pShaderManager->registerShader<T>(purpose, entryPoint, defines);
+    }
+
+    template <typename T>
+    bool getShader(Rendering::ShaderHandle<T> handle, T& result)
+    {
+        return m_pShaderManager->getShader(handle, result);
+    }
+
+    // Does not block on a cache miss, see ShaderManager::getShaderAsync()
+    template <typename T>
+    std::shared_future<T> getShaderAsync(Rendering::ShaderHandle<T> handle)
+    {
+        return m_pShaderManager->getShaderAsync(handle);
+    }
+
     template<typename T>
-    bool getShaderBytecode(const ID3D11VertexShaderPtr& shaderObject,
+    bool getShaderBytecode(const T& shaderObject,
                            ID3DBlobPtr& bytecode)
     {
         return m_pShaderManager->getShaderBytecode(shaderObject, bytecode);
     }
 
-  /*  template<typename T, size_t TLayoutSize>
-    bool createInputLayout(D3D11_INPUT_ELEMENT_DESC (&layout)[TLayoutSize],
+    template<size_t TLayoutSize>
+    bool createInputLayout(const D3D11_INPUT_ELEMENT_DESC (&layout)[TLayoutSize],
                            const ID3D11VertexShaderPtr& shaderObject,
                            ID3D11InputLayoutPtr& result)
     {
-        ID3DBlobPtr bytecode;
-        if (!getShaderBytecode(shaderObject, bytecode))
-            return false;
-        UINT numElements = TLayoutSize;
-        auto hr = g_d3dDevice->CreateInputLayout(layout,
-                                                 numElements,
-                                                 bytecode->GetBufferPointer(),
-                                                 bytecode->GetBufferSize(),
-                                                 &result);
-        return SUCCEEDED(hr);
-    }*/
+        return m_pShaderManager->createInputLayout(layout, TLayoutSize, shaderObject, result);
+    }
 
 protected:
     TextureMgr *mTexMgr;
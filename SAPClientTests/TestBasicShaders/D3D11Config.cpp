@@ -43,6 +43,7 @@ D3D11Config::D3D11Config(const D3D11Client &gc)
     , m_d3dImmContext(0)
     , m_dxgiSwapChain(0)
     , iShaderCompileFlag(0)
+    , iShaderCacheSizeMB(64)
 {
     oapiWriteLogV("D3D11Config::D3D11Config");
     dxgiCurrentAAMode.Count = 1;
@@ -208,6 +209,10 @@ D3D11Config::loadConfig()
     // Read planet related options
     oapiReadItem_int( hCfgFile, "Planet texture filter", m_FileConfig.Planet_Texture_filter );
     oapiReadItem_int( hCfgFile, "Planet tile loading frequency", m_FileConfig.Planet_Tile_loading_Freq );
+
+    // Read shader related options, older files do not have these
+    m_FileConfig.Shader_cache_size_MB = 64;
+    oapiReadItem_int( hCfgFile, "Shader cache size MB", m_FileConfig.Shader_cache_size_MB );
     oapiCloseFile( hCfgFile, FILE_IN );
 
     // Check values
@@ -217,6 +222,7 @@ D3D11Config::loadConfig()
     m_FileConfig.Mesh_Texture_Filter = m_FileConfig.Mesh_Texture_Filter > 4 ? 0 : (m_FileConfig.Mesh_Texture_Filter < 0 ? 0 : m_FileConfig.Mesh_Texture_Filter);
     m_FileConfig.Planet_Texture_filter = m_FileConfig.Planet_Texture_filter > 4 ? 0 : (m_FileConfig.Planet_Texture_filter < 0 ? 0 : m_FileConfig.Planet_Texture_filter);
     m_FileConfig.Planet_Tile_loading_Freq = m_FileConfig.Planet_Tile_loading_Freq > 200 ? 50 : (m_FileConfig.Planet_Tile_loading_Freq < 0 ? 50 : m_FileConfig.Planet_Tile_loading_Freq);
+    m_FileConfig.Shader_cache_size_MB = m_FileConfig.Shader_cache_size_MB > 1024 ? 64 : (m_FileConfig.Shader_cache_size_MB < 1 ? 64 : m_FileConfig.Shader_cache_size_MB);
     return true;
 }
 
@@ -242,6 +248,8 @@ D3D11Config::setDefault()
 
     m_FileConfig.Planet_Texture_filter = 1;
     m_FileConfig.Planet_Tile_loading_Freq = 50;
+
+    m_FileConfig.Shader_cache_size_MB = 64;
 }
 
 void
@@ -300,6 +308,9 @@ D3D11Config::saveConfig()
     oapiWriteItem_int( hCfgFile, "Planet texture filter", m_FileConfig.Planet_Texture_filter );
     oapiWriteItem_int( hCfgFile, "Planet tile loading frequency",
                                        m_FileConfig.Planet_Tile_loading_Freq );
+
+    //SHADERS:
+    oapiWriteItem_int( hCfgFile, "Shader cache size MB", m_FileConfig.Shader_cache_size_MB );
     oapiCloseFile( hCfgFile, FILE_OUT );
 }
 
@@ -336,9 +347,29 @@ D3D11Config::applyConfig()
 
     bPreloadTiles = false;
 	iEnablePPEffects = m_FileConfig.PP_effect_enable;
+	iShaderCacheSizeMB = m_FileConfig.Shader_cache_size_MB;
 //    bPreloadTiles = CFG.P_preload_tiles ? true : false;
 }
 
+Rendering::ShaderFeatures
+D3D11Config::getShaderFeatures() const
+{
+    Rendering::ShaderFeatures features = 0;
+    if (bNormalMaps) {
+        features |= Rendering::SHADER_FEATURE_NORMAL_MAP;
+    }
+    if (bBumpMaps) {
+        features |= Rendering::SHADER_FEATURE_BUMP_MAP;
+    }
+    if (bSpecularMaps) {
+        features |= Rendering::SHADER_FEATURE_SPECULAR_MAP;
+    }
+    if (bEmissiveMaps) {
+        features |= Rendering::SHADER_FEATURE_EMISSIVE_MAP;
+    }
+    return features;
+}
+
 void
 D3D11Config::dumpConfig() const
 {
@@ -487,36 +518,21 @@ D3D11Config::initShaderLevels()
 {
     D3D_FEATURE_LEVEL feature = m_d3dDevice->GetFeatureLevel();
 
+    // 9_2 and 10_1 run the profiles of the level below, anything newer those of 11_0
     switch( feature ) {
     case D3D_FEATURE_LEVEL_9_1:
-        strcpy( VSVersion, "vs_4_0_level_9_1" );
-        strcpy( GSVersion, "gs_4_0_level_9_1" );
-        strcpy( PSVersion, "ps_4_0_level_9_1" );
-        break;
     case D3D_FEATURE_LEVEL_9_2:
-        strcpy( VSVersion, "vs_4_0_level_9_1" );
-        strcpy( GSVersion, "gs_4_0_level_9_1" );
-        strcpy( PSVersion, "ps_4_0_level_9_1" );
+        shaderLevel = Rendering::SHADER_LEVEL_9_1;
         break;
     case D3D_FEATURE_LEVEL_9_3:
-        strcpy( VSVersion, "vs_4_0_level_9_3" );
-        strcpy( GSVersion, "gs_4_0_level_9_3" );
-        strcpy( PSVersion, "ps_4_0_level_9_3" );
+        shaderLevel = Rendering::SHADER_LEVEL_9_3;
         break;
     case D3D_FEATURE_LEVEL_10_0:
-        strcpy( VSVersion, "vs_4_0" );
-        strcpy( GSVersion, "gs_4_0" );
-        strcpy( PSVersion, "ps_4_0" );
-        break;
     case D3D_FEATURE_LEVEL_10_1:
-        strcpy( VSVersion, "vs_4_0" );
-        strcpy( GSVersion, "gs_4_0" );
-        strcpy( PSVersion, "ps_4_0" );
+        shaderLevel = Rendering::SHADER_LEVEL_10_0;
         break;
-    case D3D_FEATURE_LEVEL_11_0:
-        strcpy( VSVersion, "vs_5_0" );
-        strcpy( GSVersion, "gs_5_0" );
-        strcpy( PSVersion, "ps_5_0" );
+    default:
+        shaderLevel = Rendering::SHADER_LEVEL_11_0;
         break;
     }
 
@@ -36,6 +36,7 @@
 
 // Local
 #include "DxTypes.h"
+#include "ShaderCatalog.h" // for ShaderFeatures
 
 /*
  * Anti-aliasing modes:
@@ -81,7 +82,9 @@ struct D3D11FileConfig {
         PlanetTile_LLights,
 
         Planet_Texture_filter,
-        Planet_Tile_loading_Freq;
+        Planet_Tile_loading_Freq,
+
+        Shader_cache_size_MB;
 };
 
 struct AA_MODE_DESC {
@@ -299,15 +302,15 @@ public:
         AF_FACTOR_PlanetTexture;
 
     /*
-     * Used during shader compilation - keep these as char[32]
+     * Picks the shader profiles, see ShaderCatalog::getProfileName()
      * Inited from D3D11Client::clbkCreateRenderWindow()
      */
-    char
-        VSVersion[32],  // Vertex Shader version
-        GSVersion[32],  // Geometry Shader version
-        PSVersion[32];  // Pixel Shader version
+    Rendering::ShaderLevel shaderLevel;
     UINT iShaderCompileFlag;
+    UINT iShaderCacheSizeMB;    // Budget for the shader disk cache
     void initShaderLevels();
+    // The mesh maps enabled above as ShaderFeature bits, for picking shader permutations
+    Rendering::ShaderFeatures getShaderFeatures() const;
 
 
 private:
@@ -226,6 +226,86 @@ ClientUtils::ShowShaderCompilationError( HRESULT hr, ID3DBlob *errorBlob )
     }
 }
 
+ClientUtils::ShaderIncludeRecorder::ShaderIncludeRecorder(LPCSTR pSrcFile)
+    : m_sourceDirectory(directoryOf(pSrcFile))
+{
+}
+
+ClientUtils::ShaderIncludeRecorder::~ShaderIncludeRecorder()
+{
+    // The compiler closes everything it opens, this is just in case it bailed out early
+    for (auto& openFile : m_openFiles) {
+        delete [] (const char*)openFile.first;
+    }
+}
+
+std::string
+ClientUtils::ShaderIncludeRecorder::directoryOf(const std::string& fileName)
+{
+    auto index = fileName.find_last_of("\\/");
+    return index == std::string::npos ? std::string() : fileName.substr(0, index + 1);
+}
+
+HRESULT
+ClientUtils::ShaderIncludeRecorder::Open(
+    D3D10_INCLUDE_TYPE IncludeType,
+    LPCSTR pFileName,
+    LPCVOID pParentData,
+    LPCVOID *ppData,
+    UINT *pBytes)
+{
+    // Local includes are relative to the file containing the #include
+    std::string directory = m_sourceDirectory;
+    if (IncludeType == D3D10_INCLUDE_LOCAL && pParentData) {
+        auto parent = m_openFiles.find(pParentData);
+        if (parent != m_openFiles.end()) {
+            directory = parent->second;
+        }
+    }
+    std::string fileName = directory + pFileName;
+
+    std::ifstream file(fileName, std::ios::binary);
+    if (!file) {
+        return E_FAIL;
+    }
+    std::vector<char> contents((std::istreambuf_iterator<char>(file)),
+                               std::istreambuf_iterator<char>());
+
+    auto data = new char[contents.size() + 1];
+    CopyMemory(data, contents.data(), contents.size());
+    data[contents.size()] = '\0';
+    m_openFiles[data] = directoryOf(fileName);
+
+    // Record each file once even if it is included from several places
+    auto recorded = false;
+    for (const auto& includedFile : m_includedFiles) {
+        if (includedFile.fileName == fileName) {
+            recorded = true;
+            break;
+        }
+    }
+    if (!recorded) {
+        Hasher hasher;
+        hasher.update(contents.data(), contents.size());
+        IncludedFile includedFile;
+        includedFile.fileName = fileName;
+        includedFile.contentHash = hasher.finish();
+        m_includedFiles.push_back(includedFile);
+    }
+
+    *ppData = data;
+    *pBytes = (UINT)contents.size();
+    return S_OK;
+}
+
+HRESULT
+ClientUtils::ShaderIncludeRecorder::Close(LPCVOID pData)
+{
+    m_openFiles.erase(pData);
+    delete [] (const char*)pData;
+    return S_OK;
+}
+
 // The more detailed shader compiler interface
 bool
 ClientUtils::CompileShaderMaxOpts(
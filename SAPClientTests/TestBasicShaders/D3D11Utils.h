@@ -5,6 +5,9 @@
 // std
 #include <fstream>
 #include <memory>
+#include <string>
+#include <vector>
+#include <map>
 
 // D3D11
 #include <D3DX11core.h>  // for ID3DX11ThreadPump used with CompileFromFile()
@@ -15,6 +18,9 @@
 // Orbiter
 #include "..\..\include\OrbiterAPI.h"  // For COLOUR4 - british
 
+// Local
+#include "Hasher.h"
+
 namespace ClientUtils {
 
 //====================================================================
@@ -129,7 +135,42 @@ void OutputShaderErrorMessage(ID3D10Blob* errorMessage, LPCSTR shaderFilename);
 // Creates message box with information about error but does not log in a file
 void ShowShaderCompilationError( HRESULT hr, ID3DBlob *EBlob );
 
-// The more detailed shader compiler interface
+/*
+ * Include handler for CompileShaderMaxOpts(). Resolves #include "file" relative to the
+ * including file and #include <file> relative to the main source, same as the default
+ * handler, and records every file it opens along with a hash of its contents. The shader
+ * disk cache stores that list with the compiled bytecode so that a change to any included
+ * file invalidates exactly the shaders that included it.
+ */
+class ShaderIncludeRecorder : public ID3D10Include
+{
+public:
+    struct IncludedFile {
+        std::string fileName;
+        Hash128 contentHash;
+    };
+
+    ShaderIncludeRecorder(LPCSTR pSrcFile);
+    ~ShaderIncludeRecorder();
+
+    STDMETHOD(Open)(D3D10_INCLUDE_TYPE IncludeType, LPCSTR pFileName, LPCVOID pParentData,
+                    LPCVOID *ppData, UINT *pBytes);
+    STDMETHOD(Close)(LPCVOID pData);
+
+    // Every file opened so far, each listed once
+    const std::vector<IncludedFile>& getIncludedFiles() const { return m_includedFiles; }
+
+private:
+    static std::string directoryOf(const std::string& fileName);
+
+    std::string m_sourceDirectory;
+    // Buffers handed to the compiler vs the directory of the file they were read from
+    std::map<LPCVOID, std::string> m_openFiles;
+    std::vector<IncludedFile> m_includedFiles;
+};
+
+// The more detailed shader compiler interface, pass a ShaderIncludeRecorder as pInclude
+// to find out which files went into the bytecode
 bool CompileShaderMaxOpts(
     LPCSTR pSrcFile,
     const D3D10_SHADER_MACRO* pDefines,
@@ -0,0 +1,244 @@
+/*
+ * The little of D3D11 and COM that the renderer independent shader sources (ShaderManager, the
+ * shader object factory and compiler interfaces and their stubs) use. On Windows this is just
+ * d3d11.h, D3Dcompiler.h and comdef.h. Elsewhere the same names are declared here: IUnknown,
+ * the shader and input layout interfaces, ID3DBlob, the structs they are described with and a
+ * small stand in for _com_ptr_t. That is enough for ShaderManager to build on a Linux box with
+ * StubShaderCompiler and StubShaderObjectFactory (see Tools\ShaderPackBuilder), nothing here
+ * can draw. The other interfaces DxTypes.h has smart pointers for are only declared.
+ * Only what is used is provided - add to both halves when a portable source needs more.
+ * Like ShaderManager this has no dependence on Orbiter headers.
+ */
+
+#pragma once
+
+// Local
+#include "Platform.h"
+
+#ifdef _WIN32
+
+// d3d
+#include <d3d11.h>
+#include <D3Dcompiler.h>
+
+// system
+#include <comdef.h>
+
+#else
+
+// std
+#include <cstddef>
+
+typedef LONG HRESULT;
+typedef unsigned int ULONG;
+typedef const char * LPCSTR;
+typedef void * LPVOID;
+
+#define STDMETHODCALLTYPE
+#define S_OK ((HRESULT)0)
+#define E_NOTIMPL ((HRESULT)0x80004001)
+#define E_NOINTERFACE ((HRESULT)0x80004002)
+#define E_FAIL ((HRESULT)0x80004005)
+#define DXGI_ERROR_NOT_FOUND ((HRESULT)0x887A0002)
+#define SUCCEEDED(hr) (((HRESULT)(hr)) >= 0)
+#define FAILED(hr) (((HRESULT)(hr)) < 0)
+
+// Interface ids only need to tell the interfaces apart here, __uuidof(I) gives a GUID holding
+// an address unique to I
+struct GUID
+{
+    const void * id;
+
+    bool operator==(const GUID& other) const { return id == other.id; }
+    bool operator!=(const GUID& other) const { return id != other.id; }
+};
+typedef const GUID& REFIID;
+typedef const GUID& REFGUID;
+
+template<typename I>
+struct InterfaceId
+{
+    static const GUID& get()
+    {
+        static const char tag = 0;
+        static const GUID guid = { &tag };
+        return guid;
+    }
+};
+#define __uuidof(I) InterfaceId<I>::get()
+
+struct IUnknown
+{
+    virtual ~IUnknown() {}
+    virtual HRESULT STDMETHODCALLTYPE QueryInterface(REFIID riid, void **ppvObject) = 0;
+    virtual ULONG STDMETHODCALLTYPE AddRef() = 0;
+    virtual ULONG STDMETHODCALLTYPE Release() = 0;
+};
+
+struct ID3D10Blob : IUnknown
+{
+    virtual LPVOID STDMETHODCALLTYPE GetBufferPointer() = 0;
+    virtual SIZE_T STDMETHODCALLTYPE GetBufferSize() = 0;
+};
+typedef ID3D10Blob ID3DBlob;
+
+struct ID3D11Device;
+struct ID3D11ClassInstance;
+
+struct ID3D11DeviceChild : IUnknown
+{
+    virtual void STDMETHODCALLTYPE GetDevice(ID3D11Device **ppDevice) = 0;
+    virtual HRESULT STDMETHODCALLTYPE GetPrivateData(REFGUID guid, UINT *pDataSize, void *pData) = 0;
+    virtual HRESULT STDMETHODCALLTYPE SetPrivateData(REFGUID guid, UINT DataSize, const void *pData) = 0;
+    virtual HRESULT STDMETHODCALLTYPE SetPrivateDataInterface(REFGUID guid, const IUnknown *pData) = 0;
+};
+
+struct ID3D11VertexShader : ID3D11DeviceChild {};
+struct ID3D11PixelShader : ID3D11DeviceChild {};
+struct ID3D11GeometryShader : ID3D11DeviceChild {};
+struct ID3D11HullShader : ID3D11DeviceChild {};
+struct ID3D11DomainShader : ID3D11DeviceChild {};
+struct ID3D11ComputeShader : ID3D11DeviceChild {};
+struct ID3D11InputLayout : ID3D11DeviceChild {};
+
+// Only what ShaderPipeline::bind() calls
+struct ID3D11DeviceContext : ID3D11DeviceChild
+{
+    virtual void STDMETHODCALLTYPE IASetInputLayout(ID3D11InputLayout *pInputLayout) = 0;
+    virtual void STDMETHODCALLTYPE VSSetShader(ID3D11VertexShader *pVertexShader,
+                                               ID3D11ClassInstance * const *ppClassInstances,
+                                               UINT NumClassInstances) = 0;
+    virtual void STDMETHODCALLTYPE PSSetShader(ID3D11PixelShader *pPixelShader,
+                                               ID3D11ClassInstance * const *ppClassInstances,
+                                               UINT NumClassInstances) = 0;
+};
+
+// Declared only, for the smart pointer types in DxTypes.h
+struct IDXGIAdapter1;
+struct IDXGIFactory1;
+struct IDXGIOutput;
+struct IDXGISurface1;
+struct IDXGISwapChain;
+struct ID3D11BlendState;
+struct ID3D11Buffer;
+struct ID3D11Debug;
+struct ID3D11DepthStencilState;
+struct ID3D11DepthStencilView;
+struct ID3D11RasterizerState;
+struct ID3D11RenderTargetView;
+struct ID3D11Resource;
+struct ID3D11SamplerState;
+struct ID3D11ShaderResourceView;
+struct ID3D11Texture2D;
+
+struct D3D10_SHADER_MACRO
+{
+    LPCSTR Name;
+    LPCSTR Definition;
+};
+
+// The values are the real ones, only the formats used are listed
+enum DXGI_FORMAT
+{
+    DXGI_FORMAT_UNKNOWN = 0,
+    DXGI_FORMAT_R32G32B32A32_FLOAT = 2,
+    DXGI_FORMAT_R32G32B32_FLOAT = 6,
+    DXGI_FORMAT_R32G32_FLOAT = 16,
+    DXGI_FORMAT_R32_FLOAT = 41
+};
+
+enum D3D11_INPUT_CLASSIFICATION
+{
+    D3D11_INPUT_PER_VERTEX_DATA = 0,
+    D3D11_INPUT_PER_INSTANCE_DATA = 1
+};
+
+struct D3D11_INPUT_ELEMENT_DESC
+{
+    LPCSTR SemanticName;
+    UINT SemanticIndex;
+    DXGI_FORMAT Format;
+    UINT InputSlot;
+    UINT AlignedByteOffset;
+    D3D11_INPUT_CLASSIFICATION InputSlotClass;
+    UINT InstanceDataStepRate;
+};
+
+namespace ClientUtils {
+
+// As much of _com_ptr_t as the portable sources use: it holds one reference
+template<typename I>
+class ComSmartPtr
+{
+public:
+    typedef I Interface;
+
+    ComSmartPtr() : m_pInterface(nullptr) {}
+    ComSmartPtr(std::nullptr_t) : m_pInterface(nullptr) {}
+    ComSmartPtr(I *pInterface) : m_pInterface(pInterface) { addRef(); }
+    ComSmartPtr(const ComSmartPtr& other) : m_pInterface(other.m_pInterface) { addRef(); }
+    ~ComSmartPtr() { Release(); }
+
+    ComSmartPtr& operator=(const ComSmartPtr& other)
+    {
+        ComSmartPtr(other).swap(*this);
+        return *this;
+    }
+    ComSmartPtr& operator=(I *pInterface)
+    {
+        ComSmartPtr(pInterface).swap(*this);
+        return *this;
+    }
+    ComSmartPtr& operator=(std::nullptr_t)
+    {
+        Release();
+        return *this;
+    }
+
+    // Takes over a reference the caller has
+    void Attach(I *pInterface)
+    {
+        Release();
+        m_pInterface = pInterface;
+    }
+    void Release()
+    {
+        if (m_pInterface) {
+            m_pInterface->Release();
+            m_pInterface = nullptr;
+        }
+    }
+
+    I * GetInterfacePtr() const { return m_pInterface; }
+    operator I*() const { return m_pInterface; }
+    I * operator->() const { return m_pInterface; }
+    // For out parameters, whatever was held is released first
+    I ** operator&()
+    {
+        Release();
+        return &m_pInterface;
+    }
+
+private:
+    void addRef()
+    {
+        if (m_pInterface) {
+            m_pInterface->AddRef();
+        }
+    }
+    void swap(ComSmartPtr& other)
+    {
+        I *pInterface = m_pInterface;
+        m_pInterface = other.m_pInterface;
+        other.m_pInterface = pInterface;
+    }
+
+    I *m_pInterface;
+};
+
+} // namespace ClientUtils
+
+// The interface id is not needed, see __uuidof above
+#define _COM_SMARTPTR_TYPEDEF(Interface, iid) typedef ClientUtils::ComSmartPtr<Interface> Interface##Ptr
+
+#endif
@@ -0,0 +1,58 @@
+/*
+ * Impl
+ */
+
+// Self
+#include "D3DShaderCompiler.h"
+
+// Local
+#include "D3D11Utils.h"  // for CompileShaderMaxOpts(), only needed in the impl
+#include "DxTypes.h"
+
+using namespace Rendering;
+
+bool
+D3DShaderCompiler::compile(
+    const std::string& shaderFileName,
+    const std::string& entryPoint,
+    const std::string& shaderProfile,
+    const ShaderDefines& defines,
+    UINT flags,
+    std::vector<BYTE>& bytecode,
+    std::vector<ShaderDependency>& dependencies)
+{
+    // Null terminated macro list pointing into defines
+    std::vector<D3D10_SHADER_MACRO> macros;
+    for (const auto& define : defines) {
+        D3D10_SHADER_MACRO macro = { define.first.c_str(), define.second.c_str() };
+        macros.push_back(macro);
+    }
+    D3D10_SHADER_MACRO terminator = { nullptr, nullptr };
+    macros.push_back(terminator);
+
+    ID3DBlobPtr data;
+    ClientUtils::ShaderIncludeRecorder includes(shaderFileName.c_str());
+    if (!ClientUtils::CompileShaderMaxOpts(shaderFileName.c_str(),
+                                           macros.data(),
+                                           &includes,
+                                           entryPoint.c_str(),
+                                           shaderProfile.c_str(),
+                                           flags,
+                                           0,
+                                           nullptr,
+                                           &data)) {
+        return false;
+    }
+
+    auto blobBytes = (const BYTE*)data->GetBufferPointer();
+    bytecode.assign(blobBytes, blobBytes + data->GetBufferSize());
+
+    dependencies.clear();
+    for (const auto& includedFile : includes.getIncludedFiles()) {
+        ShaderDependency dependency;
+        dependency.fileName = includedFile.fileName;
+        dependency.contentHash = includedFile.contentHash;
+        dependencies.push_back(dependency);
+    }
+    return true;
+}
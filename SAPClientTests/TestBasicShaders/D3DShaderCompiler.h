@@ -0,0 +1,27 @@
+/*
+ * The D3DShaderCompiler class compiles through ClientUtils::CompileShaderMaxOpts(), that is
+ * D3DX11CompileFromFile() with a ShaderIncludeRecorder to find the included files. Compile
+ * errors are shown the same way as for every other shader in the client.
+ * Windows only, see ShaderCompiler.h for the portable stand in.
+ */
+
+#pragma once
+
+// Local
+#include "ShaderCompiler.h"
+
+namespace Rendering {
+
+class D3DShaderCompiler : public IShaderCompiler
+{
+public:
+    virtual bool compile(const std::string& shaderFileName,
+                         const std::string& entryPoint,
+                         const std::string& shaderProfile,
+                         const ShaderDefines& defines,
+                         UINT flags,
+                         std::vector<BYTE>& bytecode,
+                         std::vector<ShaderDependency>& dependencies);
+};
+
+} // namespace Rendering
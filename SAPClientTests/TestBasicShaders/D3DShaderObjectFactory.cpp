@@ -0,0 +1,77 @@
+/*
+ * Impl
+ */
+
+// Self
+#include "D3DShaderObjectFactory.h"
+
+// d3d
+#include <D3Dcompiler.h>
+
+using namespace Rendering;
+
+bool
+D3DShaderObjectFactory::createShader(const void *bytecode, SIZE_T bytecodeLength, ID3D11VertexShaderPtr& result)
+{
+    return SUCCEEDED(m_d3dDevice->CreateVertexShader(bytecode, bytecodeLength, nullptr, &result));
+}
+
+bool
+D3DShaderObjectFactory::createShader(const void *bytecode, SIZE_T bytecodeLength, ID3D11PixelShaderPtr& result)
+{
+    return SUCCEEDED(m_d3dDevice->CreatePixelShader(bytecode, bytecodeLength, nullptr, &result));
+}
+
+bool
+D3DShaderObjectFactory::createShader(const void *bytecode, SIZE_T bytecodeLength, ID3D11GeometryShaderPtr& result)
+{
+    return SUCCEEDED(m_d3dDevice->CreateGeometryShader(bytecode, bytecodeLength, nullptr, &result));
+}
+
+bool
+D3DShaderObjectFactory::createShader(const void *bytecode, SIZE_T bytecodeLength, ID3D11HullShaderPtr& result)
+{
+    return SUCCEEDED(m_d3dDevice->CreateHullShader(bytecode, bytecodeLength, nullptr, &result));
+}
+
+bool
+D3DShaderObjectFactory::createShader(const void *bytecode, SIZE_T bytecodeLength, ID3D11DomainShaderPtr& result)
+{
+    return SUCCEEDED(m_d3dDevice->CreateDomainShader(bytecode, bytecodeLength, nullptr, &result));
+}
+
+bool
+D3DShaderObjectFactory::createShader(const void *bytecode, SIZE_T bytecodeLength, ID3D11ComputeShaderPtr& result)
+{
+    return SUCCEEDED(m_d3dDevice->CreateComputeShader(bytecode, bytecodeLength, nullptr, &result));
+}
+
+bool
+D3DShaderObjectFactory::createBlob(const void *data, SIZE_T length, ID3DBlobPtr& result)
+{
+    ID3DBlobPtr blob;
+    if (FAILED(D3DCreateBlob(length, &blob))) {
+        return false;
+    }
+    CopyMemory(blob->GetBufferPointer(), data, length);
+    result = blob;
+    return true;
+}
+
+bool
+D3DShaderObjectFactory::getInputSignature(const void *bytecode, SIZE_T bytecodeLength, ID3DBlobPtr& signature)
+{
+    return SUCCEEDED(D3DGetInputSignatureBlob(bytecode, bytecodeLength, &signature));
+}
+
+bool
+D3DShaderObjectFactory::createInputLayout(
+    const D3D11_INPUT_ELEMENT_DESC *layout,
+    UINT numElements,
+    const void *signature,
+    SIZE_T signatureLength,
+    ID3D11InputLayoutPtr& result)
+{
+    return SUCCEEDED(m_d3dDevice->CreateInputLayout(layout, numElements, signature,
+                                                    signatureLength, &result));
+}
@@ -0,0 +1,40 @@
+/*
+ * The D3DShaderObjectFactory class creates shader objects and input layouts on the D3D device,
+ * the input signature comes from D3DGetInputSignatureBlob(). The device is not owned.
+ * See ShaderObjectFactory.h for the stand in that needs no device.
+ */
+
+#pragma once
+
+// Local
+#include "ShaderObjectFactory.h"
+
+namespace Rendering {
+
+class D3DShaderObjectFactory : public IShaderObjectFactory
+{
+public:
+    explicit D3DShaderObjectFactory(ID3D11Device *device) : m_d3dDevice(device) {}
+
+    virtual bool createShader(const void *bytecode, SIZE_T bytecodeLength, ID3D11VertexShaderPtr& result);
+    virtual bool createShader(const void *bytecode, SIZE_T bytecodeLength, ID3D11PixelShaderPtr& result);
+    virtual bool createShader(const void *bytecode, SIZE_T bytecodeLength, ID3D11GeometryShaderPtr& result);
+    virtual bool createShader(const void *bytecode, SIZE_T bytecodeLength, ID3D11HullShaderPtr& result);
+    virtual bool createShader(const void *bytecode, SIZE_T bytecodeLength, ID3D11DomainShaderPtr& result);
+    virtual bool createShader(const void *bytecode, SIZE_T bytecodeLength, ID3D11ComputeShaderPtr& result);
+
+    virtual bool createBlob(const void *data, SIZE_T length, ID3DBlobPtr& result);
+
+    virtual bool getInputSignature(const void *bytecode, SIZE_T bytecodeLength, ID3DBlobPtr& signature);
+
+    virtual bool createInputLayout(const D3D11_INPUT_ELEMENT_DESC *layout,
+                                   UINT numElements,
+                                   const void *signature,
+                                   SIZE_T signatureLength,
+                                   ID3D11InputLayoutPtr& result);
+
+private:
+    ID3D11Device *m_d3dDevice;
+};
+
+} // namespace Rendering
@@ -4,8 +4,8 @@
 
 #pragma once
 
-// system
-#include<comdef.h>
+// Local
+#include "D3DPlatform.h" // d3d11.h and comdef.h, or their stand ins off Windows
 
 /*
  * COM smart pointer types
@@ -34,6 +34,9 @@ _COM_SMARTPTR_TYPEDEF(ID3D11DepthStencilState, IID_ID3D11DepthStencilState);
 _COM_SMARTPTR_TYPEDEF(ID3D11DepthStencilView, IID_ID3D11DepthStencilView);
 _COM_SMARTPTR_TYPEDEF(ID3D11Device, IID_ID3D11Device);
 _COM_SMARTPTR_TYPEDEF(ID3D11DeviceContext, IID_ID3D11DeviceContext);
+_COM_SMARTPTR_TYPEDEF(ID3D11DomainShader, IID_ID3D11DomainShader);
+_COM_SMARTPTR_TYPEDEF(ID3D11GeometryShader, IID_ID3D11GeometryShader);
+_COM_SMARTPTR_TYPEDEF(ID3D11HullShader, IID_ID3D11HullShader);
 _COM_SMARTPTR_TYPEDEF(ID3D11InputLayout, IID_ID3D11InputLayout);
 _COM_SMARTPTR_TYPEDEF(ID3D11PixelShader, IID_ID3D11PixelShader);
 _COM_SMARTPTR_TYPEDEF(ID3D11RasterizerState, IID_ID3D11RasterizerState);
@@ -0,0 +1,162 @@
+/*
+ * Impl
+ */
+
+// Self
+#include "Hasher.h"
+
+// The switch in finish() falls through on purpose. [[fallthrough]] is C++17, before that the
+// compilers have their own spellings.
+#if defined(__clang__)
+#define HASHER_FALLTHROUGH [[clang::fallthrough]]
+#elif defined(__GNUC__) && __GNUC__ >= 7
+#define HASHER_FALLTHROUGH [[gnu::fallthrough]]
+#else
+#define HASHER_FALLTHROUGH
+#endif
+
+using namespace ClientUtils;
+
+namespace {
+
+const UINT64 c1 = 0x87c37b91114253d5ULL;
+const UINT64 c2 = 0x4cf5ad432745937fULL;
+
+inline UINT64 rotl64(UINT64 x, int r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+inline UINT64 fmix64(UINT64 k)
+{
+    k ^= k >> 33;
+    k *= 0xff51afd7ed558ccdULL;
+    k ^= k >> 33;
+    k *= 0xc4ceb9fe1a85ec53ULL;
+    k ^= k >> 33;
+    return k;
+}
+
+} // namespace
+
+std::string
+Hash128::toString() const
+{
+    static const char digits[] = "0123456789abcdef";
+    std::string result(32, '0');
+    for (int i = 0; i < 16; ++i) {
+        result[15 - i] = digits[(high >> (i * 4)) & 0xf];
+        result[31 - i] = digits[(low >> (i * 4)) & 0xf];
+    }
+    return result;
+}
+
+Hasher::Hasher(UINT64 seed)
+    : m_h1(seed)
+    , m_h2(seed)
+    , m_bufferLength(0)
+    , m_totalLength(0)
+{
+}
+
+void
+Hasher::processBlock(const BYTE *block)
+{
+    UINT64 k1, k2;
+    CopyMemory(&k1, block, 8);
+    CopyMemory(&k2, block + 8, 8);
+
+    k1 *= c1; k1 = rotl64(k1, 31); k1 *= c2; m_h1 ^= k1;
+    m_h1 = rotl64(m_h1, 27); m_h1 += m_h2; m_h1 = m_h1 * 5 + 0x52dce729;
+
+    k2 *= c2; k2 = rotl64(k2, 33); k2 *= c1; m_h2 ^= k2;
+    m_h2 = rotl64(m_h2, 31); m_h2 += m_h1; m_h2 = m_h2 * 5 + 0x38495ab5;
+}
+
+void
+Hasher::update(const void *data, SIZE_T length)
+{
+    auto bytes = (const BYTE*)data;
+    m_totalLength += length;
+
+    // Top up a partial block left from the last call first
+    if (m_bufferLength) {
+        SIZE_T fill = 16 - m_bufferLength;
+        if (fill > length) {
+            fill = length;
+        }
+        CopyMemory(m_buffer + m_bufferLength, bytes, fill);
+        m_bufferLength += fill;
+        bytes += fill;
+        length -= fill;
+        if (m_bufferLength < 16) {
+            return;
+        }
+        processBlock(m_buffer);
+        m_bufferLength = 0;
+    }
+
+    for (; length >= 16; bytes += 16, length -= 16) {
+        processBlock(bytes);
+    }
+
+    if (length) {
+        CopyMemory(m_buffer, bytes, length);
+        m_bufferLength = length;
+    }
+}
+
+void
+Hasher::update(const std::string &str)
+{
+    updateValue((UINT64)str.length());
+    update(str.data(), str.length());
+}
+
+void
+Hasher::update(const char *str)
+{
+    update(std::string(str ? str : ""));
+}
+
+Hash128
+Hasher::finish() const
+{
+    UINT64 h1 = m_h1, h2 = m_h2;
+    UINT64 k1 = 0, k2 = 0;
+    const BYTE *tail = m_buffer;
+
+    switch (m_bufferLength) {
+    case 15: k2 ^= (UINT64)tail[14] << 48; HASHER_FALLTHROUGH;
+    case 14: k2 ^= (UINT64)tail[13] << 40; HASHER_FALLTHROUGH;
+    case 13: k2 ^= (UINT64)tail[12] << 32; HASHER_FALLTHROUGH;
+    case 12: k2 ^= (UINT64)tail[11] << 24; HASHER_FALLTHROUGH;
+    case 11: k2 ^= (UINT64)tail[10] << 16; HASHER_FALLTHROUGH;
+    case 10: k2 ^= (UINT64)tail[9] << 8; HASHER_FALLTHROUGH;
+    case 9:  k2 ^= (UINT64)tail[8];
+             k2 *= c2; k2 = rotl64(k2, 33); k2 *= c1; h2 ^= k2; HASHER_FALLTHROUGH;
+    case 8:  k1 ^= (UINT64)tail[7] << 56; HASHER_FALLTHROUGH;
+    case 7:  k1 ^= (UINT64)tail[6] << 48; HASHER_FALLTHROUGH;
+    case 6:  k1 ^= (UINT64)tail[5] << 40; HASHER_FALLTHROUGH;
+    case 5:  k1 ^= (UINT64)tail[4] << 32; HASHER_FALLTHROUGH;
+    case 4:  k1 ^= (UINT64)tail[3] << 24; HASHER_FALLTHROUGH;
+    case 3:  k1 ^= (UINT64)tail[2] << 16; HASHER_FALLTHROUGH;
+    case 2:  k1 ^= (UINT64)tail[1] << 8; HASHER_FALLTHROUGH;
+    case 1:  k1 ^= (UINT64)tail[0];
+             k1 *= c1; k1 = rotl64(k1, 31); k1 *= c2; h1 ^= k1;
+    }
+
+    h1 ^= m_totalLength;
+    h2 ^= m_totalLength;
+    h1 += h2;
+    h2 += h1;
+    h1 = fmix64(h1);
+    h2 = fmix64(h2);
+    h1 += h2;
+    h2 += h1;
+
+    Hash128 result;
+    result.low = h1;
+    result.high = h2;
+    return result;
+}
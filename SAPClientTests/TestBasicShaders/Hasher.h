@@ -0,0 +1,54 @@
+/*
+ * Streaming 128 bit content hash (MurmurHash3 x64_128 run over everything passed to
+ * update()). Used to key cached data by the exact bytes it was built from, so identical
+ * inputs give identical keys across runs and machines.
+ * Not cryptographic - it guards against accidental collisions, not deliberate ones.
+ */
+
+#pragma once
+
+// Local
+#include "Platform.h" // for the Win32 types
+
+// std
+#include <string>
+
+namespace ClientUtils {
+
+struct Hash128
+{
+    UINT64 low, high;
+
+    bool operator==(const Hash128 &other) const { return low == other.low && high == other.high; }
+    bool operator!=(const Hash128 &other) const { return !(*this == other); }
+
+    // 32 lowercase hex digits
+    std::string toString() const;
+};
+
+class Hasher
+{
+public:
+    Hasher(UINT64 seed = 0);
+
+    void update(const void *data, SIZE_T length);
+
+    // Strings are length prefixed so that consecutive fields cannot run into each other
+    void update(const std::string &str);
+    void update(const char *str);
+
+    template<typename T>
+    void updateValue(const T &value) { update(&value, sizeof(value)); }
+
+    Hash128 finish() const;
+
+private:
+    void processBlock(const BYTE *block);
+
+    UINT64 m_h1, m_h2;
+    BYTE m_buffer[16];
+    SIZE_T m_bufferLength;
+    UINT64 m_totalLength;
+};
+
+} // namespace ClientUtils
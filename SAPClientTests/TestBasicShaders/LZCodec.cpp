@@ -0,0 +1,226 @@
+/*
+ * Impl
+ */
+
+// Self
+#include "LZCodec.h"
+
+// std
+#include <cstring>
+
+#define LZ_MIN_MATCH 4
+#define LZ_MAX_OFFSET 0xffff
+#define LZ_RUN_MASK 15				// nibble value saying more length bytes follow
+#define LZ_HASH_BITS 12
+#define LZ_SKIP_TRIGGER 6			// step up the search after 2^n misses in a row
+#define LZ_FAST_COPY 16				// literal runs up to this are copied in one go
+
+using namespace ClientUtils;
+
+namespace {
+
+inline UINT read32(const BYTE *p)
+{
+    UINT value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+inline UINT hashSequence(UINT sequence)
+{
+    return (sequence * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+// Bytes a length takes past its nibble
+inline SIZE_T extraLengthSize(SIZE_T length)
+{
+    return length >= LZ_RUN_MASK ? (length - LZ_RUN_MASK) / 255 + 1 : 0;
+}
+
+inline void writeExtraLength(BYTE *&out, SIZE_T length)
+{
+    if (length < LZ_RUN_MASK) {
+        return;
+    }
+    for (length -= LZ_RUN_MASK; length >= 255; length -= 255) {
+        *out++ = 255;
+    }
+    *out++ = (BYTE)length;
+}
+
+inline bool readExtraLength(const BYTE *&in, const BYTE *end, SIZE_T &length)
+{
+    BYTE next;
+    do {
+        if (in == end) {
+            return false;
+        }
+        next = *in++;
+        length += next;
+    } while (next == 255);
+    return true;
+}
+
+// matchLength 0 makes the last sequence, literals only
+bool writeSequence(BYTE *&out, const BYTE *outEnd, const BYTE *literals, SIZE_T literalLength,
+                   SIZE_T offset, SIZE_T matchLength)
+{
+    auto matchCode = matchLength ? matchLength - LZ_MIN_MATCH : 0;
+    auto size = 1 + extraLengthSize(literalLength) + literalLength;
+    if (matchLength) {
+        size += 2 + extraLengthSize(matchCode);
+    }
+    if ((SIZE_T)(outEnd - out) < size) {
+        return false;
+    }
+
+    *out++ = (BYTE)((literalLength < LZ_RUN_MASK ? literalLength : LZ_RUN_MASK) << 4 |
+                    (matchCode < LZ_RUN_MASK ? matchCode : LZ_RUN_MASK));
+    writeExtraLength(out, literalLength);
+    if (literalLength) {
+        memcpy(out, literals, literalLength);
+        out += literalLength;
+    }
+    if (matchLength) {
+        *out++ = (BYTE)offset;
+        *out++ = (BYTE)(offset >> 8);
+        writeExtraLength(out, matchCode);
+    }
+    return true;
+}
+
+} // namespace
+
+SIZE_T
+LZCodec::compressBound(SIZE_T sourceLength)
+{
+    // All literals in one sequence, the token and the length bytes on top
+    return sourceLength + sourceLength / 255 + 16;
+}
+
+SIZE_T
+LZCodec::compress(const void *source, SIZE_T sourceLength, void *dest, SIZE_T destCapacity)
+{
+    auto src = (const BYTE*)source;
+    auto end = src + sourceLength;
+    auto out = (BYTE*)dest;
+    auto outEnd = out + destCapacity;
+
+    // Offsets into source of the last position seen with each hash. Stale or colliding ones
+    // are caught by comparing the bytes.
+    UINT table[1 << LZ_HASH_BITS];
+    memset(table, 0, sizeof(table));
+
+    auto anchor = src;
+    auto ip = src;
+    UINT misses = 0;
+    while (sourceLength >= LZ_MIN_MATCH && ip <= end - LZ_MIN_MATCH) {
+        auto sequence = read32(ip);
+        auto hash = hashSequence(sequence);
+        auto candidate = src + table[hash];
+        table[hash] = (UINT)(ip - src);
+        if (candidate >= ip || ip - candidate > LZ_MAX_OFFSET || read32(candidate) != sequence) {
+            // Long runs of misses are likely incompressible, skip through them faster
+            ip += 1 + (misses++ >> LZ_SKIP_TRIGGER);
+            continue;
+        }
+        misses = 0;
+
+        auto matchEnd = ip + LZ_MIN_MATCH;
+        auto ref = candidate + LZ_MIN_MATCH;
+        while (matchEnd < end && *matchEnd == *ref) {
+            ++matchEnd;
+            ++ref;
+        }
+        if (!writeSequence(out, outEnd, anchor, ip - anchor, ip - candidate, matchEnd - ip)) {
+            return 0;
+        }
+        ip = anchor = matchEnd;
+
+        // One position near the end of the match, so the next one can start right there
+        if (ip <= end - LZ_MIN_MATCH) {
+            table[hashSequence(read32(ip - 2))] = (UINT)(ip - 2 - src);
+        }
+    }
+    if (!writeSequence(out, outEnd, anchor, end - anchor, 0, 0)) {
+        return 0;
+    }
+    return out - (BYTE*)dest;
+}
+
+bool
+LZCodec::decompress(const void *source, SIZE_T sourceLength, void *dest, SIZE_T destLength)
+{
+    auto in = (const BYTE*)source;
+    auto inEnd = in + sourceLength;
+    auto begin = (BYTE*)dest;
+    auto out = begin;
+    auto outEnd = begin + destLength;
+
+    // Every length and offset is checked against both buffers, the block may come off a
+    // damaged file
+    for (;;) {
+        if (in == inEnd) {
+            return false;
+        }
+        auto token = *in++;
+
+        SIZE_T literalLength = token >> 4;
+        if (literalLength == LZ_RUN_MASK && !readExtraLength(in, inEnd, literalLength)) {
+            return false;
+        }
+        if ((SIZE_T)(inEnd - in) < literalLength || (SIZE_T)(outEnd - out) < literalLength) {
+            return false;
+        }
+        if (literalLength <= LZ_FAST_COPY && inEnd - in >= LZ_FAST_COPY && outEnd - out >= LZ_FAST_COPY) {
+            // Short runs are the common case, a fixed size copy beats a call
+            memcpy(out, in, LZ_FAST_COPY);
+        }
+        else if (literalLength) {
+            memcpy(out, in, literalLength);
+        }
+        in += literalLength;
+        out += literalLength;
+        if (in == inEnd) {
+            // That was the last sequence
+            return out == outEnd;
+        }
+
+        if (inEnd - in < 2) {
+            return false;
+        }
+        SIZE_T offset = in[0] | (SIZE_T)in[1] << 8;
+        in += 2;
+        SIZE_T matchLength = token & LZ_RUN_MASK;
+        if (matchLength == LZ_RUN_MASK && !readExtraLength(in, inEnd, matchLength)) {
+            return false;
+        }
+        matchLength += LZ_MIN_MATCH;
+        if (offset == 0 || offset > (SIZE_T)(out - begin) || (SIZE_T)(outEnd - out) < matchLength) {
+            return false;
+        }
+
+        auto match = out - offset;
+        auto matchOutEnd = out + matchLength;
+        if (offset >= 8 && (SIZE_T)(outEnd - out) >= matchLength + 8) {
+            // 8 bytes at a time, running over the end is fine with room left, later
+            // sequences write there
+            do {
+                memcpy(out, match, 8);
+                out += 8;
+                match += 8;
+            } while (out < matchOutEnd);
+            out = matchOutEnd;
+        }
+        else if (offset >= matchLength) {
+            memcpy(out, match, matchLength);
+            out = matchOutEnd;
+        }
+        else {
+            // Overlapping, a short pattern repeated
+            while (out < matchOutEnd) {
+                *out++ = *match++;
+            }
+        }
+    }
+}
@@ -0,0 +1,40 @@
+/*
+ * A small LZ77 block codec in the spirit of LZ4, for data that is written once and read
+ * often (compiled shader bytecode in ShaderDiskCache). Compression is greedy with a single
+ * hash probe per position, decompression is a plain copy loop, so decoding runs at memory
+ * speed rather than disk speed.
+ *
+ * A block is a run of sequences, each:
+ *     token                  - literal count in the high nibble, match length - 4 in the low
+ *     [literal count bytes]  - if the nibble was 15, add bytes till one is below 255
+ *     literals
+ *     offset                 - 2 bytes little endian, back from the current output position
+ *     [match length bytes]   - as for the literal count
+ * The last sequence stops after its literals. The block does not store its decoded size, the
+ * caller keeps that and passes it to decompress().
+ * Like ShaderManager this has no dependence on Orbiter headers.
+ */
+
+#pragma once
+
+// Local
+#include "Platform.h" // for the Win32 types
+
+namespace ClientUtils {
+
+class LZCodec
+{
+public:
+    // The most compress() can make of sourceLength bytes, for incompressible data
+    static SIZE_T compressBound(SIZE_T sourceLength);
+
+    // Returns the compressed length, 0 if it does not fit in destCapacity. Passing less than
+    // the bound is the way to only keep results that save something.
+    static SIZE_T compress(const void *source, SIZE_T sourceLength, void *dest, SIZE_T destCapacity);
+
+    // Decodes a whole block into exactly destLength bytes. False if the block is damaged or
+    // decodes to any other length, never reads or writes outside the buffers.
+    static bool decompress(const void *source, SIZE_T sourceLength, void *dest, SIZE_T destLength);
+};
+
+} // namespace ClientUtils
@@ -0,0 +1,75 @@
+/*
+ * Impl
+ */
+
+// Self
+#include "MappedFile.h"
+
+using namespace ClientUtils;
+
+MappedFile::MappedFile()
+    : m_hFile(INVALID_HANDLE_VALUE)
+    , m_hMapping(nullptr)
+    , m_pView(nullptr)
+    , m_size(0)
+{
+}
+
+MappedFile::~MappedFile()
+{
+    close();
+}
+
+bool
+MappedFile::open(const TCHAR * fileName)
+{
+    close();
+
+    // Others may append to the file while it is mapped, the view keeps its original size. They
+    // may also rename it or replace it, the view keeps the file it was made from.
+    m_hFile = ::CreateFile(fileName, GENERIC_READ,
+                           FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                           nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0);
+    if (m_hFile == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+
+    LARGE_INTEGER fileSize;
+    if (!::GetFileSizeEx(m_hFile, &fileSize) || fileSize.QuadPart == 0) {
+        // Empty files cannot be mapped
+        close();
+        return false;
+    }
+
+    m_hMapping = ::CreateFileMapping(m_hFile, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (!m_hMapping) {
+        close();
+        return false;
+    }
+
+    m_pView = (const BYTE*)::MapViewOfFile(m_hMapping, FILE_MAP_READ, 0, 0, 0);
+    if (!m_pView) {
+        close();
+        return false;
+    }
+    m_size = (SIZE_T)fileSize.QuadPart;
+    return true;
+}
+
+void
+MappedFile::close()
+{
+    if (m_pView) {
+        ::UnmapViewOfFile(m_pView);
+        m_pView = nullptr;
+    }
+    if (m_hMapping) {
+        ::CloseHandle(m_hMapping);
+        m_hMapping = nullptr;
+    }
+    if (m_hFile != INVALID_HANDLE_VALUE) {
+        ::CloseHandle(m_hFile);
+        m_hFile = INVALID_HANDLE_VALUE;
+    }
+    m_size = 0;
+}
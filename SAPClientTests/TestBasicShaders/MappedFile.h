@@ -0,0 +1,41 @@
+/*
+ * The MappedFile class maps a whole file read-only into the address space. The view stays
+ * valid till close() is called or the object is destroyed, so pointers into data() can be
+ * handed out without copying the file contents. The file may be appended to by others while
+ * mapped, size() stays what it was when open() was called.
+ * Like ShaderManager this has no dependence on Orbiter headers.
+ */
+
+#pragma once
+
+// Local
+#include "Platform.h" // for the Win32 types
+
+namespace ClientUtils {
+
+class MappedFile
+{
+public:
+    MappedFile();
+    ~MappedFile();
+
+    // Maps the whole file, fails for missing or empty files
+    bool open(const TCHAR * fileName);
+    void close();
+
+    bool isOpen() const { return m_pView != nullptr; }
+    const BYTE * data() const { return m_pView; }
+    SIZE_T size() const { return m_size; }
+
+private:
+    // Not copyable, the view is owned
+    MappedFile(const MappedFile&);
+    MappedFile& operator=(const MappedFile&);
+
+    HANDLE m_hFile;
+    HANDLE m_hMapping;
+    const BYTE * m_pView;
+    SIZE_T m_size;
+};
+
+} // namespace ClientUtils
@@ -0,0 +1,349 @@
+/*
+ * Impl
+ */
+
+// Self
+#include "Platform.h"
+
+#ifndef _WIN32
+
+// System
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <errno.h>
+
+// std
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <mutex>
+
+namespace {
+
+// What a HANDLE points to, a file or a mapping of one
+struct PosixHandle
+{
+    int fd;
+    bool isMapping;
+    SIZE_T mappingSize;
+};
+
+int
+fdOf(HANDLE handle)
+{
+    return handle && handle != INVALID_HANDLE_VALUE ? ((PosixHandle*)handle)->fd : -1;
+}
+
+// munmap() needs the length of the view
+std::mutex sViewsMutex;
+std::map<const void*, SIZE_T> sViewSizes;
+
+} // namespace
+
+HANDLE
+CreateFile(
+    const TCHAR * fileName,
+    DWORD desiredAccess,
+    DWORD /*shareMode*/,
+    void * /*securityAttributes*/,
+    DWORD creationDisposition,
+    DWORD /*flagsAndAttributes*/,
+    HANDLE /*templateFile*/)
+{
+    int flags = (desiredAccess & GENERIC_WRITE) ? O_RDWR : O_RDONLY;
+    switch (creationDisposition) {
+    case CREATE_NEW:    flags |= O_CREAT | O_EXCL; break;
+    case CREATE_ALWAYS: flags |= O_CREAT | O_TRUNC; break;
+    case OPEN_ALWAYS:   flags |= O_CREAT; break;
+    }
+    int fd = ::open(fileName, flags | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        return INVALID_HANDLE_VALUE;
+    }
+    PosixHandle handle = { fd, false, 0 };
+    return new PosixHandle(handle);
+}
+
+BOOL
+ReadFile(
+    HANDLE hFile,
+    void * buffer,
+    DWORD bytesToRead,
+    DWORD * bytesRead,
+    void * /*overlapped*/)
+{
+    ssize_t count = ::read(fdOf(hFile), buffer, bytesToRead);
+    if (count < 0) {
+        return FALSE;
+    }
+    if (bytesRead) {
+        *bytesRead = (DWORD)count;
+    }
+    return TRUE;
+}
+
+BOOL
+WriteFile(
+    HANDLE hFile,
+    const void * buffer,
+    DWORD bytesToWrite,
+    DWORD * bytesWritten,
+    void * /*overlapped*/)
+{
+    ssize_t count = ::write(fdOf(hFile), buffer, bytesToWrite);
+    if (count < 0) {
+        return FALSE;
+    }
+    if (bytesWritten) {
+        *bytesWritten = (DWORD)count;
+    }
+    return TRUE;
+}
+
+BOOL
+SetFilePointerEx(
+    HANDLE hFile,
+    LARGE_INTEGER distance,
+    LARGE_INTEGER * newPosition,
+    DWORD moveMethod)
+{
+    int whence = moveMethod == FILE_BEGIN ? SEEK_SET : moveMethod == FILE_CURRENT ? SEEK_CUR : SEEK_END;
+    off_t position = ::lseek(fdOf(hFile), (off_t)distance.QuadPart, whence);
+    if (position < 0) {
+        return FALSE;
+    }
+    if (newPosition) {
+        newPosition->QuadPart = position;
+    }
+    return TRUE;
+}
+
+BOOL
+GetFileSizeEx(
+    HANDLE hFile,
+    LARGE_INTEGER * fileSize)
+{
+    struct stat st;
+    if (::fstat(fdOf(hFile), &st) != 0) {
+        return FALSE;
+    }
+    fileSize->QuadPart = st.st_size;
+    return TRUE;
+}
+
+BOOL
+FlushFileBuffers(
+    HANDLE hFile)
+{
+    return ::fsync(fdOf(hFile)) == 0;
+}
+
+BOOL
+CloseHandle(
+    HANDLE handle)
+{
+    if (!handle || handle == INVALID_HANDLE_VALUE) {
+        return FALSE;
+    }
+    auto posixHandle = (PosixHandle*)handle;
+    auto ok = ::close(posixHandle->fd) == 0;
+    delete posixHandle;
+    return ok;
+}
+
+namespace {
+
+BOOL
+setLock(HANDLE hFile, short type, bool wait, DWORD bytesLow, DWORD bytesHigh,
+        const OVERLAPPED * overlapped)
+{
+    struct flock lock;
+    ZeroMemory(&lock, sizeof(lock));
+    lock.l_type = type;
+    lock.l_whence = SEEK_SET;
+    lock.l_start = (off_t)(((UINT64)overlapped->OffsetHigh << 32) | overlapped->Offset);
+    lock.l_len = (off_t)(((UINT64)bytesHigh << 32) | bytesLow);
+#ifdef F_OFD_SETLKW
+    int command = wait ? F_OFD_SETLKW : F_OFD_SETLK;
+#else
+    int command = wait ? F_SETLKW : F_SETLK;
+#endif
+    int result;
+    do {
+        result = ::fcntl(fdOf(hFile), command, &lock);
+    } while (result < 0 && errno == EINTR);
+    return result == 0;
+}
+
+} // namespace
+
+BOOL
+LockFileEx(
+    HANDLE hFile,
+    DWORD flags,
+    DWORD /*reserved*/,
+    DWORD bytesLow,
+    DWORD bytesHigh,
+    OVERLAPPED * overlapped)
+{
+    return setLock(hFile, (flags & LOCKFILE_EXCLUSIVE_LOCK) ? F_WRLCK : F_RDLCK,
+                   !(flags & LOCKFILE_FAIL_IMMEDIATELY), bytesLow, bytesHigh, overlapped);
+}
+
+BOOL
+UnlockFileEx(
+    HANDLE hFile,
+    DWORD /*reserved*/,
+    DWORD bytesLow,
+    DWORD bytesHigh,
+    OVERLAPPED * overlapped)
+{
+    return setLock(hFile, F_UNLCK, false, bytesLow, bytesHigh, overlapped);
+}
+
+DWORD
+GetCurrentProcessId()
+{
+    return (DWORD)::getpid();
+}
+
+HANDLE
+CreateFileMapping(
+    HANDLE hFile,
+    void * /*securityAttributes*/,
+    DWORD protect,
+    DWORD maximumSizeHigh,
+    DWORD maximumSizeLow,
+    const TCHAR * /*name*/)
+{
+    LARGE_INTEGER fileSize;
+    if (protect != PAGE_READONLY || maximumSizeHigh || maximumSizeLow ||
+            !GetFileSizeEx(hFile, &fileSize) || fileSize.QuadPart == 0) {
+        return nullptr;
+    }
+    // The mapping outlives the file handle on Windows, so it gets its own descriptor
+    int fd = ::fcntl(fdOf(hFile), F_DUPFD_CLOEXEC, 0);
+    if (fd < 0) {
+        return nullptr;
+    }
+    PosixHandle handle = { fd, true, (SIZE_T)fileSize.QuadPart };
+    return new PosixHandle(handle);
+}
+
+void *
+MapViewOfFile(
+    HANDLE hMapping,
+    DWORD desiredAccess,
+    DWORD offsetHigh,
+    DWORD offsetLow,
+    SIZE_T bytesToMap)
+{
+    auto mapping = (PosixHandle*)hMapping;
+    if (!mapping || !mapping->isMapping || desiredAccess != FILE_MAP_READ || offsetHigh || offsetLow) {
+        return nullptr;
+    }
+    SIZE_T size = bytesToMap ? bytesToMap : mapping->mappingSize;
+    void * view = ::mmap(nullptr, size, PROT_READ, MAP_SHARED, mapping->fd, 0);
+    if (view == MAP_FAILED) {
+        return nullptr;
+    }
+    std::lock_guard<std::mutex> lock(sViewsMutex);
+    sViewSizes[view] = size;
+    return view;
+}
+
+BOOL
+UnmapViewOfFile(
+    const void * baseAddress)
+{
+    SIZE_T size;
+    {
+        std::lock_guard<std::mutex> lock(sViewsMutex);
+        auto view = sViewSizes.find(baseAddress);
+        if (view == sViewSizes.end()) {
+            return FALSE;
+        }
+        size = view->second;
+        sViewSizes.erase(view);
+    }
+    return ::munmap((void*)baseAddress, size) == 0;
+}
+
+DWORD
+GetFileAttributes(
+    const TCHAR * fileName)
+{
+    struct stat st;
+    if (::stat(fileName, &st) != 0) {
+        return INVALID_FILE_ATTRIBUTES;
+    }
+    return FILE_ATTRIBUTE_NORMAL;
+}
+
+BOOL
+CreateDirectory(
+    const TCHAR * pathName,
+    void * /*securityAttributes*/)
+{
+    return ::mkdir(pathName, 0755) == 0;
+}
+
+BOOL
+SetCurrentDirectory(
+    const TCHAR * pathName)
+{
+    return ::chdir(pathName) == 0;
+}
+
+BOOL
+MoveFileEx(
+    const TCHAR * existingFileName,
+    const TCHAR * newFileName,
+    DWORD flags)
+{
+    if (!(flags & MOVEFILE_REPLACE_EXISTING) && GetFileAttributes(newFileName) != INVALID_FILE_ATTRIBUTES) {
+        return FALSE;
+    }
+    return ::rename(existingFileName, newFileName) == 0;
+}
+
+BOOL
+DeleteFile(
+    const TCHAR * fileName)
+{
+    return ::unlink(fileName) == 0;
+}
+
+DWORD
+GetTempPath(
+    DWORD bufferLength,
+    TCHAR * buffer)
+{
+    const char * directory = ::getenv("TMPDIR");
+    std::string path = directory && *directory ? directory : "/tmp";
+    if (path[path.length() - 1] != PATH_SEPARATOR) {
+        path += PATH_SEPARATOR;
+    }
+    // As on Windows the length needed, with the terminator, if the buffer is too short
+    if (path.length() >= bufferLength) {
+        return (DWORD)path.length() + 1;
+    }
+    memcpy(buffer, path.c_str(), path.length() + 1);
+    return (DWORD)path.length();
+}
+
+#endif
+
+std::string
+ClientUtils::nativePath(const std::string& fileName)
+{
+    std::string result = fileName;
+    for (auto& c : result) {
+        if (c == '\\' || c == '/') {
+            c = PATH_SEPARATOR;
+        }
+    }
+    return result;
+}
@@ -0,0 +1,138 @@
+/*
+ * The little of Win32 that the renderer independent sources (the shader disk cache, hashing,
+ * mapped files, the worker pool, ShaderManager) use. On Windows this is just windows.h.
+ * Elsewhere the same names are declared here and implemented over POSIX in Platform.cpp, so
+ * those sources and the tools built from them (see Tools\ShaderPackBuilder) also build on a
+ * Linux box. D3DPlatform.h does the same for the D3D11 types.
+ * Only what is used is provided - add to both halves when a portable source needs more.
+ * Like ShaderManager this has no dependence on Orbiter headers.
+ */
+
+#pragma once
+
+#ifdef _WIN32
+
+// System
+#include <windows.h>
+#include <tchar.h> // for _T and TCHAR
+
+#define PATH_SEPARATOR '\\'
+
+#else
+
+// std
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+typedef unsigned char BYTE;
+typedef unsigned short WORD;
+typedef unsigned int UINT;
+typedef unsigned int DWORD;
+typedef int BOOL;
+typedef int LONG;
+typedef int64_t LONGLONG;
+typedef uint64_t UINT64;
+typedef size_t SIZE_T;
+typedef char TCHAR;
+typedef void * HANDLE;
+
+typedef union _LARGE_INTEGER {
+    struct {
+        DWORD LowPart;
+        LONG HighPart;
+    };
+    LONGLONG QuadPart;
+} LARGE_INTEGER;
+
+#define _T(x) x
+#define TRUE 1
+#define FALSE 0
+#define MAX_PATH 260
+#define INVALID_HANDLE_VALUE ((HANDLE)(intptr_t)-1)
+#define INVALID_FILE_ATTRIBUTES ((DWORD)-1)
+
+#define GENERIC_READ 0x80000000
+#define GENERIC_WRITE 0x40000000
+#define FILE_SHARE_READ 0x1
+#define FILE_SHARE_WRITE 0x2
+#define FILE_SHARE_DELETE 0x4
+#define CREATE_NEW 1
+#define CREATE_ALWAYS 2
+#define OPEN_EXISTING 3
+#define OPEN_ALWAYS 4
+#define FILE_ATTRIBUTE_NORMAL 0x80
+#define FILE_BEGIN 0
+#define FILE_CURRENT 1
+#define FILE_END 2
+#define PAGE_READONLY 0x2
+#define FILE_MAP_READ 0x4
+#define MOVEFILE_REPLACE_EXISTING 0x1
+#define LOCKFILE_FAIL_IMMEDIATELY 0x1
+#define LOCKFILE_EXCLUSIVE_LOCK 0x2
+
+#define ZeroMemory(dest, length) memset((dest), 0, (length))
+#define CopyMemory(dest, src, length) memcpy((dest), (src), (length))
+
+#define PATH_SEPARATOR '/'
+
+// Only the offset is used, for LockFileEx()
+typedef struct _OVERLAPPED {
+    DWORD Offset;
+    DWORD OffsetHigh;
+    HANDLE hEvent;
+} OVERLAPPED;
+
+// Files, handles are closed with CloseHandle(). Share modes, security attributes, flags and
+// templates are accepted and ignored.
+HANDLE CreateFile(const TCHAR * fileName, DWORD desiredAccess, DWORD shareMode,
+                  void * securityAttributes, DWORD creationDisposition,
+                  DWORD flagsAndAttributes, HANDLE templateFile);
+BOOL ReadFile(HANDLE hFile, void * buffer, DWORD bytesToRead, DWORD * bytesRead, void * overlapped);
+BOOL WriteFile(HANDLE hFile, const void * buffer, DWORD bytesToWrite, DWORD * bytesWritten,
+               void * overlapped);
+BOOL SetFilePointerEx(HANDLE hFile, LARGE_INTEGER distance, LARGE_INTEGER * newPosition,
+                      DWORD moveMethod);
+BOOL GetFileSizeEx(HANDLE hFile, LARGE_INTEGER * fileSize);
+// fsync()
+BOOL FlushFileBuffers(HANDLE hFile);
+BOOL CloseHandle(HANDLE handle);
+
+// Byte range locks over fcntl() locks owned by the open file (OFD locks where there are any).
+// Unlike on Windows they exclude other processes and other handles, not threads sharing a
+// handle.
+BOOL LockFileEx(HANDLE hFile, DWORD flags, DWORD reserved, DWORD bytesLow, DWORD bytesHigh,
+                OVERLAPPED * overlapped);
+BOOL UnlockFileEx(HANDLE hFile, DWORD reserved, DWORD bytesLow, DWORD bytesHigh,
+                  OVERLAPPED * overlapped);
+
+DWORD GetCurrentProcessId();
+
+// Read-only mappings of whole files only
+HANDLE CreateFileMapping(HANDLE hFile, void * securityAttributes, DWORD protect,
+                         DWORD maximumSizeHigh, DWORD maximumSizeLow, const TCHAR * name);
+void * MapViewOfFile(HANDLE hMapping, DWORD desiredAccess, DWORD offsetHigh, DWORD offsetLow,
+                     SIZE_T bytesToMap);
+BOOL UnmapViewOfFile(const void * baseAddress);
+
+// File system
+DWORD GetFileAttributes(const TCHAR * fileName);
+BOOL CreateDirectory(const TCHAR * pathName, void * securityAttributes);
+BOOL SetCurrentDirectory(const TCHAR * pathName);
+BOOL MoveFileEx(const TCHAR * existingFileName, const TCHAR * newFileName, DWORD flags);
+BOOL DeleteFile(const TCHAR * fileName);
+// $TMPDIR or /tmp, with a trailing separator
+DWORD GetTempPath(DWORD bufferLength, TCHAR * buffer);
+
+#endif
+
+// std
+#include <string>
+
+namespace ClientUtils {
+
+// File names in the client are written with backslashes (the purpose map etc.), this turns
+// them into something the platform can open
+std::string nativePath(const std::string& fileName);
+
+} // namespace ClientUtils
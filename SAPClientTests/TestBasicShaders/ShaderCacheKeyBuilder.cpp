@@ -0,0 +1,100 @@
+/*
+ * Impl
+ */
+
+// Self
+#include "ShaderCacheKeyBuilder.h"
+
+// std
+#include <fstream>
+#include <iterator>
+#include <algorithm>
+
+using namespace Rendering;
+
+ShaderCacheKeyBuilder::ShaderCacheKeyBuilder(UINT compileFlags)
+    : m_compileFlags(compileFlags)
+{
+}
+
+void
+ShaderCacheKeyBuilder::createDefinesString(const ShaderDefines& defines, std::string& result)
+{
+    result.clear();
+    ShaderDefines sortedDefines = defines;
+    std::sort(sortedDefines.begin(), sortedDefines.end());
+    for (const auto& define : sortedDefines) {
+        result += define.first + "=" + define.second + ";";
+    }
+}
+
+bool
+ShaderCacheKeyBuilder::createKey(
+    const std::string& shaderFileName,
+    const std::string& entryPoint,
+    const std::string& shaderProfile,
+    const std::string& definesStr,
+    std::string& result)
+{
+    ClientUtils::Hash128 sourceHash;
+    if (!getSourceHash(shaderFileName, sourceHash)) {
+        return false;
+    }
+
+    ClientUtils::Hasher hasher;
+    hasher.updateValue(sourceHash);
+    hasher.update(entryPoint);
+    hasher.update(shaderProfile);
+    hasher.update(definesStr);
+    hasher.updateValue(m_compileFlags);
+    result = hasher.finish().toString();
+    return true;
+}
+
+bool
+ShaderCacheKeyBuilder::getSourceHash(const std::string& shaderFileName, ClientUtils::Hash128& result)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_sourceHashesMutex);
+        auto cached = m_sourceHashes.find(shaderFileName);
+        if (cached != m_sourceHashes.end()) {
+            result = cached->second;
+            return true;
+        }
+    }
+
+    std::ifstream file(ClientUtils::nativePath(shaderFileName), std::ios::binary);
+    if (!file) {
+        return false;
+    }
+    std::vector<char> source((std::istreambuf_iterator<char>(file)),
+                             std::istreambuf_iterator<char>());
+
+    ClientUtils::Hasher hasher;
+    hasher.update(source.data(), source.size());
+    result = hasher.finish();
+
+    std::lock_guard<std::mutex> lock(m_sourceHashesMutex);
+    m_sourceHashes[shaderFileName] = result;
+    return true;
+}
+
+void
+ShaderCacheKeyBuilder::setSourceHash(const std::string& shaderFileName, const ClientUtils::Hash128& hash)
+{
+    std::lock_guard<std::mutex> lock(m_sourceHashesMutex);
+    m_sourceHashes.insert(std::make_pair(shaderFileName, hash));
+}
+
+bool
+ShaderCacheKeyBuilder::dependenciesUnchanged(const std::vector<ShaderDependency>& dependencies)
+{
+    for (const auto& dependency : dependencies) {
+        ClientUtils::Hash128 currentHash;
+        if (!getSourceHash(dependency.fileName, currentHash) ||
+                currentHash != dependency.contentHash) {
+            return false;
+        }
+    }
+    return true;
+}
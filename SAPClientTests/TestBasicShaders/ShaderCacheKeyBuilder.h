@@ -0,0 +1,62 @@
+/*
+ * The ShaderCacheKeyBuilder class makes the keys shaders are stored under in the
+ * ShaderDiskCache, and checks that the files an entry was compiled from are still the same.
+ * A key is a hash of the source bytes, defines, profile, compile flags and entry point. Both
+ * ShaderManager and the offline pack builder (Tools\ShaderPackBuilder) go through here, so a
+ * pack built ahead of time is found by the client as long as the sources and flags agree.
+ * Safe to use from several threads at once.
+ * Like ShaderManager this has no dependence on Orbiter headers.
+ */
+
+#pragma once
+
+// std
+#include <map>
+#include <string>
+#include <vector>
+#include <mutex>
+
+// Local
+#include "Platform.h"
+#include "Hasher.h"
+#include "ShaderCompiler.h" // for ShaderDefines
+#include "ShaderDiskCache.h" // for ShaderDependency
+
+namespace Rendering {
+
+class ShaderCacheKeyBuilder
+{
+public:
+    // compileFlags are D3D11Config::iShaderCompileFlag, part of every key
+    explicit ShaderCacheKeyBuilder(UINT compileFlags);
+
+    UINT getCompileFlags() const { return m_compileFlags; }
+
+    // Canonical "NAME=VALUE;" list of the defines sorted by name, so the same macro set always
+    // gives the same string
+    static void createDefinesString(const ShaderDefines& defines, std::string& result);
+
+    // Fails if the source cannot be read
+    bool createKey(const std::string& shaderFileName,
+                   const std::string& entryPoint,
+                   const std::string& shaderProfile,
+                   const std::string& definesStr,
+                   std::string& result);
+
+    // Source file hashes are computed once per session, file names as in the purpose map
+    bool getSourceHash(const std::string& shaderFileName, ClientUtils::Hash128& result);
+
+    // For files a compiler has just read, no need to read them again this session
+    void setSourceHash(const std::string& shaderFileName, const ClientUtils::Hash128& hash);
+
+    // True if every included file still hashes to what it did when the entry was compiled
+    bool dependenciesUnchanged(const std::vector<ShaderDependency>& dependencies);
+
+private:
+    UINT m_compileFlags;
+
+    std::map<std::string, ClientUtils::Hash128> m_sourceHashes;
+    std::mutex m_sourceHashesMutex;
+};
+
+} // namespace Rendering
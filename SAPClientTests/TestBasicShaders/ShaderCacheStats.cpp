@@ -0,0 +1,254 @@
+/*
+ * Impl
+ */
+
+// Self
+#include "ShaderCacheStats.h"
+
+// std
+#include <cstdio>
+
+using namespace Rendering;
+
+const UINT LatencyHistogram::sBucketCount;
+std::atomic<UINT> ShaderCacheStats::sNextShard(0);
+
+LatencyHistogram::LatencyHistogram()
+    : m_count(0)
+    , m_totalMicroseconds(0)
+    , m_maxMicroseconds(0)
+{
+    for (UINT bucket = 0; bucket < sBucketCount; ++bucket) {
+        m_buckets[bucket].store(0, std::memory_order_relaxed);
+    }
+}
+
+LatencyHistogram::LatencyHistogram(const LatencyHistogram& other)
+{
+    *this = other;
+}
+
+LatencyHistogram&
+LatencyHistogram::operator=(const LatencyHistogram& other)
+{
+    for (UINT bucket = 0; bucket < sBucketCount; ++bucket) {
+        m_buckets[bucket].store(other.getBucketCount(bucket), std::memory_order_relaxed);
+    }
+    m_count.store(other.getCount(), std::memory_order_relaxed);
+    m_totalMicroseconds.store(other.getTotalMicroseconds(), std::memory_order_relaxed);
+    m_maxMicroseconds.store(other.getMaxMicroseconds(), std::memory_order_relaxed);
+    return *this;
+}
+
+void
+LatencyHistogram::record(UINT64 microseconds)
+{
+    UINT bucket = 0;
+    while (bucket < sBucketCount - 1 && microseconds >= getBucketLimit(bucket)) {
+        ++bucket;
+    }
+    // Only counters, nothing is ordered against them
+    m_buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+    m_count.fetch_add(1, std::memory_order_relaxed);
+    m_totalMicroseconds.fetch_add(microseconds, std::memory_order_relaxed);
+    UINT64 max = getMaxMicroseconds();
+    while (microseconds > max &&
+           !m_maxMicroseconds.compare_exchange_weak(max, microseconds, std::memory_order_relaxed)) {
+    }
+}
+
+UINT64
+LatencyHistogram::getPercentile(double fraction) const
+{
+    UINT64 count = getCount();
+    UINT64 max = getMaxMicroseconds();
+    if (!count) {
+        return 0;
+    }
+    auto wanted = (UINT64)(fraction * count + 0.5);
+    if (wanted < 1) {
+        wanted = 1;
+    }
+    UINT64 seen = 0;
+    for (UINT bucket = 0; bucket < sBucketCount - 1; ++bucket) {
+        seen += getBucketCount(bucket);
+        if (seen >= wanted) {
+            auto limit = getBucketLimit(bucket);
+            return limit < max ? limit : max;
+        }
+    }
+    return max;
+}
+
+void
+LatencyHistogram::add(const LatencyHistogram& other)
+{
+    for (UINT bucket = 0; bucket < sBucketCount; ++bucket) {
+        m_buckets[bucket].fetch_add(other.getBucketCount(bucket), std::memory_order_relaxed);
+    }
+    m_count.fetch_add(other.getCount(), std::memory_order_relaxed);
+    m_totalMicroseconds.fetch_add(other.getTotalMicroseconds(), std::memory_order_relaxed);
+    UINT64 max = getMaxMicroseconds();
+    UINT64 otherMax = other.getMaxMicroseconds();
+    while (otherMax > max &&
+           !m_maxMicroseconds.compare_exchange_weak(max, otherMax, std::memory_order_relaxed)) {
+    }
+}
+
+UINT64
+ShaderCacheStats::MemoryHitCounters::getTotal() const
+{
+    UINT64 total = 0;
+    for (const auto& shard : shards) {
+        total += shard.count.load(std::memory_order_relaxed);
+    }
+    return total;
+}
+
+void
+ShaderCacheStats::MemoryHitCounters::reset()
+{
+    for (auto& shard : shards) {
+        shard.count.store(0, std::memory_order_relaxed);
+    }
+}
+
+const char *
+ShaderCacheStats::getTierName(ShaderCacheTier tier)
+{
+    static const char * names[SHADER_TIER_COUNT] = { "memory", "disk", "compile" };
+    return names[tier];
+}
+
+UINT
+ShaderCacheStats::getPurposeId(const std::string& purpose)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto found = m_purposeIds.find(purpose);
+    if (found != m_purposeIds.end()) {
+        return found->second;
+    }
+    if (!m_purposes.append() || !m_memoryHits.append()) {
+        return sInvalidPurposeId;
+    }
+    UINT id = m_purposes.publish();
+    m_memoryHits.publish();
+    m_purposeNames.push_back(purpose);
+    m_purposeIds[purpose] = id;
+    return id;
+}
+
+void
+ShaderCacheStats::recordLookup(UINT purposeId, ShaderCacheTier tier, UINT64 microseconds)
+{
+    if (purposeId < m_purposes.size()) {
+        m_purposes[purposeId].tiers[tier].record(microseconds);
+    }
+}
+
+void
+ShaderCacheStats::recordFailure(UINT purposeId)
+{
+    if (purposeId < m_purposes.size()) {
+        m_purposes[purposeId].failures.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+std::map<std::string, ShaderPurposeStats>
+ShaderCacheStats::getPurposeStats() const
+{
+    std::map<std::string, ShaderPurposeStats> result;
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (UINT id = 0; id < m_purposeNames.size(); ++id) {
+        auto& stats = result[m_purposeNames[id]];
+        stats = m_purposes[id];
+        stats.memoryHits = m_memoryHits[id].getTotal();
+    }
+    return result;
+}
+
+ShaderPurposeStats
+ShaderCacheStats::getTotals() const
+{
+    ShaderPurposeStats totals;
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (UINT id = 0; id < m_purposeNames.size(); ++id) {
+        const auto& purpose = m_purposes[id];
+        for (UINT tier = 0; tier < SHADER_TIER_COUNT; ++tier) {
+            totals.tiers[tier].add(purpose.tiers[tier]);
+        }
+        totals.memoryHits += m_memoryHits[id].getTotal();
+        totals.failures += purpose.failures;
+    }
+    return totals;
+}
+
+void
+ShaderCacheStats::reset()
+{
+    // Ids stay valid, only the figures go. Lookups recorded meanwhile may be half kept.
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (UINT id = 0; id < m_purposeNames.size(); ++id) {
+        m_purposes[id] = ShaderPurposeStats();
+        m_memoryHits[id].reset();
+    }
+}
+
+void
+ShaderCacheStats::formatPurpose(const std::string& name, const ShaderPurposeStats& stats,
+                                std::string& line)
+{
+    char buffer[160];
+    line = "Shader cache: " + name + ":";
+    for (UINT tier = 0; tier < SHADER_TIER_COUNT; ++tier) {
+        const auto& histogram = stats.tiers[tier];
+        if (!histogram.getCount()) {
+            // Memory cache hits are not timed
+            snprintf(buffer, sizeof(buffer), " %s %llu,", getTierName((ShaderCacheTier)tier),
+                     (unsigned long long)stats.getCount((ShaderCacheTier)tier));
+        }
+        else {
+            snprintf(buffer, sizeof(buffer),
+                     " %s %llu (avg %llu us, p50 <= %llu us, p99 <= %llu us, max %llu us),",
+                     getTierName((ShaderCacheTier)tier),
+                     (unsigned long long)histogram.getCount(),
+                     (unsigned long long)(histogram.getTotalMicroseconds() / histogram.getCount()),
+                     (unsigned long long)histogram.getPercentile(0.5),
+                     (unsigned long long)histogram.getPercentile(0.99),
+                     (unsigned long long)histogram.getMaxMicroseconds());
+        }
+        line += buffer;
+    }
+    snprintf(buffer, sizeof(buffer), " failed %llu", (unsigned long long)stats.failures);
+    line += buffer;
+}
+
+void
+ShaderCacheStats::formatReport(
+    UINT64 diskBytesRead,
+    UINT64 diskBytesWritten,
+    UINT64 diskQueueFullWaits,
+    UINT64 diskBytesDecompressed,
+    UINT64 diskDecompressMicroseconds,
+    std::vector<std::string>& lines) const
+{
+    lines.clear();
+    std::string line;
+    for (const auto& purpose : getPurposeStats()) {
+        formatPurpose(purpose.first, purpose.second, line);
+        lines.push_back(line);
+    }
+    formatPurpose("total", getTotals(), line);
+    lines.push_back(line);
+
+    char buffer[200];
+    snprintf(buffer, sizeof(buffer),
+             "Shader cache: disk read %llu bytes, written %llu bytes, %llu waits for the writer, "
+             "%llu bytes decompressed in %llu us",
+             (unsigned long long)diskBytesRead,
+             (unsigned long long)diskBytesWritten,
+             (unsigned long long)diskQueueFullWaits,
+             (unsigned long long)diskBytesDecompressed,
+             (unsigned long long)diskDecompressMicroseconds);
+    lines.push_back(buffer);
+}
@@ -0,0 +1,189 @@
+/*
+ * Counters for ShaderManager::getShader(). Every lookup is counted against its purpose and the
+ * tier that served it - the memory cache, the disk cache or a compile. Disk cache hits and
+ * compiles also get a histogram of how long they took, so cache effectiveness and startup
+ * regressions show up in numbers. Memory cache hits and failed lookups are only counted.
+ * The stats can be read at any time (getPurposeStats() etc.) and the client writes
+ * formatReport() to the Orbiter log when the session closes.
+ * Purposes are interned by getPurposeId() so recording takes no strings.
+ * Safe to use from several threads at once. Recording takes no lock, the counters are atomics
+ * and the per purpose stats never move; only interning a new purpose and reading the stats out
+ * lock. Memory cache hits are the hot path, drawing code gets its shaders every frame from
+ * several threads, so they are not timed and each thread counts them in its own shard (see
+ * MemoryHitCounters) instead of all writing the same cache line.
+ * Like ShaderManager this has no dependence on Orbiter headers.
+ */
+
+#pragma once
+
+// std
+#include <map>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <atomic>
+
+// Local
+#include "Platform.h"
+#include "AppendOnlyArray.h"
+
+#define SHADER_STATS_HIT_SHARDS 16          // threads beyond that share shards
+#define SHADER_STATS_CACHE_LINE 64
+
+namespace Rendering {
+
+enum ShaderCacheTier
+{
+    SHADER_TIER_MEMORY,
+    SHADER_TIER_DISK,
+    SHADER_TIER_COMPILE,
+    SHADER_TIER_COUNT
+};
+
+/*
+ * Latencies in microseconds in power of 2 buckets: bucket 0 holds samples under 1 us, bucket
+ * i those from 2^(i-1) up to 2^i us. The last bucket takes everything longer.
+ * record() may be called from several threads at once. A copy taken meanwhile is consistent
+ * per counter, not across them.
+ */
+class LatencyHistogram
+{
+public:
+    static const UINT sBucketCount = 24;    // the last one starts at 2^22 us, about 4 s
+
+    LatencyHistogram();
+    LatencyHistogram(const LatencyHistogram& other);
+    LatencyHistogram& operator=(const LatencyHistogram& other);
+
+    void record(UINT64 microseconds);
+
+    UINT64 getCount() const { return m_count.load(std::memory_order_relaxed); }
+    UINT64 getTotalMicroseconds() const { return m_totalMicroseconds.load(std::memory_order_relaxed); }
+    UINT64 getMaxMicroseconds() const { return m_maxMicroseconds.load(std::memory_order_relaxed); }
+    UINT64 getBucketCount(UINT bucket) const { return m_buckets[bucket].load(std::memory_order_relaxed); }
+
+    // Samples in the bucket are below this many microseconds, except for the last bucket
+    static UINT64 getBucketLimit(UINT bucket) { return 1ULL << bucket; }
+
+    // The limit of the bucket that holds the given fraction (0.5, 0.99 ..) of the samples, so
+    // an upper bound of the percentile. The max if that is in the last bucket, 0 if empty.
+    UINT64 getPercentile(double fraction) const;
+
+    void add(const LatencyHistogram& other);
+
+private:
+    std::atomic<UINT64> m_buckets[sBucketCount];
+    std::atomic<UINT64> m_count;
+    std::atomic<UINT64> m_totalMicroseconds;
+    std::atomic<UINT64> m_maxMicroseconds;
+};
+
+// tiers[SHADER_TIER_MEMORY] stays empty, memory cache hits are not timed and only counted
+// in memoryHits
+struct ShaderPurposeStats
+{
+    ShaderPurposeStats() : memoryHits(0), failures(0) {}
+    ShaderPurposeStats(const ShaderPurposeStats& other) { *this = other; }
+    ShaderPurposeStats& operator=(const ShaderPurposeStats& other)
+    {
+        for (UINT tier = 0; tier < SHADER_TIER_COUNT; ++tier) {
+            tiers[tier] = other.tiers[tier];
+        }
+        memoryHits = other.memoryHits;
+        failures.store(other.failures.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        return *this;
+    }
+
+    // Lookups served by the tier
+    UINT64 getCount(ShaderCacheTier tier) const
+    {
+        return tier == SHADER_TIER_MEMORY ? memoryHits : tiers[tier].getCount();
+    }
+
+    LatencyHistogram tiers[SHADER_TIER_COUNT];
+    UINT64 memoryHits;              // filled in by ShaderCacheStats when copying out
+    std::atomic<UINT64> failures;
+};
+
+class ShaderCacheStats
+{
+public:
+    static const char * getTierName(ShaderCacheTier tier);
+
+    static const UINT sInvalidPurposeId = 0xffffffff;
+
+    // Small ids handed out in order, the same one every time for a purpose.
+    // sInvalidPurposeId once there are too many purposes, recording ignores that.
+    UINT getPurposeId(const std::string& purpose);
+
+    // Lock-free. For the disk and compile tiers, memory cache hits go to recordMemoryHit().
+    void recordLookup(UINT purposeId, ShaderCacheTier tier, UINT64 microseconds);
+    void recordFailure(UINT purposeId);
+
+    // Lock-free and only writes to the calling thread's shard
+    void recordMemoryHit(UINT purposeId)
+    {
+        if (purposeId < m_memoryHits.size()) {
+            m_memoryHits[purposeId].shards[getThreadShard()].count.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    // Copies, keyed by purpose
+    std::map<std::string, ShaderPurposeStats> getPurposeStats() const;
+    // All purposes added up
+    ShaderPurposeStats getTotals() const;
+
+    void reset();
+
+    // A line per purpose and one for the totals, then one with the disk cache figures passed in
+    void formatReport(UINT64 diskBytesRead,
+                      UINT64 diskBytesWritten,
+                      UINT64 diskQueueFullWaits,
+                      UINT64 diskBytesDecompressed,
+                      UINT64 diskDecompressMicroseconds,
+                      std::vector<std::string>& lines) const;
+
+private:
+    /*
+     * The memory cache hits of a purpose, added up when the stats are read. Each shard is
+     * padded to a cache line so threads counting hits of the same purpose do not share one.
+     * Padded rather than aligned, new only guarantees the default alignment.
+     */
+    struct MemoryHitCounters
+    {
+        struct Shard
+        {
+            Shard() : count(0) {}
+            std::atomic<UINT64> count;
+            char padding[SHADER_STATS_CACHE_LINE - sizeof(std::atomic<UINT64>)];
+        };
+
+        UINT64 getTotal() const;
+        void reset();
+
+        Shard shards[SHADER_STATS_HIT_SHARDS];
+    };
+
+    // Handed out round robin to threads as they first record a hit
+    static UINT getThreadShard()
+    {
+        static thread_local UINT shard = sNextShard.fetch_add(1, std::memory_order_relaxed) %
+                                         SHADER_STATS_HIT_SHARDS;
+        return shard;
+    }
+    static std::atomic<UINT> sNextShard;
+
+    static void formatPurpose(const std::string& name, const ShaderPurposeStats& stats,
+                              std::string& line);
+
+    // Guards the ids and names, appending to m_purposes and reading the stats out
+    mutable std::mutex m_mutex;
+    std::map<std::string, UINT> m_purposeIds;
+    // Indexed by purpose id
+    std::vector<std::string> m_purposeNames;
+    ClientUtils::AppendOnlyArray<ShaderPurposeStats, 4, 64> m_purposes;
+    // Indexed by purpose id as well, appended together with m_purposes
+    ClientUtils::AppendOnlyArray<MemoryHitCounters, 4, 64> m_memoryHits;
+};
+
+} // namespace Rendering
@@ -0,0 +1,77 @@
+/*
+ * Impl
+ */
+
+// Self
+#include "ShaderCatalog.h"
+
+using namespace Rendering;
+
+/* Init shader purpose vs file name map - make an entry here for any new shader purposes
+ * Shader file names must include the path from the Orbiter directory as the exe is
+ * launched with that set as the working directory.
+ */
+const std::map<std::string, std::string> ShaderCatalog::m_shaderPurposeVsFileNameMap = {
+     { "VertexShader", "Modules\\D3D11Shaders\\Test\\TestVertexShader.fx" }
+    ,{ "PixelShader",  "Modules\\D3D11Shaders\\Test\\TestPixelShader.fx" }
+    ,{ "CelSphere",    "Modules\\D3D11Shaders\\CelSphere.fx" }
+};
+
+/* Init the shaders loaded by warmUp() - make an entry here for any shader that is needed
+ * before or during the first frames, so it does not have to be loaded when first drawn.
+ * Only list entry points and defines that really exist, a failed compile shows an error.
+ */
+const std::vector<ShaderPermutation> ShaderCatalog::m_expectedPermutations = {
+     ShaderPermutation("CelSphere", "VS_Star_Line", SHADER_STAGE_VERTEX)
+    ,ShaderPermutation("CelSphere", "PS_Star",      SHADER_STAGE_PIXEL)
+    ,ShaderPermutation("CelSphere", "PS_Line",      SHADER_STAGE_PIXEL)
+};
+
+const TCHAR *
+ShaderCatalog::getProfileName(ShaderStage stage, ShaderLevel level)
+{
+    // Indexed by level then stage: vs ps gs cs hs ds. The geometry shader profiles below 10_0
+    // do not exist, neither does that stage on those devices.
+    static const TCHAR * profiles[SHADER_LEVEL_COUNT][SHADER_STAGE_COUNT] = {
+        { _T("vs_4_0_level_9_1"), _T("ps_4_0_level_9_1"), nullptr, nullptr, nullptr, nullptr },
+        { _T("vs_4_0_level_9_3"), _T("ps_4_0_level_9_3"), nullptr, nullptr, nullptr, nullptr },
+        { _T("vs_4_0"), _T("ps_4_0"), _T("gs_4_0"), nullptr, nullptr, nullptr },
+        { _T("vs_5_0"), _T("ps_5_0"), _T("gs_5_0"), _T("cs_5_0"), _T("hs_5_0"), _T("ds_5_0") }
+    };
+    return profiles[level][stage];
+}
+
+const TCHAR *
+ShaderCatalog::getLevelName(ShaderLevel level)
+{
+    static const TCHAR * names[SHADER_LEVEL_COUNT] = {
+        _T("9_1"), _T("9_3"), _T("10_0"), _T("11_0")
+    };
+    return names[level];
+}
+
+bool
+ShaderCatalog::getLevel(const std::string& name, ShaderLevel& level)
+{
+    for (UINT candidate = 0; candidate < SHADER_LEVEL_COUNT; ++candidate) {
+        if (name == getLevelName((ShaderLevel)candidate)) {
+            level = (ShaderLevel)candidate;
+            return true;
+        }
+    }
+    return false;
+}
+
+void
+ShaderCatalog::getFeatureDefines(ShaderFeatures features, ShaderDefines& defines)
+{
+    // Indexed by bit number, see ShaderFeature
+    static const char * names[SHADER_FEATURE_COUNT] = {
+        "NORMAL_MAP", "BUMP_MAP", "SPECULAR_MAP", "EMISSIVE_MAP"
+    };
+    for (UINT bit = 0; bit < SHADER_FEATURE_COUNT; ++bit) {
+        if (features & (1 << bit)) {
+            defines.push_back(std::make_pair(names[bit], "1"));
+        }
+    }
+}
@@ -0,0 +1,110 @@
+/*
+ * The ShaderCatalog lists the shaders the client knows about: which file each shader purpose
+ * is compiled from, and the permutations (entry point, stage, defines) that are needed early
+ * on. ShaderManager looks purposes up here and warms up the expected permutations at startup,
+ * the offline pack builder (Tools\ShaderPackBuilder) compiles the same list ahead of time.
+ * It also lists the optional features a shader can be compiled with and the define each one
+ * turns on, a set of features is a permutation of the shader.
+ * Like ShaderManager this has no dependence on Orbiter headers, or on D3D.
+ */
+
+#pragma once
+
+// std
+#include <map>
+#include <string>
+#include <vector>
+
+// Local
+#include "Platform.h"
+#include "ShaderCompiler.h" // for ShaderDefines
+
+namespace Rendering {
+
+enum ShaderStage
+{
+    SHADER_STAGE_VERTEX,
+    SHADER_STAGE_PIXEL,
+    SHADER_STAGE_GEOMETRY,
+    SHADER_STAGE_COMPUTE,
+    SHADER_STAGE_HULL,
+    SHADER_STAGE_DOMAIN
+};
+#define SHADER_STAGE_COUNT 6
+
+/*
+ * The device feature levels as far as shaders go, each has its own set of profiles (see
+ * ShaderCatalog::getProfileName()). 9_2 runs the 9_1 profiles and 10_1 the 10_0 ones.
+ */
+enum ShaderLevel
+{
+    SHADER_LEVEL_9_1,
+    SHADER_LEVEL_9_3,
+    SHADER_LEVEL_10_0,
+    SHADER_LEVEL_11_0,
+    SHADER_LEVEL_COUNT
+};
+
+/*
+ * Optional shader features, OR'ed together into ShaderFeatures. Each is a define the shader
+ * source tests with #ifdef. A ShaderFeatures value doubles as the permutation id, so it is
+ * below SHADER_PERMUTATION_COUNT. Keep the bits dense when adding features.
+ */
+enum ShaderFeature
+{
+    SHADER_FEATURE_NORMAL_MAP   = 1 << 0,
+    SHADER_FEATURE_BUMP_MAP     = 1 << 1,
+    SHADER_FEATURE_SPECULAR_MAP = 1 << 2,
+    SHADER_FEATURE_EMISSIVE_MAP = 1 << 3
+};
+typedef UINT ShaderFeatures;
+
+#define SHADER_FEATURE_COUNT 4
+#define SHADER_PERMUTATION_COUNT (1 << SHADER_FEATURE_COUNT)
+
+/*
+ * One shader to load ahead of time, through ShaderManager::warmUp() in the client or into a
+ * pack by the pack builder. The stage picks the shader type and so the profile.
+ */
+struct ShaderPermutation
+{
+    ShaderPermutation(const std::string& purpose,
+                      const std::string& entryPoint,
+                      ShaderStage stage,
+                      const ShaderDefines& defines = ShaderDefines())
+        : purpose(purpose)
+        , entryPoint(entryPoint)
+        , stage(stage)
+        , defines(defines)
+    {
+    }
+
+    std::string purpose;
+    std::string entryPoint;
+    ShaderStage stage;
+    ShaderDefines defines;
+};
+
+class ShaderCatalog
+{
+public:
+    // Shader purpose vs filename mapping
+    static const std::map<std::string, std::string> m_shaderPurposeVsFileNameMap;
+    // Shaders the client is known to ask for early on
+    static const std::vector<ShaderPermutation> m_expectedPermutations;
+
+    // The profile the client compiles a stage with at a feature level, "vs_5_0",
+    // "ps_4_0_level_9_3" etc. Null if the level does not have the stage, as compute, hull and
+    // domain shaders below 11_0. InitShaderProfiles() sets ShaderProfile<>::name from this.
+    static const TCHAR * getProfileName(ShaderStage stage, ShaderLevel level);
+
+    // "11_0", "9_3" ... as in D3D_FEATURE_LEVEL_11_0, for the pack builder's options and output
+    static const TCHAR * getLevelName(ShaderLevel level);
+    // The other way round, false for a name that is not one of the levels
+    static bool getLevel(const std::string& name, ShaderLevel& level);
+
+    // Appends the defines for the features, in bit order
+    static void getFeatureDefines(ShaderFeatures features, ShaderDefines& defines);
+};
+
+} // namespace Rendering
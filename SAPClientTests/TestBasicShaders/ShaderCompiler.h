@@ -0,0 +1,48 @@
+/*
+ * The IShaderCompiler interface turns one entry point of an HLSL source into bytecode. It is
+ * what ShaderManager (and the offline pack builder in Tools\ShaderPackBuilder) compile through,
+ * so the compiler backend can be swapped without touching the caching around it:
+ *   D3DShaderCompiler  - the real thing, D3DX11CompileFromFile(), Windows only
+ *   StubShaderCompiler - deterministic fake bytecode, builds anywhere, for testing the cache
+ *                        archive and the tools on a box without the DirectX SDK
+ * Implementations must be safe to call from several threads at once.
+ * Like ShaderManager this has no dependence on Orbiter headers.
+ */
+
+#pragma once
+
+// std
+#include <string>
+#include <vector>
+#include <utility>
+
+// Local
+#include "Platform.h"
+#include "ShaderDiskCache.h" // for ShaderDependency
+
+namespace Rendering {
+
+// Preprocessor defines for a compile as name, value pairs
+typedef std::vector<std::pair<std::string, std::string>> ShaderDefines;
+
+class IShaderCompiler
+{
+public:
+    virtual ~IShaderCompiler() {}
+
+    /*
+     * Compiles entryPoint from shaderFileName (relative to the working directory, as in the
+     * purpose map) for profile ("vs_5_0" etc.). flags are the D3D10_SHADER_* compile flags.
+     * On success bytecode holds the result and dependencies every file pulled in through
+     * #include, with the hash of its contents as read by the compiler.
+     */
+    virtual bool compile(const std::string& shaderFileName,
+                         const std::string& entryPoint,
+                         const std::string& shaderProfile,
+                         const ShaderDefines& defines,
+                         UINT flags,
+                         std::vector<BYTE>& bytecode,
+                         std::vector<ShaderDependency>& dependencies) = 0;
+};
+
+} // namespace Rendering
@@ -3,243 +3,1190 @@
  */
 
 #include "ShaderDiskCache.h"
-#include <tchar.h>  // for _T and TCHAR
+
+// Local
+#include "LZCodec.h"
+
+// std
+#include <vector>
+#include <chrono>
+#include <algorithm>
+#include <thread>
+#include <cstddef>
 
 #if _DEBUG
-#define CACHE_FILE_SUFFIX _T(".debug.cache")
+#define CACHE_ARCHIVE_NAME _T("Shaders.debug.cache")
 #else
-#define CACHE_FILE_SUFFIX _T(".cache")
+#define CACHE_ARCHIVE_NAME _T("Shaders.cache")
 #endif
 
+#define CACHE_FILE_MAGIC 0x43444853		// "SHDC"
+#define CACHE_FORMAT_VERSION 8
+#define CACHE_INITIAL_INDEX_SLOTS 64
+#define CACHE_ENTRY_ALIGNMENT 16
+#define CACHE_MAX_PENDING_ENTRIES 256
+#define CACHE_FULL_QUEUE_WAIT_MS 2000		// longest an insert waits for room in the queue
+#define CACHE_WRITE_BATCH_DELAY_MS 100
+#define CACHE_COMPACTED_SUFFIX _T(".compacted")
+#define CACHE_RETIRED_SUFFIX _T(".retired")		// an archive moved aside while still mapped
+#define CACHE_RETIRED_FILE_COUNT 8
+#define CACHE_MIN_GARBAGE_TO_COMPACT (256 * 1024)
+#define CACHE_COMPACTION_RETRY_BATCHES 16		// skipped after a failed swap, doubling per failure
+#define CACHE_COMPACTION_MAX_RETRY_BATCHES 1024
+#define CACHE_LOCK_SUFFIX _T(".lock")
+#define CACHE_ARCHIVE_LOCK 0				// range in the lock file held by writers
+#define CACHE_FIRST_KEY_LOCK 1				// key locks follow it
+#define CACHE_KEY_LOCK_COUNT 1024
+#define CACHE_HEADER_READ_ATTEMPTS 8		// for a header another process is rewriting
+#define CACHE_MIN_COMPRESSION_SAVING 8		// compressed bytecode must be 1/n smaller to be kept
+//every open of the archive lets it be renamed and replaced under it, see swapCompactedArchive()
+#define CACHE_SHARE_MODE (FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE)
+
 using namespace Rendering;
 
-ShaderDiskCache::ShaderDiskCache(std::string& cacheRoot)
+ShaderDiskCache::ShaderDiskCache(
+    std::string& cacheRoot,
+    UINT sizeBudget,
+    const std::vector<std::string>& readOnlyRoots)
+	: m_hLockFile(INVALID_HANDLE_VALUE)
+	, m_sizeBudget(sizeBudget)
+	, m_compactionSkipBatches(0)
+	, m_compactionRetryBatches(CACHE_COMPACTION_RETRY_BATCHES)
+	, m_bArchiveChanged(false)
+	, m_bWriterBusy(true)
+	, m_flushWaiters(0)
+	, m_bStopWriter(false)
+	, m_bytesRead(0)
+	, m_bytesWritten(0)
+	, m_queueFullWaits(0)
+	, m_bytesDecompressed(0)
+	, m_decompressMicroseconds(0)
 {
     m_cacheDirectoryRoot = cacheRoot;
-	if (m_cacheDirectoryRoot[m_cacheDirectoryRoot.length() - 1] != '\\')
+	if (m_cacheDirectoryRoot[m_cacheDirectoryRoot.length() - 1] != PATH_SEPARATOR)
 	{
-		//append backslash
-		m_cacheDirectoryRoot += "\\";
+		//append the path separator
+		m_cacheDirectoryRoot += PATH_SEPARATOR;
 	}
+	m_archiveFileName = getArchiveFileName(m_cacheDirectoryRoot);
+	m_compactedFileName = m_archiveFileName + CACHE_COMPACTED_SUFFIX +
+						  std::to_string(::GetCurrentProcessId());
+	ZeroMemory(&m_compactedFrom, sizeof(m_compactedFrom));
+
+	//shared by every process using the directory, only its locks matter, never its contents
+	std::string lockFileName = m_archiveFileName + CACHE_LOCK_SUFFIX;
+	m_hLockFile = ::CreateFile(lockFileName.c_str(), GENERIC_READ | GENERIC_WRITE,
+		CACHE_SHARE_MODE, nullptr, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, 0);
+
+	//map the archive up front, a missing one is created by the first batch the writer puts out
+	mapArchive();
+
+	//the layers below are only read, a missing or unusable one is no error
+	for (const auto &root : readOnlyRoots)
+	{
+		ReadOnlyLayer layer;
+		auto fileName = getArchiveFileName(ClientUtils::nativePath(root));
+		if (openMappedArchive(fileName, layer.archive, layer.header))
+		{
+			m_readOnlyLayers.push_back(layer);
+		}
+	}
+
+	m_writerThread = std::thread(&ShaderDiskCache::writerThreadMain, this);
 }
 
 
 ShaderDiskCache::~ShaderDiskCache(void)
 {
+	//the writer drains the queue before it exits
+	{
+		std::lock_guard<std::mutex> lock(m_queueMutex);
+		m_bStopWriter = true;
+	}
+	m_writeQueueChanged.notify_all();
+	m_writerThread.join();
+
+	//the writer released every key lock it was handed
+	if (m_hLockFile != INVALID_HANDLE_VALUE)
+	{
+		CloseHandle(m_hLockFile);
+	}
 }
 
-void
-ShaderDiskCache::createCacheFileName(
-    const std::string& shaderFileName,
-    std::string& result)
+std::string
+ShaderDiskCache::getArchiveFileName(
+    const std::string& cacheRoot)
 {
-	auto index = (int)shaderFileName.find('\\');
-	std::string fileName;
-	if (index > -1)
+	std::string fileName = cacheRoot;
+	if (fileName.empty() || fileName[fileName.length() - 1] != PATH_SEPARATOR)
 	{
-		auto idx = index;
-		while(idx > -1)
-		{
-			index = idx;
-			idx = (int)shaderFileName.find('\\', idx + 1);
-		}
-		fileName = shaderFileName.substr(index + 1);
+		fileName += PATH_SEPARATOR;
 	}
-	else
+	return fileName + CACHE_ARCHIVE_NAME;
+}
+
+UINT64
+ShaderDiskCache::hashKey(const char * key, UINT keyLength)
+{
+	// FNV-1a, 0 is reserved for empty index slots
+	UINT64 hash = 14695981039346656037ULL;
+	for (UINT i = 0; i < keyLength; ++i)
 	{
-		fileName = shaderFileName;
+		hash ^= (BYTE)key[i];
+		hash *= 1099511628211ULL;
 	}
-	result = m_cacheDirectoryRoot + fileName + CACHE_FILE_SUFFIX;
+	return hash ? hash : 1;
 }
 
-void
-ShaderDiskCache::writeCacheEntry(
-    HANDLE hFile,
-    const CacheEntry & entry)
+UINT
+ShaderDiskCache::alignEntrySize(UINT size)
 {
-	DWORD dwWritten;
-	::WriteFile(hFile, &entry.keyLength, sizeof(entry.keyLength) + sizeof(entry.bytecodeLength), &dwWritten, nullptr);
-	//::WriteFile(hFile, &entry.bytecodeLength, sizeof(entry.bytecodeLength), &dwWritten, nullptr);
-	::WriteFile(hFile, entry.key, sizeof(char) * entry.keyLength, &dwWritten, nullptr);
-	::WriteFile(hFile, entry.bytecode, entry.bytecodeLength, &dwWritten, nullptr);
+	return (size + CACHE_ENTRY_ALIGNMENT - 1) & ~(UINT)(CACHE_ENTRY_ALIGNMENT - 1);
+}
+
+UINT
+ShaderDiskCache::bytecodeOffset(const CacheIndexSlot &slot)
+{
+	return alignEntrySize(sizeof(CacheRecordHeader) + slot.keyLength + slot.dependenciesLength);
+}
+
+UINT
+ShaderDiskCache::storedBytecodeLength(const CacheIndexSlot &slot)
+{
+	return slot.compressedLength ? slot.compressedLength : slot.bytecodeLength;
+}
+
+UINT
+ShaderDiskCache::recordSize(const CacheIndexSlot &slot)
+{
+	return bytecodeOffset(slot) + alignEntrySize(storedBytecodeLength(slot));
+}
 
+bool
+ShaderDiskCache::isValidHeader(const CacheFileHeader &header)
+{
+	//files from older versions of the client are not understood, treat them as empty
+	return header.magic == CACHE_FILE_MAGIC &&
+		   header.version == CACHE_FORMAT_VERSION &&
+		   header.indexSlotCount != 0 &&
+		   (header.indexSlotCount & (header.indexSlotCount - 1)) == 0 &&
+		   header.fileSize >= sizeof(CacheFileHeader) &&
+		   header.checksum == headerChecksum(header);
 }
 
 UINT
-ShaderDiskCache::calculateCacheEntrySize(const CacheEntry & entry)
+ShaderDiskCache::headerChecksum(const CacheFileHeader &header)
+{
+	auto hash = hashKey((const char*)&header, (UINT)offsetof(CacheFileHeader, checksum));
+	return (UINT)(hash ^ (hash >> 32));
+}
+
+bool
+ShaderDiskCache::lockRange(
+    UINT index)
+{
+	OVERLAPPED overlapped;
+	ZeroMemory(&overlapped, sizeof(overlapped));
+	overlapped.Offset = index;
+	return ::LockFileEx(m_hLockFile, LOCKFILE_EXCLUSIVE_LOCK, 0, 1, 0, &overlapped) != FALSE;
+}
+
+void
+ShaderDiskCache::unlockRange(
+    UINT index)
+{
+	OVERLAPPED overlapped;
+	ZeroMemory(&overlapped, sizeof(overlapped));
+	overlapped.Offset = index;
+	::UnlockFileEx(m_hLockFile, 0, 1, 0, &overlapped);
+}
+
+bool
+ShaderDiskCache::archiveChangedOnDisk()
 {
-	return sizeof(entry.keyLength) + sizeof(char) * entry.keyLength + 
-			sizeof(entry.bytecodeLength) + entry.bytecodeLength;
+	HANDLE hFile = ::CreateFile(m_archiveFileName.c_str(), GENERIC_READ,
+		CACHE_SHARE_MODE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0);
+	if (hFile == INVALID_HANDLE_VALUE)
+	{
+		return false;
+	}
+	//a torn header only costs a needless remap
+	CacheFileHeader header;
+	auto ok = readAt(hFile, 0, &header, sizeof(header));
+	CloseHandle(hFile);
+	return ok && (!m_mappedArchive ||
+				  header.fileSize != m_mappedHeader.fileSize ||
+				  header.indexOffset != m_mappedHeader.indexOffset ||
+				  header.useClock != m_mappedHeader.useClock);
 }
 
 bool
-ShaderDiskCache::readCacheEntry(
+ShaderDiskCache::readAt(
     HANDLE hFile,
-    CacheEntry & entry,
-    bool readBytecode)
+    UINT offset,
+    void * buffer,
+    UINT size)
 {
+	LARGE_INTEGER pos;
+	pos.QuadPart = offset;
 	DWORD dwRead;
-	DWORD size = sizeof(entry.keyLength) + sizeof(entry.bytecodeLength);
-	if (!ReadFile(hFile, &entry.keyLength, size, &dwRead, nullptr) || dwRead != size)
+	if (!::SetFilePointerEx(hFile, pos, nullptr, FILE_BEGIN))
 	{
 		return false;
 	}
-	auto key = new char[entry.keyLength + 1];
-	key[entry.keyLength] = '\0';
-	ReadFile(hFile, key, entry.keyLength, &dwRead, nullptr);
-	entry.key = key;
-		
-	//ReadFile(hFile, &entry.bytecodeLength, sizeof(entry.bytecodeLength), &dwRead, nullptr);
-	if (readBytecode)
+	if (!::ReadFile(hFile, buffer, size, &dwRead, nullptr))
 	{
-		auto bytecode = new BYTE[entry.bytecodeLength];
-		ReadFile(hFile, bytecode, entry.bytecodeLength, &dwRead, nullptr);
-		entry.bytecode = bytecode;
+		return false;
 	}
-	else
+	m_bytesRead += dwRead;
+	return dwRead == size;
+}
+
+bool
+ShaderDiskCache::writeAt(
+    HANDLE hFile,
+    UINT offset,
+    const void * buffer,
+    UINT size)
+{
+	LARGE_INTEGER pos;
+	pos.QuadPart = offset;
+	DWORD dwWritten;
+	if (!::SetFilePointerEx(hFile, pos, nullptr, FILE_BEGIN))
+	{
+		return false;
+	}
+	if (!::WriteFile(hFile, buffer, size, &dwWritten, nullptr))
+	{
+		return false;
+	}
+	m_bytesWritten += dwWritten;
+	return dwWritten == size;
+}
+
+void
+ShaderDiskCache::serializeDependencies(
+    const std::vector<ShaderDependency> & dependencies,
+    std::vector<BYTE> & result)
+{
+	result.clear();
+	if (dependencies.empty())
+	{
+		return;
+	}
+	auto append = [&result](const void * data, SIZE_T size)
+	{
+		result.insert(result.end(), (const BYTE*)data, (const BYTE*)data + size);
+	};
+	UINT count = (UINT)dependencies.size();
+	append(&count, sizeof(count));
+	for (const auto &dependency : dependencies)
+	{
+		UINT nameLength = (UINT)dependency.fileName.length();
+		append(&nameLength, sizeof(nameLength));
+		append(dependency.fileName.data(), nameLength);
+		append(&dependency.contentHash, sizeof(dependency.contentHash));
+	}
+}
+
+bool
+ShaderDiskCache::parseDependencies(
+    const BYTE * data,
+    UINT length,
+    std::vector<ShaderDependency> & result)
+{
+	result.clear();
+	if (length == 0)
+	{
+		return true;
+	}
+	auto end = data + length;
+	UINT count;
+	if (length < sizeof(count))
+	{
+		return false;
+	}
+	CopyMemory(&count, data, sizeof(count));
+	data += sizeof(count);
+	if (count > length)
+	{
+		return false;
+	}
+	result.resize(count);
+	for (auto &dependency : result)
+	{
+		UINT nameLength;
+		if ((SIZE_T)(end - data) < sizeof(nameLength))
+		{
+			return false;
+		}
+		CopyMemory(&nameLength, data, sizeof(nameLength));
+		data += sizeof(nameLength);
+		if ((SIZE_T)(end - data) < nameLength + sizeof(dependency.contentHash))
+		{
+			return false;
+		}
+		dependency.fileName.assign((const char*)data, nameLength);
+		data += nameLength;
+		CopyMemory(&dependency.contentHash, data, sizeof(dependency.contentHash));
+		data += sizeof(dependency.contentHash);
+	}
+	return true;
+}
+
+void
+ShaderDiskCache::mapArchive()
+{
+	//the header is only read under the lock so a batch being published is never seen half
+	//written, everything it points to was on disk before the header went out
+	std::lock_guard<std::mutex> lock(m_archiveMutex);
+
+	//entries found earlier keep the old view alive through their storage
+	m_mappedArchive.reset();
+	std::shared_ptr<ClientUtils::MappedFile> archive;
+	if (openMappedArchive(m_archiveFileName, archive, m_mappedHeader))
+	{
+		m_mappedArchive = archive;
+	}
+	//else older format or a truncated file, the writer starts it over
+}
+
+bool
+ShaderDiskCache::openMappedArchive(
+    const std::string & fileName,
+    std::shared_ptr<ClientUtils::MappedFile> & archive,
+    CacheFileHeader & header)
+{
+	archive.reset(new ClientUtils::MappedFile());
+	if (!archive->open(fileName.c_str()) || archive->size() < sizeof(CacheFileHeader))
+	{
+		archive.reset();
+		return false;
+	}
+	for (UINT attempt = 1; ; ++attempt)
+	{
+		CopyMemory(&header, archive->data(), sizeof(header));
+		if (isValidHeader(header) || attempt >= CACHE_HEADER_READ_ATTEMPTS)
+		{
+			break;
+		}
+		//another process may be rewriting it right now, it is a single small write
+		std::this_thread::yield();
+	}
+	if (!isValidHeader(header) || header.indexOffset == 0 ||
+		(UINT64)header.indexOffset + header.indexSlotCount * sizeof(CacheIndexSlot) > archive->size())
 	{
-		//just advance file pointer
-		SetFilePointer(hFile, entry.bytecodeLength, nullptr, FILE_CURRENT);
+		archive.reset();
+		return false;
 	}
 	return true;
 }
 
 bool
-ShaderDiskCache::searchForEntry(
-    CacheEntry& entry,
-    const TCHAR * fileName,
-    const TCHAR * shaderFileName)
+ShaderDiskCache::findMappedEntry(
+    CacheEntry & entry,
+    UINT & compressedLength)
 {
-	auto attrs = ::GetFileAttributes(fileName);
-	if (attrs == INVALID_FILE_ATTRIBUTES)
+	if (!m_mappedArchive)
 	{
-		//no file exists, so nowhere to look at
 		return false;
 	}
+	//the header copy is used, not the one in the view, the writer may have moved on since
+	return findEntryIn(m_mappedArchive, m_mappedHeader, entry, compressedLength);
+}
 
-	WIN32_FILE_ATTRIBUTE_DATA shaderFileInfo;
-	WIN32_FILE_ATTRIBUTE_DATA cacheFileInfo;
-	::GetFileAttributesEx(shaderFileName, GetFileExInfoStandard, &shaderFileInfo);
-	::GetFileAttributesEx(fileName, GetFileExInfoStandard, &cacheFileInfo);
+bool
+ShaderDiskCache::findEntryIn(
+    const std::shared_ptr<ClientUtils::MappedFile> & archive,
+    const CacheFileHeader & header,
+    CacheEntry & entry,
+    UINT & compressedLength)
+{
+	auto base = archive->data();
+	auto size = archive->size();
+	auto slots = (const CacheIndexSlot*)(base + header.indexOffset);
+	auto hash = hashKey(entry.key, entry.keyLength);
+	auto mask = header.indexSlotCount - 1;
+	for (UINT i = 0; i < header.indexSlotCount; ++i)
+	{
+		const auto &slot = slots[(hash + i) & mask];
+		if (slot.keyHash == 0)
+		{
+			return false;
+		}
+		if (slot.keyHash == hash && slot.keyLength == entry.keyLength &&
+			(UINT64)slot.offset + recordSize(slot) <= size)
+		{
+			auto record = base + slot.offset;
+			auto key = record + sizeof(CacheRecordHeader);
+			if (!memcmp(key, entry.key, entry.keyLength))
+			{
+				if (!parseDependencies(key + slot.keyLength, slot.dependenciesLength, entry.dependencies))
+				{
+					return false;
+				}
+				entry.bytecodeLength = slot.bytecodeLength;
+				entry.bytecode = record + bytecodeOffset(slot);
+				entry.storage = archive;
+				compressedLength = slot.compressedLength;
+				//nothing is copied, but the pages behind the record get faulted in from disk
+				m_bytesRead += recordSize(slot);
+				return true;
+			}
+		}
+	}
+	return false;
+}
 
-	ULARGE_INTEGER shaderLastModified, cacheLastModified;
-	shaderLastModified.LowPart = shaderFileInfo.ftLastWriteTime.dwLowDateTime;
-	shaderLastModified.HighPart = shaderFileInfo.ftLastWriteTime.dwHighDateTime;
-	cacheLastModified.LowPart = cacheFileInfo.ftLastWriteTime.dwLowDateTime;
-	cacheLastModified.HighPart = cacheFileInfo.ftLastWriteTime.dwHighDateTime;
-	if (shaderLastModified.QuadPart > cacheLastModified.QuadPart)
+bool
+ShaderDiskCache::findUnpublishedEntry(
+    CacheEntry & entry)
+{
+	if (m_unpublishedEntries.empty())
+	{
+		return false;
+	}
+	auto found = m_unpublishedEntries.find(std::string(entry.key, entry.keyLength));
+	if (found == m_unpublishedEntries.end())
 	{
-		//cache file found, not outdated, so pretend in doesn't exist
 		return false;
 	}
+	const auto &pending = *found->second;
+	entry.bytecodeLength = (UINT)pending.bytecode.size();
+	entry.bytecode = pending.bytecode.data();
+	entry.dependencies = pending.dependencies;
+	entry.storage = found->second;
+	return true;
+}
 
-	HANDLE hFile = ::CreateFile(fileName, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, 
-				nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0);
-	//scan file for entry
-	CacheEntry curr;
-	while (readCacheEntry(hFile, curr, false))
+bool
+ShaderDiskCache::findSlot(
+    HANDLE hFile,
+    const std::vector<CacheIndexSlot> & slots,
+    const PendingEntry & entry,
+    UINT & slotNumber)
+{
+	auto keyLength = (UINT)entry.key.length();
+	auto hash = hashKey(entry.key.data(), keyLength);
+	auto mask = (UINT)slots.size() - 1;
+	std::vector<char> key;
+
+	//linear probing, the index is never allowed to get more than half full
+	for (UINT i = 0; i < slots.size(); ++i)
 	{
-		if (!strcmp(curr.key, entry.key))
+		slotNumber = (UINT)((hash + i) & mask);
+		const auto &slot = slots[slotNumber];
+		if (slot.keyHash == 0)
 		{
-			//entry found, stop
-			auto size = calculateCacheEntrySize(curr);
-			int iSize = size;
-			::SetFilePointer(hFile, -iSize, nullptr, FILE_CURRENT);
-			readCacheEntry(hFile, entry, true);
-			::CloseHandle(hFile);
+			//empty slot, the key is not in the file
 			return true;
 		}
+		if (slot.keyHash == hash && slot.keyLength == keyLength)
+		{
+			key.resize(keyLength);
+			if (!readAt(hFile, slot.offset + sizeof(CacheRecordHeader), key.data(), keyLength))
+			{
+				return false;
+			}
+			if (!memcmp(key.data(), entry.key.data(), keyLength))
+			{
+				return true;
+			}
+		}
 	}
-	::CloseHandle(hFile);
 	return false;
 }
 
-void
-ShaderDiskCache::addCacheEntry(
-    const CacheEntry & entry,
-    const TCHAR * fileName,
-    const TCHAR * shaderFileName)
+bool
+ShaderDiskCache::writeRecord(
+    HANDLE hFile,
+    UINT offset,
+    const PendingEntry & entry,
+    CacheIndexSlot & slot)
 {
-	auto attrs = GetFileAttributes(fileName);
-	auto isNewFile = false;
-	HANDLE hFile = 0;
-	if (attrs == INVALID_FILE_ATTRIBUTES)
+	std::vector<BYTE> dependencies;
+	serializeDependencies(entry.dependencies, dependencies);
+
+	slot.keyHash = hashKey(entry.key.data(), (UINT)entry.key.length());
+	slot.offset = offset;
+	slot.keyLength = (UINT)entry.key.length();
+	slot.bytecodeLength = (UINT)entry.bytecode.size();
+	slot.dependenciesLength = (UINT)dependencies.size();
+	slot.lastUse = 0;
+	slot.compressedLength = (UINT)entry.compressedBytecode.size();
+	auto bytecode = slot.compressedLength ? entry.compressedBytecode.data() : entry.bytecode.data();
+
+	CacheRecordHeader record;
+	record.keyLength = slot.keyLength;
+	record.dependenciesLength = slot.dependenciesLength;
+	record.bytecodeLength = slot.bytecodeLength;
+	record.compressedLength = slot.compressedLength;
+
+	//assemble the record with its padding so it goes out in one write
+	std::vector<BYTE> buffer(recordSize(slot), 0);
+	auto key = buffer.data() + sizeof(record);
+	CopyMemory(buffer.data(), &record, sizeof(record));
+	CopyMemory(key, entry.key.data(), slot.keyLength);
+	if (!dependencies.empty())
 	{
-		//file does not exist, so create one
-		isNewFile = true;
-		hFile = ::CreateFile(fileName, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, 
-			nullptr, CREATE_NEW, FILE_ATTRIBUTE_NORMAL, 0);
+		CopyMemory(key + slot.keyLength, dependencies.data(), slot.dependenciesLength);
 	}
-	else
+	if (!entry.bytecode.empty())
 	{
-		WIN32_FILE_ATTRIBUTE_DATA shaderFileInfo;
-		WIN32_FILE_ATTRIBUTE_DATA cacheFileInfo;
-		GetFileAttributesEx(shaderFileName, GetFileExInfoStandard, &shaderFileInfo);
-		GetFileAttributesEx(fileName, GetFileExInfoStandard, &cacheFileInfo);
+		CopyMemory(buffer.data() + bytecodeOffset(slot), bytecode, storedBytecodeLength(slot));
+	}
+	return writeAt(hFile, offset, buffer.data(), (UINT)buffer.size());
+}
 
-		ULARGE_INTEGER shaderLastModified, cacheLastModified;
-		shaderLastModified.LowPart = shaderFileInfo.ftLastWriteTime.dwLowDateTime;
-		shaderLastModified.HighPart = shaderFileInfo.ftLastWriteTime.dwHighDateTime;
-		cacheLastModified.LowPart = cacheFileInfo.ftLastWriteTime.dwLowDateTime;
-		cacheLastModified.HighPart = cacheFileInfo.ftLastWriteTime.dwHighDateTime;
+void
+ShaderDiskCache::compressEntry(
+    PendingEntry & entry)
+{
+	//only kept if it saves enough to be worth decoding, the codec gives up as soon as the
+	//output would not fit
+	auto length = entry.bytecode.size();
+	auto capacity = length - length / CACHE_MIN_COMPRESSION_SAVING;
+	entry.compressedBytecode.clear();
+	if (capacity == 0 || capacity == length)
+	{
+		return;
+	}
+	entry.compressedBytecode.resize(capacity);
+	auto compressedLength = ClientUtils::LZCodec::compress(entry.bytecode.data(), length,
+		entry.compressedBytecode.data(), capacity);
+	entry.compressedBytecode.resize(compressedLength);
+}
 
-		if (shaderLastModified.QuadPart > cacheLastModified.QuadPart)
+void
+ShaderDiskCache::growIndex(
+    std::vector<CacheIndexSlot> & slots)
+{
+	//offsets are from the start of the file so they stay valid, only the slots move
+	std::vector<CacheIndexSlot> newSlots(slots.size() * 2);
+	ZeroMemory(newSlots.data(), newSlots.size() * sizeof(CacheIndexSlot));
+	auto mask = (UINT)newSlots.size() - 1;
+	for (const auto &slot : slots)
+	{
+		if (slot.keyHash == 0)
 		{
-			//shader has been modified, so overwrite the cache file
-			hFile = CreateFile(fileName, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ,
-				nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, 0);
-			isNewFile = true;
+			continue;
 		}
-		else
+		auto idx = (UINT)(slot.keyHash & mask);
+		while (newSlots[idx].keyHash != 0)
 		{
-			//cache is up-to-date
-			hFile = CreateFile(fileName, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ,
-				nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0);
+			idx = (idx + 1) & mask;
 		}
+		newSlots[idx] = slot;
 	}
-	if (isNewFile)
+	slots.swap(newSlots);
+}
+
+bool
+ShaderDiskCache::readIndex(
+    HANDLE hFile,
+    CacheFileHeader & header,
+    std::vector<CacheIndexSlot> & slots)
+{
+	slots.clear();
+	if (!readAt(hFile, 0, &header, sizeof(header)) || !isValidHeader(header) || !header.indexOffset)
+	{
+		return false;
+	}
+	slots.resize(header.indexSlotCount);
+	if (!readAt(hFile, header.indexOffset, slots.data(), header.indexSlotCount * sizeof(CacheIndexSlot)))
+	{
+		slots.clear();
+		return false;
+	}
+	return true;
+}
+
+void
+ShaderDiskCache::writeBatch(
+    const std::vector<PendingEntryPtr> & batch,
+    const std::vector<UINT64> & usedKeys)
+{
+	//the searching thread may have the archive mapped, so share it both ways
+	HANDLE hFile = ::CreateFile(m_archiveFileName.c_str(), GENERIC_READ | GENERIC_WRITE,
+		CACHE_SHARE_MODE, nullptr, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, 0);
+	if (hFile == INVALID_HANDLE_VALUE)
 	{
-		//the file is new, so no need to search for anything, just white down
-		writeCacheEntry(hFile, entry);
-		CloseHandle(hFile);
 		return;
 	}
-	else
+
+	//done before the lock is taken, other processes may be waiting for it
+	for (const auto &pending : batch)
+	{
+		compressEntry(*pending);
+	}
+
+	//other processes append to the same archive, from here till the header is out it is ours
+	auto locked = m_hLockFile != INVALID_HANDLE_VALUE && lockRange(CACHE_ARCHIVE_LOCK);
+
+	CacheFileHeader header;
+	std::vector<CacheIndexSlot> slots;
+	if (!readIndex(hFile, header, slots))
+	{
+		//new file or one in an older format, start with an empty index
+		header.magic = CACHE_FILE_MAGIC;
+		header.version = CACHE_FORMAT_VERSION;
+		header.indexSlotCount = CACHE_INITIAL_INDEX_SLOTS;
+		header.entryCount = 0;
+		header.indexOffset = 0;
+		header.fileSize = sizeof(CacheFileHeader);
+		header.useClock = 0;
+		slots.resize(CACHE_INITIAL_INDEX_SLOTS);
+		ZeroMemory(slots.data(), slots.size() * sizeof(CacheIndexSlot));
+	}
+	header.useClock++;
+
+	//hashes are enough to find the slots, a rare collision only keeps an extra entry alive
+	auto mask = (UINT)slots.size() - 1;
+	std::vector<UINT> usedSlots;
+	for (auto keyHash : usedKeys)
 	{
-		//scan file for entry
-		CacheEntry curr;
-		while (readCacheEntry(hFile, curr, false))
+		for (auto idx = (UINT)(keyHash & mask); slots[idx].keyHash != 0; idx = (idx + 1) & mask)
 		{
-			if (!strcmp(curr.key, entry.key))
+			if (slots[idx].keyHash == keyHash && slots[idx].lastUse != header.useClock)
 			{
-				//entry found, stop
-				CloseHandle(hFile);
-				return;
+				slots[idx].lastUse = header.useClock;
+				usedSlots.push_back(idx);
 			}
 		}
-		//we're at the end, and entry is not found, so add one
-		writeCacheEntry(hFile, entry);
+	}
+
+	if (batch.empty())
+	{
+		//only uses to record, a session that just reads must not grow the archive. The slots
+		//of the published index are updated where they are, searches never look at lastUse.
+		if (!usedSlots.empty() && header.indexOffset)
+		{
+			for (auto idx : usedSlots)
+			{
+				writeAt(hFile, header.indexOffset + idx * (UINT)sizeof(CacheIndexSlot) +
+					(UINT)offsetof(CacheIndexSlot, lastUse), &header.useClock, sizeof(UINT));
+			}
+			header.checksum = headerChecksum(header);
+
+			std::lock_guard<std::mutex> lock(m_archiveMutex);
+			writeAt(hFile, 0, &header, sizeof(header));
+		}
+		if (locked)
+		{
+			unlockRange(CACHE_ARCHIVE_LOCK);
+		}
 		CloseHandle(hFile);
 		return;
 	}
+
+	//records go after everything in use, nothing already published is overwritten
+	auto offset = alignEntrySize(header.fileSize);
+	for (const auto &pending : batch)
+	{
+		//keep the index at most half full so probe chains stay short
+		if ((header.entryCount + 1) * 2 > slots.size())
+		{
+			growIndex(slots);
+		}
+
+		UINT slotNumber;
+		CacheIndexSlot slot;
+		if (!findSlot(hFile, slots, *pending, slotNumber) ||
+			!writeRecord(hFile, offset, *pending, slot))
+		{
+			continue;
+		}
+		//either not in the file, or there but rejected by the caller because one of its
+		//dependencies changed, in which case the new record takes over the slot
+		if (slots[slotNumber].keyHash == 0)
+		{
+			header.entryCount++;
+		}
+		slot.lastUse = header.useClock;
+		slots[slotNumber] = slot;
+		offset += recordSize(slot);
+	}
+
+	//then the index, and the header pointing to it last
+	auto indexSize = (UINT)(slots.size() * sizeof(CacheIndexSlot));
+	if (writeAt(hFile, offset, slots.data(), indexSize))
+	{
+		header.indexSlotCount = (UINT)slots.size();
+		header.indexOffset = offset;
+		header.fileSize = offset + indexSize;
+		header.checksum = headerChecksum(header);
+
+		std::lock_guard<std::mutex> lock(m_archiveMutex);
+		writeAt(hFile, 0, &header, sizeof(header));
+	}
+	if (locked)
+	{
+		unlockRange(CACHE_ARCHIVE_LOCK);
+	}
+	CloseHandle(hFile);
+}
+
+void
+ShaderDiskCache::writerThreadMain()
+{
+	//an archive the last session left over budget is tidied up before anything is added
+	compactArchive();
+
+	std::unique_lock<std::mutex> lock(m_queueMutex);
+	for (;;)
+	{
+		m_bWriterBusy = false;
+		m_writeQueueChanged.notify_all();
+		m_writeQueueChanged.wait(lock, [this] { return m_bStopWriter || !m_writeQueue.empty(); });
+		if (m_writeQueue.empty() && m_usedKeys.empty())
+		{
+			//asked to stop and nothing left to write
+			break;
+		}
+
+		//new permutations tend to show up together, give the rest a moment to arrive so
+		//they go out in one batch
+		if (!m_bStopWriter)
+		{
+			m_writeQueueChanged.wait_for(lock, std::chrono::milliseconds(CACHE_WRITE_BATCH_DELAY_MS),
+				[this] { return m_bStopWriter || m_flushWaiters > 0 ||
+						m_writeQueue.size() >= CACHE_MAX_PENDING_ENTRIES; });
+		}
+
+		std::vector<PendingEntryPtr> batch;
+		std::vector<UINT64> usedKeys;
+		batch.swap(m_writeQueue);
+		usedKeys.swap(m_usedKeys);
+		m_bWriterBusy = true;
+		//inserts waiting for room in the queue go on
+		m_writeQueueChanged.notify_all();
+		lock.unlock();
+		writeBatch(batch, usedKeys);
+
+		//the entries are in the archive for every process now, let those waiting for the
+		//keys find them. Searches only ever use the raw bytecode of a pending entry.
+		for (const auto &pending : batch)
+		{
+			pending->keyLock.reset();
+			std::vector<BYTE>().swap(pending->compressedBytecode);
+		}
+		lock.lock();
+
+		//searches keep serving these from memory till they remap the archive
+		m_writtenEntries.insert(m_writtenEntries.end(), batch.begin(), batch.end());
+		m_bArchiveChanged = true;
+
+		//not worth holding up shutdown for, the next session does it
+		if (!m_bStopWriter)
+		{
+			lock.unlock();
+			compactArchive();
+			lock.lock();
+		}
+	}
 }
 
 bool
 ShaderDiskCache::searchForEntry(
-    CacheEntry& entry,
-    const std::string& shaderFileName)
+    CacheEntry& entry)
+{
+	UINT compressedLength = 0;
+	{
+		std::lock_guard<std::mutex> lock(m_queueMutex);
+		if (!findEntry(entry, compressedLength))
+		{
+			return false;
+		}
+	}
+	//other searches go on meanwhile, the view is kept alive by entry.storage
+	return !compressedLength || decompressEntry(entry, compressedLength);
+}
+
+bool
+ShaderDiskCache::decompressEntry(
+    CacheEntry & entry,
+    UINT compressedLength)
+{
+	auto start = std::chrono::steady_clock::now();
+	auto buffer = std::make_shared<std::vector<BYTE>>(entry.bytecodeLength);
+	if (!ClientUtils::LZCodec::decompress(entry.bytecode, compressedLength, buffer->data(), buffer->size()))
+	{
+		//a damaged record, the caller compiles the shader again and its new record takes over
+		//the slot
+		entry.bytecode = nullptr;
+		entry.storage.reset();
+		return false;
+	}
+	//the view goes when the entry lets go of it, the buffer lives as long as the entry
+	entry.bytecode = buffer->data();
+	entry.storage = buffer;
+	m_bytesDecompressed += entry.bytecodeLength;
+	m_decompressMicroseconds += std::chrono::duration_cast<std::chrono::microseconds>(
+		std::chrono::steady_clock::now() - start).count();
+	return true;
+}
+
+bool
+ShaderDiskCache::findEntry(
+    CacheEntry & entry,
+    UINT & compressedLength)
 {
-	std::string cacheFileName;
-	createCacheFileName(shaderFileName, cacheFileName);
-	return searchForEntry(entry, cacheFileName.c_str(), shaderFileName.c_str());
+	if (m_bArchiveChanged)
+	{
+		//pick up what the writer put out
+		mapArchive();
+		for (const auto &written : m_writtenEntries)
+		{
+			auto unpublished = m_unpublishedEntries.find(written->key);
+			if (unpublished != m_unpublishedEntries.end() && unpublished->second == written)
+			{
+				m_unpublishedEntries.erase(unpublished);
+			}
+		}
+		m_writtenEntries.clear();
+		m_bArchiveChanged = false;
+	}
+	if (findUnpublishedEntry(entry))
+	{
+		return true;
+	}
+	if (findMappedEntry(entry, compressedLength))
+	{
+		m_usedKeys.push_back(hashKey(entry.key, entry.keyLength));
+		return true;
+	}
+	//the layers below have no use clock to keep
+	for (const auto &layer : m_readOnlyLayers)
+	{
+		if (findEntryIn(layer.archive, layer.header, entry, compressedLength))
+		{
+			return true;
+		}
+	}
+	return false;
 }
 
 void
 ShaderDiskCache::addCacheEntry(
-    const CacheEntry & entry,
-    const std::string& shaderFileName)
+    const CacheEntry & entry)
+{
+	auto pending = std::make_shared<PendingEntry>();
+	pending->key.assign(entry.key, entry.keyLength);
+	pending->bytecode.assign((const BYTE*)entry.bytecode, (const BYTE*)entry.bytecode + entry.bytecodeLength);
+	pending->dependencies = entry.dependencies;
+	pending->keyLock = entry.keyLock;
+
+	{
+		std::unique_lock<std::mutex> lock(m_queueMutex);
+		if (m_writeQueue.size() >= CACHE_MAX_PENDING_ENTRIES)
+		{
+			//the writer is not keeping up, slow the compiles down to its pace. It starts on a
+			//full queue at once, the wait is one batch write.
+			m_queueFullWaits++;
+			m_writeQueueChanged.notify_all();
+			m_writeQueueChanged.wait_for(lock, std::chrono::milliseconds(CACHE_FULL_QUEUE_WAIT_MS),
+				[this] { return m_bStopWriter || m_writeQueue.size() < CACHE_MAX_PENDING_ENTRIES; });
+		}
+		m_writeQueue.push_back(pending);
+		m_unpublishedEntries[pending->key] = pending;
+	}
+	m_writeQueueChanged.notify_all();
+}
+
+void
+ShaderDiskCache::lockKey(
+    CacheEntry & entry)
+{
+	entry.keyLock.reset();
+	if (m_hLockFile == INVALID_HANDLE_VALUE)
+	{
+		return;
+	}
+	auto index = CACHE_FIRST_KEY_LOCK + (UINT)(hashKey(entry.key, entry.keyLength) % CACHE_KEY_LOCK_COUNT);
+	if (!lockRange(index))
+	{
+		return;
+	}
+	//not a pointer to anything, only the deleter matters
+	entry.keyLock = std::shared_ptr<void>(this, [this, index](void *) { unlockRange(index); });
+
+	//whoever held the lock may have published the key from another process
+	std::lock_guard<std::mutex> lock(m_queueMutex);
+	if (archiveChangedOnDisk())
+	{
+		m_bArchiveChanged = true;
+	}
+}
+
+void
+ShaderDiskCache::flush()
 {
-	std::string cacheFileName;
-	createCacheFileName(shaderFileName, cacheFileName);
-	addCacheEntry(entry, cacheFileName.c_str(), shaderFileName.c_str());
+	std::unique_lock<std::mutex> lock(m_queueMutex);
+	++m_flushWaiters;
+	m_writeQueueChanged.notify_all();
+	for (;;)
+	{
+		if (m_bStopWriter || (m_writeQueue.empty() && !m_bWriterBusy))
+		{
+			break;
+		}
+		m_writeQueueChanged.wait(lock);
+	}
+	--m_flushWaiters;
+}
+
+void
+ShaderDiskCache::compact()
+{
+	flush();
+	if (writeCompactedArchive(true))
+	{
+		swapCompactedArchive();
+	}
+}
+
+void
+ShaderDiskCache::compactArchive()
+{
+	//whatever made the last swap fail is likely still there, copying the whole archive again
+	//every batch meanwhile would be wasted
+	if (m_compactionSkipBatches > 0)
+	{
+		m_compactionSkipBatches--;
+		return;
+	}
+	if (!writeCompactedArchive(false))
+	{
+		return;
+	}
+	if (swapCompactedArchive())
+	{
+		m_compactionRetryBatches = CACHE_COMPACTION_RETRY_BATCHES;
+	}
+	else
+	{
+		m_compactionSkipBatches = m_compactionRetryBatches;
+		m_compactionRetryBatches = std::min(m_compactionRetryBatches * 2, (UINT)CACHE_COMPACTION_MAX_RETRY_BATCHES);
+	}
+}
+
+bool
+ShaderDiskCache::writeCompactedArchive(
+    bool evenIfTidy)
+{
+	//no other process may append while the archive is copied
+	auto locked = m_hLockFile != INVALID_HANDLE_VALUE && lockRange(CACHE_ARCHIVE_LOCK);
+	auto ok = writeCompactedArchiveLocked(evenIfTidy);
+	if (locked)
+	{
+		unlockRange(CACHE_ARCHIVE_LOCK);
+	}
+	return ok;
+}
+
+bool
+ShaderDiskCache::writeCompactedArchiveLocked(
+    bool evenIfTidy)
+{
+	HANDLE hFile = ::CreateFile(m_archiveFileName.c_str(), GENERIC_READ,
+		CACHE_SHARE_MODE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0);
+	if (hFile == INVALID_HANDLE_VALUE)
+	{
+		return false;
+	}
+
+	CacheFileHeader header;
+	std::vector<CacheIndexSlot> slots;
+	if (!readIndex(hFile, header, slots))
+	{
+		CloseHandle(hFile);
+		return false;
+	}
+	m_compactedFrom = header;
+
+	//everything but the live records and the current index is garbage
+	std::vector<CacheIndexSlot> liveSlots;
+	UINT64 liveSize = sizeof(CacheFileHeader) + slots.size() * sizeof(CacheIndexSlot);
+	for (const auto &slot : slots)
+	{
+		if (slot.keyHash != 0)
+		{
+			liveSlots.push_back(slot);
+			liveSize += recordSize(slot);
+		}
+	}
+	auto garbageSize = header.fileSize > liveSize ? header.fileSize - liveSize : 0;
+	if (header.fileSize <= m_sizeBudget && !evenIfTidy &&
+		(garbageSize < CACHE_MIN_GARBAGE_TO_COMPACT || garbageSize < liveSize))
+	{
+		CloseHandle(hFile);
+		return false;
+	}
+
+	//most recently used first, they are the ones kept if the budget is tight and they end up
+	//next to each other at the front of the file
+	std::sort(liveSlots.begin(), liveSlots.end(),
+		[](const CacheIndexSlot &a, const CacheIndexSlot &b) { return a.lastUse > b.lastUse; });
+
+	//going down to 3/4 of the budget leaves room to grow before the next compaction
+	UINT64 keepSize = (UINT64)m_sizeBudget * 3 / 4;
+	UINT64 keptSize = sizeof(CacheFileHeader);
+	UINT keptCount = 0;
+	for (const auto &slot : liveSlots)
+	{
+		//each kept entry costs its record and two slots in the index
+		UINT64 entrySize = recordSize(slot) + 2 * sizeof(CacheIndexSlot);
+		if (keptSize + entrySize > keepSize)
+		{
+			break;
+		}
+		keptSize += entrySize;
+		keptCount++;
+	}
+	liveSlots.resize(keptCount);
+
+	UINT indexSlotCount = CACHE_INITIAL_INDEX_SLOTS;
+	while (keptCount * 2 > indexSlotCount)
+	{
+		indexSlotCount *= 2;
+	}
+	std::vector<CacheIndexSlot> newSlots(indexSlotCount);
+	ZeroMemory(newSlots.data(), newSlots.size() * sizeof(CacheIndexSlot));
+
+	HANDLE hCompacted = ::CreateFile(m_compactedFileName.c_str(), GENERIC_WRITE, 0,
+		nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, 0);
+	if (hCompacted == INVALID_HANDLE_VALUE)
+	{
+		CloseHandle(hFile);
+		return false;
+	}
+
+	//records are copied as they are, only their offsets change
+	auto ok = true;
+	auto offset = alignEntrySize(sizeof(CacheFileHeader));
+	auto mask = indexSlotCount - 1;
+	std::vector<BYTE> record;
+	for (auto slot : liveSlots)
+	{
+		record.resize(recordSize(slot));
+		if (!readAt(hFile, slot.offset, record.data(), (UINT)record.size()) ||
+			!writeAt(hCompacted, offset, record.data(), (UINT)record.size()))
+		{
+			ok = false;
+			break;
+		}
+		slot.offset = offset;
+		offset += (UINT)record.size();
+
+		auto idx = (UINT)(slot.keyHash & mask);
+		while (newSlots[idx].keyHash != 0)
+		{
+			idx = (idx + 1) & mask;
+		}
+		newSlots[idx] = slot;
+	}
+	CloseHandle(hFile);
+
+	header.indexSlotCount = indexSlotCount;
+	header.entryCount = keptCount;
+	header.indexOffset = offset;
+	header.fileSize = offset + indexSlotCount * (UINT)sizeof(CacheIndexSlot);
+	header.checksum = headerChecksum(header);
+	//on disk before it is renamed over the archive, a crash after the rename must not leave a
+	//named archive with its contents still in the write cache
+	ok = ok &&
+		writeAt(hCompacted, header.indexOffset, newSlots.data(), indexSlotCount * sizeof(CacheIndexSlot)) &&
+		writeAt(hCompacted, 0, &header, sizeof(header)) &&
+		::FlushFileBuffers(hCompacted);
+	CloseHandle(hCompacted);
+	if (!ok)
+	{
+		::DeleteFile(m_compactedFileName.c_str());
+	}
+	return ok;
+}
+
+std::string
+ShaderDiskCache::getRetiredFileName(
+    UINT index) const
+{
+	return m_archiveFileName + CACHE_RETIRED_SUFFIX + std::to_string(index);
+}
+
+bool
+ShaderDiskCache::retireArchive(
+    std::string & retiredFileName)
+{
+	for (UINT i = 0; i < CACHE_RETIRED_FILE_COUNT; ++i)
+	{
+		auto fileName = getRetiredFileName(i);
+		if (::GetFileAttributes(fileName.c_str()) == INVALID_FILE_ATTRIBUTES &&
+			::MoveFileEx(m_archiveFileName.c_str(), fileName.c_str(), 0))
+		{
+			retiredFileName = fileName;
+			return true;
+		}
+	}
+	return false;
+}
+
+bool
+ShaderDiskCache::swapCompactedArchive()
+{
+	//another process may have appended since the compacted file was made, then it is out of
+	//date and goes
+	auto locked = m_hLockFile != INVALID_HANDLE_VALUE && lockRange(CACHE_ARCHIVE_LOCK);
+	CacheFileHeader header;
+	auto current = false;
+	HANDLE hFile = ::CreateFile(m_archiveFileName.c_str(), GENERIC_READ,
+		CACHE_SHARE_MODE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0);
+	if (hFile != INVALID_HANDLE_VALUE)
+	{
+		current = readAt(hFile, 0, &header, sizeof(header)) &&
+				  !memcmp(&header, &m_compactedFrom, sizeof(header));
+		CloseHandle(hFile);
+	}
+
+	auto swapped = false;
+	if (current)
+	{
+		//archives retired by earlier swaps go once no process maps them any more, till then
+		//their names stay taken
+		for (UINT i = 0; i < CACHE_RETIRED_FILE_COUNT; ++i)
+		{
+			::DeleteFile(getRetiredFileName(i).c_str());
+		}
+
+		//searches wait from here till the move is done, the next one maps the archive again.
+		//Entries found earlier keep the old view alive through their storage.
+		std::lock_guard<std::mutex> lock(m_queueMutex);
+		{
+			std::lock_guard<std::mutex> archiveLock(m_archiveMutex);
+			m_mappedArchive.reset();
+		}
+		//on Windows an archive with a view still open, held by an entry found here or mapped by
+		//another process, cannot be replaced. It can be renamed though, every handle to it
+		//shares delete access, so it is moved aside and the compacted file takes its name.
+		swapped = ::MoveFileEx(m_compactedFileName.c_str(), m_archiveFileName.c_str(),
+							   MOVEFILE_REPLACE_EXISTING) != FALSE;
+		std::string retiredFileName;
+		if (!swapped && retireArchive(retiredFileName))
+		{
+			swapped = ::MoveFileEx(m_compactedFileName.c_str(), m_archiveFileName.c_str(), 0) != FALSE;
+			if (!swapped)
+			{
+				::MoveFileEx(retiredFileName.c_str(), m_archiveFileName.c_str(), 0);
+			}
+		}
+		m_bArchiveChanged = true;
+	}
+	if (!swapped)
+	{
+		::DeleteFile(m_compactedFileName.c_str());
+	}
+	if (locked)
+	{
+		unlockRange(CACHE_ARCHIVE_LOCK);
+	}
+	return swapped;
 }
@@ -2,51 +2,381 @@
  * The ShaderDiskCache class. This manages a cache which is realized in memory through a map in
  * ShaderManager. The actual storage is not here.
  *
+ * All shaders share one archive file in the cache directory, laid out as:
+ *     CacheFileHeader                      - magic, format version, index size and offset
+ *     records                              - the entries (key + dependencies + bytecode)
+ *     CacheIndexSlot[indexSlotCount]       - the table of contents, an open addressed hash
+ *                                            table of key hash vs record offset
+ * Every record, the bytecode inside it and the index start on a CACHE_ENTRY_ALIGNMENT boundary.
+ * So a lookup costs one probe into the index (rarely more) and one read of the entry.
+ *
+ * The writer compresses the bytecode of each record with ClientUtils::LZCodec when that saves
+ * at least CACHE_MIN_COMPRESSION_SAVING of it, otherwise it is stored as is. The index slot
+ * and record header carry the compressed length, 0 for a raw record. Compressed bytecode is
+ * decoded by searchForEntry() into a buffer the entry owns, outside the cache's locks, and the
+ * shader object is made straight from that; raw bytecode is still used in place in the view.
+ * Decoding runs far faster than the disk the saved bytes would come from.
+ *
+ * Apart from last uses (below) the archive is only ever appended to: a batch of new records
+ * goes after the old ones, then a fresh copy of the index, and only then is the header
+ * rewritten to point at it. Older copies of the index and replaced records stay behind as
+ * garbage. Searches never see a record or an index field they read change under them: the
+ * only writes in place are the lastUse fields of the published index and the header. Searches
+ * do not read lastUse, and the header carries a checksum. lastUse is only read back by batch
+ * writers and compaction, which hold the archive lock the in-place writes are made under, so
+ * a half written lastUse is never seen.
+ *
+ * The archive is kept within a size budget. Each index slot carries the value of the header's
+ * use clock (ticked once per batch) from when the entry was last found or written. A batch
+ * with only uses to record, as a session that compiled nothing ends with, rewrites those
+ * slots and the header in place instead of appending an index, so reading never grows the
+ * archive. When the archive grows past the budget, or is mostly garbage, the writer thread
+ * copies the most recently used entries that fit in 3/4 of the budget to a new file, flushes
+ * it to disk and moves it over the archive, searches only wait for the move. On Windows a file
+ * with a view open, an entry found in it still held here or another process using it, cannot
+ * be replaced, but it can be renamed as every handle to the archive is opened with
+ * FILE_SHARE_DELETE. So the archive is then moved aside to a retired name and deleted by a
+ * later compaction once nobody maps it. Processes mapping it keep their view and pick up the
+ * new archive on their next remap. Should the swap still fail, every retired name in use say,
+ * compaction leaves the archive be for a number of batches that doubles with every failure,
+ * rather than copy it again each batch.
+ *
+ * Keys are built by ShaderManager from a hash of everything the bytecode depends on (source,
+ * defines, profile, flags, entry point), so entries never go stale - a changed shader simply
+ * gets a new key. There is no timestamp based invalidation. Files pulled in through #include
+ * are not part of the key, each entry instead stores the list of included files with their
+ * content hashes and ShaderManager rejects the entry if any of them changed.
+ *
+ * The archive is opened and memory mapped once when the ShaderDiskCache is created, so
+ * startup costs a single file open however many shaders are looked up. A found raw entry
+ * points straight into the mapped view (or into the copy queued by addCacheEntry()), nothing
+ * is copied. The entry's storage keeps that view alive, so the bytecode stays valid for as long
+ * as the entry is held, even if the archive is remapped meanwhile. Searches and inserts may
+ * come from any thread.
+ *
+ * addCacheEntry() only queues a copy of the entry. A writer thread owned by the cache appends
+ * queued entries to the archive in batches, and searchForEntry() remaps the archive once a
+ * batch is out. The queue is bounded: an insert that finds CACHE_MAX_PENDING_ENTRIES queued
+ * waits for the writer to take them, up to CACHE_FULL_QUEUE_WAIT_MS. Should the writer be
+ * stuck for longer (a hung disk) the entry is queued anyway, no compiled shader is lost. Anything still queued is written out when
+ * the ShaderDiskCache is destroyed, or when flush() is called.
+ *
+ * Several processes (Orbiter instances) may share the cache directory. Writers take an
+ * exclusive lock on the archive's lock file (LockFileEx(), the range at 0) from reading the
+ * index till the header is rewritten, and compaction only replaces the archive if no other
+ * writer moved it on meanwhile. Readers take no lock: every header carries a checksum, so a
+ * header caught half rewritten is retried, and what it points to was written before it.
+ * To have each shader compiled once machine-wide, a caller that misses locks the key with
+ * lockKey() and searches again - if another process was compiling it, its entry is found once
+ * the lock comes free. Otherwise the lock goes along with addCacheEntry() and is released
+ * when the entry is in the archive. Key locks are ranges in the lock file picked by key hash.
+ * They keep other processes out, not other threads: all threads share the process's lock
+ * file handle, so a caller has to see to it that only one of its threads loads a key at once
+ * (ShaderManager joins loads of the same shader).
+ *
+ * Below the writable archive there can be read-only layers: archives in other directories,
+ * such as a pack built by Tools\ShaderPackBuilder and shipped with the install. They are
+ * mapped once on construction and never written, compacted or remapped. A search looks in the
+ * writable archive (and the entries queued for it) first, then falls through the read-only
+ * layers in the order they were given. New entries only ever go to the writable archive, so
+ * an entry the layers below reject (ShaderManager found an included file changed) is
+ * recompiled once and then found on top.
  */
 #pragma once
 
-// System
-#include <windows.h> // For HANDLE
-
 // std
 #include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+// Local
+#include "Platform.h" // For HANDLE
+#include "MappedFile.h"
+#include "Hasher.h"
 
 namespace Rendering {
 
+// A file the cached bytecode was compiled from other than the main source
+struct ShaderDependency
+{
+	std::string fileName;
+	ClientUtils::Hash128 contentHash;
+};
+
 struct CacheEntry
 {
 	UINT keyLength;
 	UINT bytecodeLength;
 	const char * key;
-	const void * bytecode;
+	const void * bytecode;	// read-only, points into the mapped cache file (or the buffer it
+							// was decompressed into) after a search
+
+	// Filled in by searchForEntry(), written out by addCacheEntry()
+	std::vector<ShaderDependency> dependencies;
+
+	// Set by searchForEntry(), keeps whatever bytecode points into alive
+	std::shared_ptr<const void> storage;
+
+	// Set by ShaderDiskCache::lockKey(), the machine-wide lock on the key. Released when the
+	// last copy goes, addCacheEntry() keeps one till the entry is written.
+	std::shared_ptr<void> keyLock;
 };
 
 class ShaderDiskCache
 {
 public:
-    ShaderDiskCache(std::string& cacheRoot);
+    // sizeBudget is in bytes, the archive is compacted when it grows past it. The archives in
+    // readOnlyRoots are searched after the one in cacheRoot, missing ones are skipped.
+    ShaderDiskCache(std::string& cacheRoot, UINT sizeBudget,
+                    const std::vector<std::string>& readOnlyRoots = std::vector<std::string>());
     virtual ~ShaderDiskCache(void);
 
-    bool searchForEntry(CacheEntry &entry, const std::string &shaderFileName);
-    void addCacheEntry(const CacheEntry &entry, const std::string &shaderFileName);
+    // entry points to the shader bytecode if the key was found after the call to
+    // searchForEntry() completes
+    bool searchForEntry(CacheEntry &entry);
+
+    // Queues a copy of the entry for the writer thread, does not touch the disk. Waits for the
+    // writer if the queue is full.
+    void addCacheEntry(const CacheEntry &entry);
+
+    // Blocks till no other thread or process holds the lock for entry's key, then takes it in
+    // entry.keyLock and has the next search pick up archive changes made meanwhile. Leaves
+    // keyLock empty if there is no lock file to lock.
+    void lockKey(CacheEntry &entry);
+
+    // Blocks till everything queued so far is in the archive. For tools filling a cache in
+    // bulk, the client itself never waits for the writer.
+    void flush();
+
+    // Flushes, then rewrites the archive without garbage (still within the budget) right
+    // away. For tools about to ship the archive, nothing else may use the cache meanwhile.
+    void compact();
+
+    // Where the archive for cacheRoot goes, for tools that create or ship one
+    static std::string getArchiveFileName(const std::string& cacheRoot);
+
+    // Read-only layers that were found and mapped
+    UINT getReadOnlyLayerCount() const { return (UINT)m_readOnlyLayers.size(); }
+
+    // Archive I/O since the cache was created, for the stats. Bytes read count the records
+    // found in the mapped view as well as what the writer reads back through the file.
+    UINT64 getBytesRead() const { return m_bytesRead; }
+    UINT64 getBytesWritten() const { return m_bytesWritten; }
+    // Times addCacheEntry() found the queue full and had to wait for the writer
+    UINT64 getQueueFullWaits() const { return m_queueFullWaits; }
+    // Bytecode decompressed by searches and the time that took, to weigh against reading it
+    // raw. The bytes read above are the compressed ones.
+    UINT64 getBytesDecompressed() const { return m_bytesDecompressed; }
+    UINT64 getDecompressMicroseconds() const { return m_decompressMicroseconds; }
 
 private:
-	void writeCacheEntry(HANDLE hFile, const CacheEntry &entry);
-	UINT calculateCacheEntrySize(const CacheEntry &entry);
-	bool readCacheEntry(HANDLE hFile, CacheEntry &entry, bool readBytecode);
+	// The on disk structures, bump CACHE_FORMAT_VERSION in the impl if these change
+	struct CacheFileHeader
+	{
+		UINT magic;
+		UINT version;
+		UINT indexSlotCount;	// always a power of 2
+		UINT entryCount;
+		UINT indexOffset;		// from the start of the file, 0 if no index was written yet
+		UINT fileSize;			// bytes in use, new records go here
+		UINT useClock;			// ticked by every batch written
+		UINT checksum;			// of the fields above, see headerChecksum()
+	};
+
+	struct CacheIndexSlot
+	{
+		UINT64 keyHash;			// 0 marks an empty slot
+		UINT offset;			// of the record, from the start of the file
+		UINT keyLength;
+		UINT bytecodeLength;
+		UINT dependenciesLength;
+		UINT lastUse;			// useClock when last found or written
+		UINT compressedLength;	// of the bytecode as stored, 0 if it is not compressed
+	};
+
+	// Starts each record, followed by key, dependencies, padding up to the alignment,
+	// bytecode (compressed or not, as in the slot) and padding again
+	struct CacheRecordHeader
+	{
+		UINT keyLength;
+		UINT dependenciesLength;
+		UINT bytecodeLength;	// decompressed
+		UINT compressedLength;
+	};
+
+	// An entry waiting for the writer thread, owns copies of everything
+	struct PendingEntry
+	{
+		std::string key;
+		std::vector<BYTE> bytecode;
+		std::vector<BYTE> compressedBytecode;	// filled in by the writer, empty to store it raw
+		std::vector<ShaderDependency> dependencies;
+		std::shared_ptr<void> keyLock;	// from the CacheEntry, released once written
+	};
+	typedef std::shared_ptr<PendingEntry> PendingEntryPtr;
+
+	// A mapped archive below the writable one, never changes once mapped
+	struct ReadOnlyLayer
+	{
+		std::shared_ptr<ClientUtils::MappedFile> archive;
+		CacheFileHeader header;
+	};
+
+	static UINT64 hashKey(const char * key, UINT keyLength);
+	static UINT alignEntrySize(UINT size);
+	static UINT bytecodeOffset(const CacheIndexSlot &slot);	// from the start of the record
+	static UINT storedBytecodeLength(const CacheIndexSlot &slot);
+	static UINT recordSize(const CacheIndexSlot &slot);
+	static bool isValidHeader(const CacheFileHeader &header);
+	static UINT headerChecksum(const CacheFileHeader &header);
+
+	// Exclusive byte range locks in the lock file, blocking. Ranges are one byte at index.
+	bool lockRange(UINT index);
+	void unlockRange(UINT index);
+
+	// Whether the archive on disk is not what is mapped, another writer published since.
+	// Called with m_queueMutex held.
+	bool archiveChangedOnDisk();
+	bool readAt(HANDLE hFile, UINT offset, void * buffer, UINT size);
+	bool writeAt(HANDLE hFile, UINT offset, const void * buffer, UINT size);
 
-	// entry contains the shader bytecode if the shader was found or its source wasnt modified
-	// after the call to searchForEntry() completes
-	bool searchForEntry(CacheEntry &entry, const TCHAR * fileName, const TCHAR * shaderFileName);
+	// Dependencies are stored as a count followed by (name length, name, content hash) each
+	static void serializeDependencies(const std::vector<ShaderDependency> &dependencies,
+									  std::vector<BYTE> &result);
+	static bool parseDependencies(const BYTE * data, UINT length, std::vector<ShaderDependency> &result);
 
-	void addCacheEntry(const CacheEntry &entry, const TCHAR * fileName, const TCHAR * shaderFileName);
+	// Maps the archive and takes a copy of its header, leaves it closed if it is not usable
+	void mapArchive();
 
-	void createCacheFileName(const std::string &shaderFileName, std::string &result);
+	// Maps fileName and copies its header, false if it is missing, not an archive, or holds
+	// no index yet
+	static bool openMappedArchive(const std::string &fileName,
+								  std::shared_ptr<ClientUtils::MappedFile> &archive,
+								  CacheFileHeader &header);
+
+	// searchForEntry() with m_queueMutex held. A compressed entry is left pointing at the
+	// stored bytecode with compressedLength set, for decompressEntry() to finish.
+	bool findEntry(CacheEntry &entry, UINT &compressedLength);
+
+	// Replaces the stored bytecode entry points to by a decompressed copy it owns
+	bool decompressEntry(CacheEntry &entry, UINT compressedLength);
+
+	// Probes the index in the mapped archive, sets up entry to point into the view if found
+	bool findMappedEntry(CacheEntry &entry, UINT &compressedLength);
+
+	// Same in any mapped archive, header is the copy taken when it was mapped
+	bool findEntryIn(const std::shared_ptr<ClientUtils::MappedFile> &archive,
+					 const CacheFileHeader &header,
+					 CacheEntry &entry,
+					 UINT &compressedLength);
+
+	// Looks through entries queued or written since the archive was last mapped
+	bool findUnpublishedEntry(CacheEntry &entry);
+
+	// Writer thread side
+	void writerThreadMain();
+
+	// Reads the header and the index, false if there is no usable archive
+	bool readIndex(HANDLE hFile, CacheFileHeader &header, std::vector<CacheIndexSlot> &slots);
+
+	// Appends the batch and a new index to the archive, then publishes the header. The slots of
+	// the used keys get their last use bumped, in the published index if the batch is empty.
+	void writeBatch(const std::vector<PendingEntryPtr> &batch, const std::vector<UINT64> &usedKeys);
+
+	// Writes the entries worth keeping to m_compactedFileName if the archive is over budget or
+	// mostly garbage and swaps it in, unless it is backing off after a failed swap
+	void compactArchive();
+
+	// Writes the compacted file if compaction is due, or in any case with evenIfTidy. False if
+	// nothing was written.
+	bool writeCompactedArchive(bool evenIfTidy);
+	// The same with the archive lock held
+	bool writeCompactedArchiveLocked(bool evenIfTidy);
+
+	// Puts the compacted file in place of the archive if the archive is still what it was made
+	// from, deletes it otherwise. Takes m_queueMutex, must not be called with it held.
+	bool swapCompactedArchive();
+	// With the archive lock held, renames the archive to a free retired name. False if every
+	// name is still taken by an archive some process maps.
+	bool retireArchive(std::string & retiredFileName);
+	std::string getRetiredFileName(UINT index) const;
+
+	// Probes the in memory copy of the index for the key, returns the slot number where the
+	// key is or the empty slot where it should go. Returns false on read errors.
+	bool findSlot(HANDLE hFile, const std::vector<CacheIndexSlot> &slots, const PendingEntry &entry,
+				  UINT &slotNumber);
+
+	// Writes the record at offset and fills in the slot pointing to it
+	bool writeRecord(HANDLE hFile, UINT offset, const PendingEntry &entry, CacheIndexSlot &slot);
+
+	// Fills in compressedBytecode if compression pays
+	static void compressEntry(PendingEntry &entry);
+
+	// Rehashes into an index twice as big, records do not move
+	static void growIndex(std::vector<CacheIndexSlot> &slots);
 
 	// The directory root for the shader files
 	std::string m_cacheDirectoryRoot;
-};
 
-} // namespace Rendering
+	// The archive holding all the shaders, under m_cacheDirectoryRoot
+	std::string m_archiveFileName;
+
+	// Written by compactArchive() next to the archive, one per process
+	std::string m_compactedFileName;
+
+	// The archive header the compacted file was made from, it is only swapped in if the
+	// archive is still at that
+	CacheFileHeader m_compactedFrom;
+
+	// Open for the life of the cache, INVALID_HANDLE_VALUE if it could not be
+	HANDLE m_hLockFile;
+
+	UINT m_sizeBudget;
+
+	// Searched in order after the writable archive, set up on construction only
+	std::vector<ReadOnlyLayer> m_readOnlyLayers;
 
+	// Mapped on construction and remapped by searchForEntry() after the writer publishes a
+	// batch, null if there is no usable archive. Guarded by m_queueMutex.
+	std::shared_ptr<ClientUtils::MappedFile> m_mappedArchive;
+	CacheFileHeader m_mappedHeader;
 
+	// Writer thread only, batches compactArchive() skips and how many the next failed swap
+	// makes it skip
+	UINT m_compactionSkipBatches;
+	UINT m_compactionRetryBatches;
+
+	// Held while the header is read for mapping or rewritten by the writer
+	std::mutex m_archiveMutex;
+
+	// Everything below is guarded by m_queueMutex
+	std::mutex m_queueMutex;
+	std::condition_variable m_writeQueueChanged;
+	std::vector<PendingEntryPtr> m_writeQueue;
+	// Added but not in the mapped view yet, keyed by entry key
+	std::map<std::string, PendingEntryPtr> m_unpublishedEntries;
+	// Written since the archive was last mapped, dropped from m_unpublishedEntries on remap
+	std::vector<PendingEntryPtr> m_writtenEntries;
+	// Key hashes of entries found in the mapped archive, for the writer to record their use
+	std::vector<UINT64> m_usedKeys;
+	bool m_bArchiveChanged;
+	bool m_bWriterBusy;			// writing a batch or compacting, not waiting for the queue
+	UINT m_flushWaiters;		// threads in flush(), the writer skips the batch delay for them
+	bool m_bStopWriter;
+
+	// Tallied by readAt(), writeAt(), findEntryIn() and decompressEntry(), read from any thread
+	std::atomic<UINT64> m_bytesRead;
+	std::atomic<UINT64> m_bytesWritten;
+	std::atomic<UINT64> m_queueFullWaits;
+	std::atomic<UINT64> m_bytesDecompressed;
+	std::atomic<UINT64> m_decompressMicroseconds;
+
+	std::thread m_writerThread;
+};
+
+} // namespace Rendering
@@ -9,9 +9,13 @@
 // std
 #include <iostream>
 #include <fstream>
+#include <vector>
+#include <algorithm>
+#include <atomic>
 
-// DirectX
-#include <D3DX11.h>  // needed ?
+// Local
+#include "WorkerPool.h"
+#include "Hasher.h"
 
 template<> struct ShaderProfile<ID3D11VertexShader> { static const TCHAR * name; };
 template<> struct ShaderProfile<ID3D11PixelShader> { static const TCHAR * name; };
@@ -22,55 +26,288 @@ template<> struct ShaderProfile<ID3D11DomainShader> { static const TCHAR * name;
 
 template<typename ShaderInterface> const TCHAR * ShaderProfile<ShaderInterface>::name = _T("UNKNOWN");
 
-const TCHAR * ShaderProfile<ID3D11VertexShader>::name =		_T("vs_") SHADER_VERSION _T("_0");
-const TCHAR * ShaderProfile<ID3D11PixelShader>::name =		_T("ps_") SHADER_VERSION _T("_0");
-const TCHAR * ShaderProfile<ID3D11GeometryShader>::name =	_T("gs_") SHADER_VERSION _T("_0");
-const TCHAR * ShaderProfile<ID3D11ComputeShader>::name =	_T("cs_") SHADER_VERSION _T("_0");
-const TCHAR * ShaderProfile<ID3D11HullShader>::name =		_T("hs_") SHADER_VERSION _T("_0");
-const TCHAR * ShaderProfile<ID3D11DomainShader>::name =		_T("ds_") SHADER_VERSION _T("_0");
+const TCHAR * ShaderProfile<ID3D11VertexShader>::name =		_T("vs_5_0");
+const TCHAR * ShaderProfile<ID3D11PixelShader>::name =		_T("ps_5_0");
+const TCHAR * ShaderProfile<ID3D11GeometryShader>::name =	_T("gs_5_0");
+const TCHAR * ShaderProfile<ID3D11ComputeShader>::name =	_T("cs_5_0");
+const TCHAR * ShaderProfile<ID3D11HullShader>::name =		_T("hs_5_0");
+const TCHAR * ShaderProfile<ID3D11DomainShader>::name =		_T("ds_5_0");
 
-void InitShaderProfiles(D3D_FEATURE_LEVEL fl)
+void InitShaderProfiles(Rendering::ShaderLevel level)
 {
-	switch(fl)
-	{
-		case D3D_FEATURE_LEVEL_10_0:
-			ShaderProfile<ID3D11VertexShader>::name =		_T("vs_4_0");
-			ShaderProfile<ID3D11PixelShader>::name =		_T("ps_4_0");
-			ShaderProfile<ID3D11GeometryShader>::name =		_T("gs_4_0");
-			ShaderProfile<ID3D11ComputeShader>::name =		_T("cs_4_0");
-			ShaderProfile<ID3D11HullShader>::name =			_T("hs_4_0");
-			ShaderProfile<ID3D11DomainShader>::name =		_T("ds_4_0");
-			break;
-		case D3D_FEATURE_LEVEL_10_1:
-			ShaderProfile<ID3D11VertexShader>::name =		_T("vs_4_1");
-			ShaderProfile<ID3D11PixelShader>::name =		_T("ps_4_1");
-			ShaderProfile<ID3D11GeometryShader>::name =		_T("gs_4_1");
-			ShaderProfile<ID3D11ComputeShader>::name =		_T("cs_4_1");
-			ShaderProfile<ID3D11HullShader>::name =			_T("hs_4_1");
-			ShaderProfile<ID3D11DomainShader>::name =		_T("ds_4_1");
-			break;
-		case D3D_FEATURE_LEVEL_11_0:
-			ShaderProfile<ID3D11VertexShader>::name =		_T("vs_5_0");
-			ShaderProfile<ID3D11PixelShader>::name =		_T("ps_5_0");
-			ShaderProfile<ID3D11GeometryShader>::name =		_T("gs_5_0");
-			ShaderProfile<ID3D11ComputeShader>::name =		_T("cs_5_0");
-			ShaderProfile<ID3D11HullShader>::name =			_T("hs_5_0");
-			ShaderProfile<ID3D11DomainShader>::name =		_T("ds_5_0");
-			break;
-	}
+	using Rendering::ShaderCatalog;
+
+	ShaderProfile<ID3D11VertexShader>::name =		ShaderCatalog::getProfileName(Rendering::SHADER_STAGE_VERTEX, level);
+	ShaderProfile<ID3D11PixelShader>::name =		ShaderCatalog::getProfileName(Rendering::SHADER_STAGE_PIXEL, level);
+	ShaderProfile<ID3D11GeometryShader>::name =		ShaderCatalog::getProfileName(Rendering::SHADER_STAGE_GEOMETRY, level);
+	ShaderProfile<ID3D11ComputeShader>::name =		ShaderCatalog::getProfileName(Rendering::SHADER_STAGE_COMPUTE, level);
+	ShaderProfile<ID3D11HullShader>::name =			ShaderCatalog::getProfileName(Rendering::SHADER_STAGE_HULL, level);
+	ShaderProfile<ID3D11DomainShader>::name =		ShaderCatalog::getProfileName(Rendering::SHADER_STAGE_DOMAIN, level);
 }
 
 using namespace Rendering;
 
 // The location for the shader disk cache
 const std::string ShaderManager::sDiskCacheDirectoryName = "D3D11Client_ShadersCache\\";
+const std::string ShaderManager::sSystemCacheDirectoryName = "Modules\\D3D11Shaders\\Cache\\";
 
-/* Init shader purpose vs file name map - make an entry here for any new shader purposes
- * Shader file names must include the path from the Orbiter directory as the exe is
- * launched with that set as the working directory.
- */
-const std::map<std::string, std::string> ShaderManager::m_shaderPurposeVsFileNameMap = {
-     { "VertexShader", "Modules\\D3D11Shaders\\Test\\TestVertexShader.fx" }
-    ,{ "PixelShader",  "Modules\\D3D11Shaders\\Test\\TestPixelShader.fx" }
-};
+std::string
+ShaderManager::getDiskCacheDirectory()
+{
+    TCHAR path[MAX_PATH + 1];
+    GetTempPath(MAX_PATH, path);
+    std::string tempFolderPath = path;
+    tempFolderPath += ClientUtils::nativePath(sDiskCacheDirectoryName);
+
+    auto attrs = ::GetFileAttributes(tempFolderPath.c_str());
+    if (attrs == INVALID_FILE_ATTRIBUTES) {
+        // TODO: Check if this happens: directory does not exist, create it
+        ::CreateDirectory(tempFolderPath.c_str(), nullptr);
+    }
+    return tempFolderPath;
+}
+
+UINT
+ShaderManager::warmUp(const std::vector<ShaderPermutation>& permutations)
+{
+    ClientUtils::WorkerPool pool;
+
+    // Reading and hashing the sources is most of the cost of a disk cache hit
+    for (const auto& purpose : ShaderCatalog::m_shaderPurposeVsFileNameMap) {
+        const std::string& shaderFileName = purpose.second;
+        pool.submit([this, &shaderFileName] {
+            ClientUtils::Hash128 sourceHash;
+            m_keyBuilder.getSourceHash(shaderFileName, sourceHash);
+        });
+    }
+    pool.waitIdle();
+
+    std::atomic<UINT> loadedCount(0);
+    for (const auto& permutation : permutations) {
+        if (ShaderCatalog::m_shaderPurposeVsFileNameMap.find(permutation.purpose) ==
+                ShaderCatalog::m_shaderPurposeVsFileNameMap.end()) {
+            continue;
+        }
+        pool.submit([this, &permutation, &loadedCount] {
+            if (loadPermutation(permutation)) {
+                loadedCount++;
+            }
+        });
+    }
+    pool.waitIdle();
+    return loadedCount;
+}
+
+bool
+ShaderManager::loadPermutation(const ShaderPermutation& permutation)
+{
+    const auto& purpose = permutation.purpose;
+    const auto& entryPoint = permutation.entryPoint;
+    const auto& defines = permutation.defines;
+    switch (permutation.stage) {
+    case SHADER_STAGE_VERTEX: {
+        ID3D11VertexShaderPtr result;
+        return getShader(purpose, entryPoint, result, defines);
+    }
+    case SHADER_STAGE_PIXEL: {
+        ID3D11PixelShaderPtr result;
+        return getShader(purpose, entryPoint, result, defines);
+    }
+    case SHADER_STAGE_GEOMETRY: {
+        ID3D11GeometryShaderPtr result;
+        return getShader(purpose, entryPoint, result, defines);
+    }
+    case SHADER_STAGE_COMPUTE: {
+        ID3D11ComputeShaderPtr result;
+        return getShader(purpose, entryPoint, result, defines);
+    }
+    case SHADER_STAGE_HULL: {
+        ID3D11HullShaderPtr result;
+        return getShader(purpose, entryPoint, result, defines);
+    }
+    case SHADER_STAGE_DOMAIN: {
+        ID3D11DomainShaderPtr result;
+        return getShader(purpose, entryPoint, result, defines);
+    }
+    default:
+        return false;
+    }
+}
+
+void
+ShaderManager::addSlotLookup(SlotLookup& lookup, UINT64 lookupHash, UINT slot)
+{
+    SlotLookupTable *table = lookup.current.load(std::memory_order_relaxed);
+    if (!table || (table->count + 1) * 2 > table->mask + 1) {
+        // Rehashed into a new table which is published whole, readers of the old one still
+        // find everything that was in it
+        UINT capacity = table ? (table->mask + 1) * 2 : SlotLookupTable::sMinCapacity;
+        std::unique_ptr<SlotLookupTable> grown(new SlotLookupTable(capacity));
+        if (table) {
+            for (UINT i = 0; i <= table->mask; ++i) {
+                const auto& entry = table->entries[i];
+                UINT oldSlot = entry.slot.load(std::memory_order_relaxed);
+                if (oldSlot != SlotLookupTable::sEmpty) {
+                    addSlotLookup(*grown, entry.hash.load(std::memory_order_relaxed), oldSlot);
+                }
+            }
+        }
+        table = grown.get();
+        lookup.tables.push_back(std::move(grown));
+        addSlotLookup(*table, lookupHash, slot);
+        lookup.current.store(table, std::memory_order_release);
+        return;
+    }
+    addSlotLookup(*table, lookupHash, slot);
+}
+
+void
+ShaderManager::addSlotLookup(SlotLookupTable& table, UINT64 lookupHash, UINT slot)
+{
+    UINT i = (UINT)lookupHash & table.mask;
+    while (table.entries[i].slot.load(std::memory_order_relaxed) != SlotLookupTable::sEmpty) {
+        i = (i + 1) & table.mask;
+    }
+    // The slot number releases the hash to readers
+    table.entries[i].hash.store(lookupHash, std::memory_order_relaxed);
+    table.entries[i].slot.store(slot, std::memory_order_release);
+    table.count++;
+}
+
+bool
+ShaderManager::compileShaderFromFile(
+    const std::string& shaderFileName,
+    const std::string& entryPoint,
+    const std::string& shaderProfile,
+    const ShaderDefines& defines,
+    std::vector<BYTE>& bytecode,
+    std::vector<ShaderDependency>& dependencies)
+{
+    if (!m_pCompiler->compile(shaderFileName,
+                              entryPoint,
+                              shaderProfile,
+                              defines,
+                              m_keyBuilder.getCompileFlags(),
+                              bytecode,
+                              dependencies)) {
+        return false;
+    }
+
+    // The compiler just read these, no need to read them again this session
+    for (const auto& dependency : dependencies) {
+        m_keyBuilder.setSourceHash(dependency.fileName, dependency.contentHash);
+    }
+    return true;
+}
+
+void
+ShaderManager::resetFailedShaders()
+{
+    resetFailed<ID3D11VertexShaderPtr>();
+    resetFailed<ID3D11PixelShaderPtr>();
+    resetFailed<ID3D11GeometryShaderPtr>();
+    resetFailed<ID3D11HullShaderPtr>();
+    resetFailed<ID3D11DomainShaderPtr>();
+    resetFailed<ID3D11ComputeShaderPtr>();
+}
+
+void
+ShaderManager::getStatsReport(std::vector<std::string>& lines) const
+{
+    m_stats.formatReport(m_pShaderDiskCacheMgr->getBytesRead(),
+                         m_pShaderDiskCacheMgr->getBytesWritten(),
+                         m_pShaderDiskCacheMgr->getQueueFullWaits(),
+                         m_pShaderDiskCacheMgr->getBytesDecompressed(),
+                         m_pShaderDiskCacheMgr->getDecompressMicroseconds(),
+                         lines);
+}
+
+bool
+ShaderManager::createInputLayout(
+    const D3D11_INPUT_ELEMENT_DESC *layout,
+    UINT numElements,
+    const ID3D11VertexShaderPtr& shaderObject,
+    ID3D11InputLayoutPtr& result)
+{
+    ID3DBlobPtr signature;
+    if (!getShaderBytecode(shaderObject, signature)) {
+        return false;
+    }
+    return m_pObjectFactory->createInputLayout(layout,
+                                               numElements,
+                                               signature->GetBufferPointer(),
+                                               signature->GetBufferSize(),
+                                               result);
+}
+
+bool
+ShaderManager::getInputLayout(
+    const D3D11_INPUT_ELEMENT_DESC *layout,
+    UINT numElements,
+    const ID3D11VertexShaderPtr& shaderObject,
+    ID3D11InputLayoutPtr& result)
+{
+    ID3DBlobPtr signature;
+    if (!getShaderBytecode(shaderObject, signature)) {
+        return false;
+    }
+
+    ClientUtils::Hasher hasher;
+    hasher.updateValue(numElements);
+    for (UINT i = 0; i < numElements; ++i) {
+        const auto& element = layout[i];
+        hasher.update(element.SemanticName);
+        hasher.updateValue(element.SemanticIndex);
+        hasher.updateValue(element.Format);
+        hasher.updateValue(element.InputSlot);
+        hasher.updateValue(element.AlignedByteOffset);
+        hasher.updateValue(element.InputSlotClass);
+        hasher.updateValue(element.InstanceDataStepRate);
+    }
+    hasher.update(signature->GetBufferPointer(), signature->GetBufferSize());
+    auto hash = hasher.finish();
+    auto key = std::make_pair(hash.low, hash.high);
 
+    std::lock_guard<std::mutex> lock(m_pipelineMutex);
+    auto found = m_inputLayouts.find(key);
+    if (found != m_inputLayouts.end()) {
+        result = found->second;
+        return true;
+    }
+    if (!m_pObjectFactory->createInputLayout(layout,
+                                             numElements,
+                                             signature->GetBufferPointer(),
+                                             signature->GetBufferSize(),
+                                             result)) {
+        return false;
+    }
+    m_inputLayouts[key] = result;
+    return true;
+}
+
+bool
+ShaderManager::getPipeline(const ShaderPipelineDesc& desc, const ShaderPipeline *&result)
+{
+    ID3D11VertexShaderPtr vertexShader;
+    ID3D11PixelShaderPtr pixelShader;
+    ID3D11InputLayoutPtr inputLayout;
+    if (!getShader(desc.purpose, desc.vertexEntryPoint, vertexShader, desc.defines) ||
+            !getShader(desc.purpose, desc.pixelEntryPoint, pixelShader, desc.defines) ||
+            !getInputLayout(desc.layout, desc.numElements, vertexShader, inputLayout)) {
+        return false;
+    }
+
+    auto key = std::make_tuple(vertexShader.GetInterfacePtr(),
+                               pixelShader.GetInterfacePtr(),
+                               inputLayout.GetInterfacePtr());
+    std::lock_guard<std::mutex> lock(m_pipelineMutex);
+    auto& pipeline = m_pipelines[key];
+    if (!pipeline) {
+        pipeline.reset(new ShaderPipeline());
+        pipeline->vertexShader = vertexShader;
+        pipeline->pixelShader = pixelShader;
+        pipeline->inputLayout = inputLayout;
+    }
+    result = pipeline.get();
+    return true;
+}
@@ -5,7 +5,7 @@
  * It also maintains a shader cache in memory mapping shader names to ID3DBlobs of compiled shaders.
  * This prevents re-compilation of already loaded shaders. Uploading to GPU RAM from main memory
  * and vice versa should be managed here in the future.
- * It has direct access to the D3D device. Its mostly a header only class.
+ * It reaches the D3D device only through an IShaderObjectFactory. Its mostly a header only class.
  * This class should have no dependence on Orbiter headers - should be resusable in other Dx apps
  *
  * It uses the ShaderDiskCache class to manage compiled shaders stored in disk.
@@ -18,78 +18,211 @@
  * Shader file names must include the path from the Orbiter directory as the exe is launched with that set as
  * the working directory.
  *
+ * Code that gets a shader often should registerShader() it once and keep the handle, getShader()
+ * with the handle is then an index into the table for its shader type. The string getShader() registers on
+ * every call, which for a shader registered before is a hash of the strings and a lock-free probe.
+ *
  * Shaders are searched as follows:
- * 1. Look in m_shaderMemoryCache with key "ShaderName", if found return ShaderInfo::shaderObject which is the shader ptr
+ * 1. Look in m_shaderTables at the handle's index, if loaded return ShaderSlot::shaderObject which is the shader ptr
  *    This prevents shaders already loaded in main memory from being read from disk cache or compiled
  *    again.
  * 2. Else look in the disk cache using m_pShaderDiskCacheMgr for the compiled shader code. This prevents
- *    recompilation unless the original shader source file was modified. If it was modified it will be
- *    recompiled as searchForEntry() will return false treating it as non-existent in cache
+ *    recompilation unless the original shader source file was modified. The disk cache key is a hash
+ *    of the source bytes, defines, profile, compile flags and entry point, so a modified source (or a
+ *    different permutation) simply misses and is compiled, while copying or touching a file does not.
+ *    Files included by the source are recorded per entry with their hashes; if any of them changed
+ *    the entry is treated as missing and recompiled. Several Orbiter instances can share the cache:
+ *    a miss takes the disk cache's machine-wide lock on the key before compiling, so a shader
+ *    another instance is compiling is waited for and found instead of compiled twice.
+ *    All shaders share one archive in the cache directory which is opened and mapped when the
+ *    ShaderManager is created. Newly compiled shaders are handed to the disk cache which writes
+ *    them out on its own thread. A read-only archive shipped with the install under
+ *    sSystemCacheDirectoryName, if there is one, is searched after it, so a fresh machine or a
+ *    cleaned temp folder still starts warm.
+ *    Keys are made by ShaderCacheKeyBuilder and compiles go through an IShaderCompiler (the
+ *    D3DX11 one in the client), both shared with the offline pack builder in
+ *    Tools\ShaderPackBuilder which fills a cache archive ahead of time.
+ * 3. Shader objects and input layouts are made from the bytecode by an IShaderObjectFactory (the
+ *    device in the client). StubShaderCompiler and StubShaderObjectFactory together take the
+ *    GPU and the HLSL compiler out, so the caches can be profiled and load tested on their
+ *    own. Nothing here needs windows.h or the DirectX SDK then (see D3DPlatform.h), it builds
+ *    on Linux as part of Tools\ShaderPackBuilder.
+ *
+ * Shaders with optional features (normal maps etc., see ShaderFeature) are registered with
+ * registerPermutations() and fetched with the features wanted. Each feature set is a permutation id
+ * that maps to its own slot, and only the permutations asked for are ever compiled. The
+ * feature defines are part of the disk cache key, so each permutation has its own entry there.
+ *
+ * getPipeline() bundles a vertex shader, a pixel shader and an input layout into a shared
+ * ShaderPipeline, with input layouts shared by element descriptions and input signature.
+ *
+ * The purposes and the shaders expected early on are listed in ShaderCatalog.
+ * getShader() may be called from several threads at once. warmUp() uses that to load a list of
+ * expected shaders (ShaderCatalog::m_expectedPermutations) on a worker pool while the client is
+ * still starting up, so the first frames find them in the memory cache.
+ * A hit on a registered shader takes no lock: slots never move once registered (see
+ * ClientUtils::AppendOnlyArray) and a shader object is published once through ShaderSlot::loaded
+ * and never changed after, so readers only need the acquire load of that flag. Registering a
+ * new shader and storing a loaded shader take m_memoryCacheMutex.
+ *
+ * Every getShader() is counted in ShaderCacheStats against its purpose and the tier that served
+ * it (memory, disk or compile), disk cache hits and compiles with their latency, see getStats()
+ * and getStatsReport(). Memory cache hits are not timed and are counted per thread, so they
+ * stay an index and an add to a counter no other thread writes.
  */
 
 #pragma once
 
-// system
-#include <tchar.h> // for _T
-
 // std
 #include <map>
+#include <unordered_map>
 #include <string>
 #include <tuple>
 #include <memory>
-
-// d3d
-#include <d3d11.h>
-#include <D3Dcompiler.h>
+#include <vector>
+#include <mutex>
+#include <chrono>
+#include <type_traits>
+#include <future>
+#include <atomic>
 
 // local
 #include "ShaderDiskCache.h"
-#include "DxTypes.h"
-
-#define SHADER_VERSION _T("5")
+#include "ShaderCatalog.h"
+#include "ShaderCompiler.h"
+#include "ShaderCacheKeyBuilder.h"
+#include "ShaderCacheStats.h"
+#include "ShaderObjectFactory.h"
+#include "Hasher.h"
+#include "WorkerPool.h"
+#include "AppendOnlyArray.h"
+#include "Platform.h" // for _T
+#include "DxTypes.h" // d3d11.h or the stand ins for it
 
 template<typename ShaderInterface> struct ShaderProfile { static const TCHAR * name; };
 
-void InitShaderProfiles(D3D_FEATURE_LEVEL fl);
+// Sets the profiles to the ones of the device's feature level, as D3D11Config::initShaderLevels()
+// maps it (see ShaderCatalog::getProfileName()). A stage the level does not have gets a null
+// profile and registerShader() gives invalid handles for it. 11_0 until called.
+void InitShaderProfiles(Rendering::ShaderLevel level);
 
 namespace Rendering {
 
-class ShaderManager
+// Returned by ShaderManager::registerShader(), T is the shader smart pointer type
+template<typename T>
+struct ShaderHandle
 {
+    static const UINT sInvalidIndex = 0xffffffff;
 
-public:
-    ShaderManager(ID3D11Device * device,
-                  bool keepAllBytecode = false)
-       : m_d3dDevice(device)
-       , m_bKeepAllBytecode(keepAllBytecode)
+    ShaderHandle() : index(sInvalidIndex) {}
+    bool isValid() const { return index != sInvalidIndex; }
+
+    UINT index;     // into the registered shaders
+};
+
+// Returned by ShaderManager::registerPermutations(), a shader with optional features
+template<typename T>
+struct ShaderPermutationsHandle
+{
+    static const UINT sInvalidIndex = 0xffffffff;
+
+    ShaderPermutationsHandle() : index(sInvalidIndex) {}
+    bool isValid() const { return index != sInvalidIndex; }
+
+    UINT index;     // into the registered permutation sets
+};
+
+/*
+ * A vertex shader, a pixel shader and the input layout for the vertex shader, everything a
+ * draw needs from the ShaderManager. Made and owned by ShaderManager::getPipeline(), shared by
+ * everyone asking for the same shaders and layout.
+ */
+struct ShaderPipeline
+{
+    void bind(ID3D11DeviceContext *context) const
     {
+        context->IASetInputLayout(inputLayout);
+        context->VSSetShader(vertexShader, nullptr, 0);
+        context->PSSetShader(pixelShader, nullptr, 0);
+    }
 
-        TCHAR path[MAX_PATH + 1];
-        GetTempPath(MAX_PATH, path);
-        std::string tempFolderPath = path;
-        tempFolderPath += _T(sDiskCacheDirectoryName);
+    ID3D11VertexShaderPtr vertexShader;
+    ID3D11PixelShaderPtr pixelShader;
+    ID3D11InputLayoutPtr inputLayout;
+};
 
-        auto attrs = ::GetFileAttributes(tempFolderPath.c_str());
-        if (attrs == INVALID_FILE_ATTRIBUTES) {
-            // TODO: Check if this happens: directory does not exist, create it
-            ::CreateDirectory(tempFolderPath.c_str(), nullptr);
-        }
-        m_pShaderDiskCacheMgr.reset(new ShaderDiskCache(tempFolderPath));
+// What a ShaderPipeline is made of, both shaders come from the same purpose and defines
+struct ShaderPipelineDesc
+{
+    std::string purpose;
+    std::string vertexEntryPoint;
+    std::string pixelEntryPoint;
+    ShaderDefines defines;
+    const D3D11_INPUT_ELEMENT_DESC *layout;
+    UINT numElements;
+};
+
+class ShaderManager
+{
+
+public:
+    /*
+     * The client passes D3DShaderCompiler and D3DShaderObjectFactory on its device, the stubs
+     * run it without either. The disk cache is in cacheDirectory, getDiskCacheDirectory() if
+     * none is given.
+     */
+    ShaderManager(std::unique_ptr<IShaderCompiler> compiler,
+                  std::unique_ptr<IShaderObjectFactory> objectFactory,
+                  UINT compileFlags,
+                  UINT diskCacheSizeMB,
+                  bool keepAllBytecode = false,
+                  const std::string& cacheDirectory = std::string())
+       : m_bKeepAllBytecode(keepAllBytecode)
+       , m_keyBuilder(compileFlags)
+       , m_pCompiler(std::move(compiler))
+       , m_pObjectFactory(std::move(objectFactory))
+       , m_bShuttingDown(false)
+    {
+        std::string tempFolderPath = cacheDirectory.empty() ? getDiskCacheDirectory() : cacheDirectory;
+        std::vector<std::string> readOnlyRoots(1, sSystemCacheDirectoryName);
+        m_pShaderDiskCacheMgr.reset(new ShaderDiskCache(tempFolderPath, diskCacheSizeMB * 1024 * 1024,
+                                                        readOnlyRoots));
+        m_pCompilePool.reset(new ClientUtils::WorkerPool(sCompileThreadCount));
     }
+    // The smart pointers in the shader tables release the COM shader objects
     ~ShaderManager()
     {
-        for(auto it = m_shaderMemoryCache.begin(); it != m_shaderMemoryCache.end(); it++)
-        {
-            // Smart pointer inside will release the COM shader object inside this ShaderInfo
-            delete (it->second);
-        }
-        m_shaderMemoryCache.clear();
+        // Loads still queued give up, the pool has to be gone before the tables
+        m_bShuttingDown = true;
+        m_pCompilePool.reset();
     }
 
+    // Threads loading shaders for getShaderAsync(), so a burst of misses cannot take
+    // all the cores from the sim
+    static const UINT sCompileThreadCount = 2;
+
     // The location for the shader disk cache - different from source file location
     static const std::string sDiskCacheDirectoryName;
-    // Shader purpose vs filename mapping
-    static const std::map<std::string, std::string> m_shaderPurposeVsFileNameMap;
+
+    // The read-only cache shipped with the install, from the Orbiter directory
+    static const std::string sSystemCacheDirectoryName;
+
+    // sDiskCacheDirectoryName in the temp directory, created if missing. Other data the
+    // client derives at load time (the star vertices) is cached there too.
+    static std::string getDiskCacheDirectory();
+
+    /*
+     * Hashes the sources of all the purposes in the ShaderCatalog, then loads every
+     * permutation (from the disk cache or by compiling) into the memory cache, all spread over
+     * a worker pool. Blocks till done and returns how many permutations loaded.
+     */
+    UINT warmUp(const std::vector<ShaderPermutation>& permutations);
+
+    // Hits, compiles and latencies of getShader() so far, per purpose and tier
+    const ShaderCacheStats& getStats() const { return m_stats; }
+
+    // The stats and the disk cache I/O as lines of text, for the log
+    void getStatsReport(std::vector<std::string>& lines) const;
 
     /*
      * The primary API for loading a shader into main memory or retrieving one already loaded
@@ -102,150 +235,760 @@ public:
                    T &result,
                    const D3D10_SHADER_MACRO* pDefines = nullptr)
     {
-        std::string shaderProfile = ShaderProfile<T>::name;
+        ShaderDefines defines;
+        for (auto define = pDefines; define && define->Name; ++define) {
+            defines.push_back(std::make_pair(define->Name,
+                                             define->Definition ? define->Definition : ""));
+        }
+        return getShader(purpose, entryPoint, result, defines);
+    }
 
-        /*std::string key = fileName + "__EP__" + entryPoint + "__SP__" + shaderProfile;
+    // Same with the defines as name, value pairs
+    template <typename T>
+    bool getShader(const std::string& purpose,
+                   const std::string& entryPoint,
+                   T &result,
+                   const ShaderDefines& defines)
+    {
+        auto handle = registerShader<T>(purpose, entryPoint, defines);
+        if (!handle.isValid()) {
+            m_stats.recordFailure(m_stats.getPurposeId(purpose));
+            return false;
+        }
+        return getShader(handle, result);
+    }
+
+    /*
+     * Registers a shader once, typically when the code using it is set up, and returns the
+     * handle to load it with. The same purpose, entry point and defines always give the same
+     * handle. Nothing is loaded yet. The handle is invalid if the purpose is unknown or the
+     * device's feature level has no shaders of the type (see InitShaderProfiles()).
+     */
+    template <typename T>
+    ShaderHandle<T> registerShader(const std::string& purpose,
+                                   const std::string& entryPoint,
+                                   const ShaderDefines& defines = ShaderDefines())
+    {
+        // T is the smart pointer type, profiles are kept against the interface type
+        const TCHAR * shaderProfile = ShaderProfile<typename T::Interface>::name;
+        ShaderHandle<T> handle;
+        if (!shaderProfile) {
+            // The device's feature level has no such stage
+            return handle;
+        }
+
+        // Registered before, the common case: no strings made and no lock
+        auto& table = getTable<T>();
+        UINT64 lookupHash = getLookupHash(purpose, entryPoint, shaderProfile, defines);
+        handle.index = findSlot(table, lookupHash, purpose, entryPoint, shaderProfile, defines);
+        if (handle.isValid()) {
+            return handle;
+        }
+
+        if (ShaderCatalog::m_shaderPurposeVsFileNameMap.find(purpose) ==
+                ShaderCatalog::m_shaderPurposeVsFileNameMap.end()) {
+            return handle;
+        }
+
+        // The same purpose can be requested with different entry points and defines
         std::string definesStr;
-        createDefinesString(pDefines, definesStr);
-        key += "__D__" + definesStr;*/
+        ShaderCacheKeyBuilder::createDefinesString(defines, definesStr);
+        std::string key = purpose + "__EP__" + entryPoint + "__SP__" + shaderProfile;
+        key += "__D__" + definesStr;
 
-        // Look up the shader file name using for the required purpose
-        std::string shaderFileName;
-        if (m_shaderPurposeVsFileNameMap.count(purpose) > 0) {
-            shaderFileName = m_shaderMemoryCache[purpose];
+        std::lock_guard<std::mutex> lock(m_memoryCacheMutex);
+        auto found = table.slotIndex.find(key);
+        if (found != table.slotIndex.end()) {
+            // Registered meanwhile, or with the same defines in another order
+            handle.index = found->second;
+            return handle;
+        }
+        // The registration is filled in before the slot is published and never changes after
+        auto slot = table.slots.append();
+        if (!slot) {
+            return handle;
         }
+        slot->registration.purpose = purpose;
+        slot->registration.purposeId = m_stats.getPurposeId(purpose);
+        slot->registration.entryPoint = entryPoint;
+        slot->registration.shaderProfile = shaderProfile;
+        slot->registration.defines = defines;
+        slot->registration.definesStr = definesStr;
+        handle.index = table.slots.publish();
+        table.slotIndex[key] = handle.index;
+        addSlotLookup(table.slotLookup, lookupHash, handle.index);
+        return handle;
+    }
 
-        // Now search for the shader in memory cache
-        if (m_shaderMemoryCache.count(purpose) > 0) {
+    /*
+     * Gets a registered shader. Once it is loaded this is an index into the registered
+     * shaders, no strings, no map, no lock, no clock. Otherwise it is loaded from the disk
+     * cache or compiled.
+     */
+    template <typename T>
+    bool getShader(ShaderHandle<T> handle, T &result)
+    {
+        // The handle type picks the table at compile time
+        const auto& table = getTable<T>();
+        if (handle.index >= table.slots.size()) {
+            return false;
+        }
+        const auto& slot = table.slots[handle.index];
+        if (slot.loaded.load(std::memory_order_acquire)) {
             // Found !! no need to compile, simplest case ! return shader object.
-            auto val = dynamic_cast<ShaderInfo<T>*>(m_shaderMemoryCache[purpose]);
-            result = val->shaderObject;
+            result = slot.shaderObject;
+            m_stats.recordMemoryHit(slot.registration.purposeId);
             return true;
         }
-        else {
-            // Not in memory, prepare a blob to receive it from disk
-            ID3DBlobPtr data;
-            CacheEntry entry;
-            entry.keyLength = (USHORT)purpose.length();
-            entry.key = purpose.c_str();
-
-            // Look in disk cache with shader filename
-            if (m_pShaderDiskCacheMgr->searchForEntry(entry, shaderFileName)) {
-                // Compiled shader found in disk cache, so just load it
-                // must be the latest compiled stuff. entry will contain the shader
-                // bytecode after the call to searchForEntry()
-                D3DCreateBlob(entry.bytecodeLength, &data);
-
-                // Copy into data for creating the shader object below - last step
-                CopyMemory(data->GetBufferPointer(),
-                           entry.bytecode,
-                           entry.bytecodeLength);
-            }
-            else {
-                // The shader is not in the disk cache - recompile from file
-                if (CompileShaderFromFile(shaderFileName.c_str(),
-                                          entryPoint.c_str(),
-                                          shaderProfile.c_str(),
-                                          &data, pDefines)) {
-                    // compiled bytecode in data, copy to entry to create entry
-                    // to memory cache
-                    entry.bytecodeLength = (UINT)data->GetBufferSize();
-                    entry.bytecode = data->GetBufferPointer();
-                    // add to disk with shader filename
-                    m_pShaderDiskCacheMgr->addCacheEntry(entry, shaderFileName);
-                }
-                else {
-                    return false;
-                }
+        if (slot.failed.load(std::memory_order_relaxed)) {
+            // Not tried again till resetFailedShaders()
+            m_stats.recordFailure(slot.registration.purposeId);
+            return false;
+        }
+        return loadOrJoin(handle, result);
+    }
+
+    /*
+     * Gets a registered shader without blocking on a miss. The load (from the disk cache or
+     * by compiling, the disk cache is updated from there too) is queued for the compile
+     * threads and the future becomes ready with the shader, or a null one if it failed.
+     * Ready at once if the shader is loaded already or failed before, a shader that failed is
+     * not queued again till resetFailedShaders(). Asking again while it loads gives the same
+     * future, a shader is never loaded twice.
+     */
+    template <typename T>
+    std::shared_future<T> getShaderAsync(ShaderHandle<T> handle)
+    {
+        auto& table = getTable<T>();
+        if (handle.index >= table.slots.size()) {
+            std::promise<T> failed;
+            failed.set_value(T());
+            return failed.get_future().share();
+        }
+        auto& slot = table.slots[handle.index];
+        if (slot.loaded.load(std::memory_order_acquire)) {
+            std::promise<T> ready;
+            ready.set_value(slot.shaderObject);
+            m_stats.recordMemoryHit(slot.registration.purposeId);
+            return ready.get_future().share();
+        }
+        if (slot.failed.load(std::memory_order_relaxed)) {
+            std::promise<T> failed;
+            failed.set_value(T());
+            return failed.get_future().share();
+        }
+
+        std::shared_ptr<std::promise<T>> promise;
+        std::shared_future<T> pending;
+        {
+            std::lock_guard<std::mutex> lock(m_memoryCacheMutex);
+            if (slot.loaded.load(std::memory_order_relaxed) ||
+                    slot.failed.load(std::memory_order_relaxed)) {
+                // Stored since the checks above, loads are stored under the lock
+                std::promise<T> ready;
+                ready.set_value(slot.shaderObject);
+                return ready.get_future().share();
             }
+            pending = joinLoad(slot, promise);
+        }
+        if (promise) {
+            m_pCompilePool->submit([this, handle, promise] {
+                T result;
+                auto loaded = !m_bShuttingDown &&
+                              loadShader(handle, result, std::chrono::steady_clock::now());
+                finishLoad(handle, *promise, loaded, result);
+            });
+        }
+        return pending;
+    }
 
-            // Prepare for an entry into the shader memory cache
-            auto shaderInfoObj = new ShaderInfo<T>();
+    /*
+     * For drawing code that can make do with a fallback shader till the real one is there:
+     * gets the shader if it is loaded, else queues it through getShaderAsync() and returns
+     * the fallback in result. Returns whether result is the real shader. Called every frame,
+     * so a loaded or failed shader is only a flag read, no future is made for it.
+     */
+    template <typename T>
+    bool getShaderOrFallback(ShaderHandle<T> handle, T &result, const T &fallback)
+    {
+        const auto& table = getTable<T>();
+        if (handle.index < table.slots.size()) {
+            const auto& slot = table.slots[handle.index];
+            if (slot.loaded.load(std::memory_order_acquire)) {
+                result = slot.shaderObject;
+                m_stats.recordMemoryHit(slot.registration.purposeId);
+                return true;
+            }
+            if (slot.failed.load(std::memory_order_relaxed)) {
+                result = fallback;
+                return false;
+            }
+        }
 
-            // Create the shader object
-            if (createShaderObject(key, data, shaderInfoObj)) {
-                m_shaderMemoryCache.insert(std::make_pair(purpose, shaderInfoObj));
-                result = shaderInfoObj->shaderObject;
+        auto pending = getShaderAsync(handle);
+        if (pending.wait_for(std::chrono::seconds(0)) == std::future_status::ready) {
+            auto shader = pending.get();
+            if (shader) {
+                result = shader;
                 return true;
             }
-            delete shaderInfoObj;
         }
+        result = fallback;
         return false;
     }
 
+    /*
+     * Shaders that failed to load (a missing source, a compile error) are not tried again,
+     * getShader() fails at once and getShaderAsync() does not queue them. This lets them all
+     * be tried again, say once their sources are fixed. Loaded shaders are kept.
+     */
+    void resetFailedShaders();
+
+    /*
+     * Registers a shader that comes in permutations: the features in supportedFeatures
+     * (ShaderFeature bits) can each be turned on or off per getShader(). Nothing is compiled
+     * here, each permutation is registered and loaded the first time it is asked for. The
+     * handle is invalid if the purpose is unknown.
+     */
+    template <typename T>
+    ShaderPermutationsHandle<T> registerPermutations(const std::string& purpose,
+                                                     const std::string& entryPoint,
+                                                     ShaderFeatures supportedFeatures)
+    {
+        ShaderPermutationsHandle<T> handle;
+        if (ShaderCatalog::m_shaderPurposeVsFileNameMap.find(purpose) ==
+                ShaderCatalog::m_shaderPurposeVsFileNameMap.end()) {
+            return handle;
+        }
+
+        std::string key = purpose + "__EP__" + entryPoint + "__F__" + std::to_string(supportedFeatures);
+        auto& table = getTable<T>();
+        std::lock_guard<std::mutex> lock(m_memoryCacheMutex);
+        auto found = table.permutationSetIndex.find(key);
+        if (found != table.permutationSetIndex.end()) {
+            handle.index = found->second;
+            return handle;
+        }
+        auto set = table.permutationSets.append();
+        if (!set) {
+            return handle;
+        }
+        set->purpose = purpose;
+        set->entryPoint = entryPoint;
+        set->supportedFeatures = supportedFeatures & (SHADER_PERMUTATION_COUNT - 1);
+        for (UINT id = 0; id < SHADER_PERMUTATION_COUNT; ++id) {
+            set->slots[id].store(ShaderHandle<T>::sInvalidIndex, std::memory_order_relaxed);
+        }
+        handle.index = table.permutationSets.publish();
+        table.permutationSetIndex[key] = handle.index;
+        return handle;
+    }
+
+    /*
+     * The handle of one permutation, for getShader() or getShaderAsync(). Features the shader
+     * does not support are ignored, the rest is the permutation id.
+     */
+    template <typename T>
+    ShaderHandle<T> getPermutation(ShaderPermutationsHandle<T> handle, ShaderFeatures features)
+    {
+        ShaderHandle<T> result;
+        auto& table = getTable<T>();
+        if (handle.index >= table.permutationSets.size()) {
+            return result;
+        }
+        auto& set = table.permutationSets[handle.index];
+        ShaderFeatures id = features & set.supportedFeatures;
+        result.index = set.slots[id].load(std::memory_order_acquire);
+        if (result.isValid()) {
+            return result;
+        }
+
+        // First time for this permutation, registering the same defines twice gives the
+        // same slot so racing here is harmless
+        ShaderDefines defines;
+        ShaderCatalog::getFeatureDefines(id, defines);
+        result = registerShader<T>(set.purpose, set.entryPoint, defines);
+        set.slots[id].store(result.index, std::memory_order_release);
+        return result;
+    }
+
+    // Gets the permutation with the features
+    template <typename T>
+    bool getShader(ShaderPermutationsHandle<T> handle, ShaderFeatures features, T &result)
+    {
+        return getShader(getPermutation(handle, features), result);
+    }
+
+    /*
+     * The bytecode kept for a loaded shader object. For a vertex shader that is only its input
+     * signature, which is all input layout creation needs, unless all bytecode is kept. Other
+     * shaders only have bytecode if all is kept.
+     */
     template<typename T>
-    bool getShaderBytecode(T &shaderObject, ID3DBlobPtr &bytecode)
+    bool getShaderBytecode(const T &shaderObject, ID3DBlobPtr &bytecode)
     {
-        for(auto it = m_shaderMemoryCache.begin(); it != m_shaderMemoryCache.end(); it++)
-        {
-            auto shaderInfoObj = dynamic_cast<ShaderInfo<T>*>(it->second);
-            if (shaderInfoObj && shaderInfoObj->shaderObject == shaderObject)
-            {
-                bytecode = shaderInfoObj->shaderCode;
-                return true;
-            }
+        const auto& table = getTable<T>();
+        std::lock_guard<std::mutex> lock(m_memoryCacheMutex);
+        auto found = table.bytecodeIndex.find(shaderObject.GetInterfacePtr());
+        if (found == table.bytecodeIndex.end()) {
+            return false;
         }
-        return false;
+        bytecode = found->second;
+        return true;
     }
-private:
+
+    // Creates an input layout for the vertex shader from its input signature
+    bool createInputLayout(const D3D11_INPUT_ELEMENT_DESC *layout,
+                           UINT numElements,
+                           const ID3D11VertexShaderPtr& shaderObject,
+                           ID3D11InputLayoutPtr& result);
 
     /*
-     * This nested interface class exists to allow storage of different shader types in 1 map
-     * for the memory cache (See m_shaderMemoryCache below). There is no higher level common
-     * parent that we have found so far for ID3D11VertexShaderPtr etc
+     * Like createInputLayout() but layouts are shared: one is only created for a new
+     * combination of element descriptions and vertex shader input signature.
      */
-    class IGenericShaderInfo
+    bool getInputLayout(const D3D11_INPUT_ELEMENT_DESC *layout,
+                        UINT numElements,
+                        const ID3D11VertexShaderPtr& shaderObject,
+                        ID3D11InputLayoutPtr& result);
+
+    /*
+     * Gets the shaders through the caches and the shared input layout, and returns the
+     * pipeline made of them. The pipeline stays valid as long as the ShaderManager.
+     */
+    bool getPipeline(const ShaderPipelineDesc& desc, const ShaderPipeline *&result);
+private:
+
+    // What it takes to load a registered shader
+    struct ShaderRegistration
     {
-    public:
-        IGenericShaderInfo() {}
-        virtual ~IGenericShaderInfo() {}
+        std::string purpose;
+        UINT purposeId;         // for m_stats
+        std::string entryPoint;
+        std::string shaderProfile;
+        ShaderDefines defines;
+        std::string definesStr;
     };
-    // The above interface is specialized for different shader object types
-    template<typename T> class ShaderInfo : public IGenericShaderInfo
+
+    // A shader registered with registerPermutations(), slots are indexed by permutation id
+    // and hold the slot number of each permutation registered so far. Only slots changes
+    // once the set is published.
+    struct ShaderPermutationSet
+    {
+        std::string purpose;
+        std::string entryPoint;
+        ShaderFeatures supportedFeatures;
+        std::atomic<UINT> slots[SHADER_PERMUTATION_COUNT];
+    };
+
+    /*
+     * A registered shader and the shader object once loaded. The registration is set before
+     * the slot is published, shaderObject before loaded is set and neither changes after, so
+     * readers that see loaded need no lock. failed is set when a load fails and only cleared
+     * by resetFailedShaders(). pending is guarded by m_memoryCacheMutex.
+     */
+    template<typename T>
+    struct ShaderSlot
     {
-    public:
-        ShaderInfo() { }
-        virtual ~ShaderInfo() { }
+        ShaderSlot() : loaded(false), failed(false) {}
+
+        ShaderRegistration registration;
         T shaderObject;
-        ID3DBlobPtr shaderCode;
+        std::atomic<bool> loaded;
+        std::atomic<bool> failed;
+        std::shared_future<T> pending;  // valid while getShaderAsync() is loading it
+    };
+
+    /*
+     * The registered slots by a hash of their purpose, entry point, profile and defines, so
+     * registerShader() finds a registered shader without a lock. Open addressing at most half
+     * full: readers probe from the hash to the first empty entry and check the registration of
+     * each slot whose hash matches. An entry's hash is stored before its slot number is
+     * released, and entries are never removed. When it fills up a table twice the size
+     * replaces it; the old ones are kept till the ShaderManager goes as readers may still be
+     * probing them.
+     */
+    struct SlotLookupTable
+    {
+        static const UINT sEmpty = 0xffffffff;
+        static const UINT sMinCapacity = 64;
+
+        struct Entry
+        {
+            Entry() : hash(0), slot(sEmpty) {}
+            std::atomic<UINT64> hash;
+            std::atomic<UINT> slot;
+        };
+
+        explicit SlotLookupTable(UINT capacity)
+            : mask(capacity - 1)
+            , count(0)
+            , entries(new Entry[capacity])
+        {}
+
+        UINT mask;          // capacity - 1, the capacity is a power of 2
+        UINT count;         // written under m_memoryCacheMutex
+        std::unique_ptr<Entry[]> entries;
+    };
+
+    // The current SlotLookupTable and the ones it replaced
+    struct SlotLookup
+    {
+        SlotLookup() : current(nullptr) {}
+
+        std::atomic<SlotLookupTable*> current;
+        std::vector<std::unique_ptr<SlotLookupTable>> tables;
     };
-    // The memory cache for shader objects which have already been loaded once
-    // It maps shader purpose vs shader object
-    std::map<std::string, IGenericShaderInfo*> m_shaderMemoryCache;
 
+    // The memory cache for one shader type, handles index the slots
     template<typename T>
-    bool createShaderObject(const std::string& key, ID3DBlobPtr &data, ShaderInfo<T>* result)
+    struct ShaderTable
     {
-        return false;
+        // Read without a lock, appended to under m_memoryCacheMutex
+        ClientUtils::AppendOnlyArray<ShaderSlot<T>> slots;
+        // Maps shader purpose + entry point + profile + defines vs the slot number, only
+        // used when registering a shader that slotLookup does not find
+        std::map<std::string, UINT> slotIndex;
+        // The lock-free side of slotIndex, added to as slots are registered
+        SlotLookup slotLookup;
+        // Maps loaded shader objects vs their kept bytecode, filled in as they load
+        std::unordered_map<typename T::Interface*, ID3DBlobPtr> bytecodeIndex;
+        // Permutation handles index these, read without a lock like slots
+        ClientUtils::AppendOnlyArray<ShaderPermutationSet, 4, 256> permutationSets;
+        // Maps purpose + entry point + supported features vs the set number
+        std::map<std::string, UINT> permutationSetIndex;
+    };
+
+    // A table per shader type, getTable<T>() picks one at compile time
+    std::tuple<ShaderTable<ID3D11VertexShaderPtr>,
+               ShaderTable<ID3D11PixelShaderPtr>,
+               ShaderTable<ID3D11GeometryShaderPtr>,
+               ShaderTable<ID3D11HullShaderPtr>,
+               ShaderTable<ID3D11DomainShaderPtr>,
+               ShaderTable<ID3D11ComputeShaderPtr>> m_shaderTables;
+    // Guards appending to and storing into all the tables, reading loaded slots needs none
+    std::mutex m_memoryCacheMutex;
+
+    template<typename T>
+    ShaderTable<T>& getTable()
+    {
+        return std::get<ShaderTable<T>>(m_shaderTables);
     }
-    template<> bool createShaderObject(const std::string& key, ID3DBlobPtr &data, ShaderInfo<ID3D11VertexShaderPtr>* result)
+
+    static UINT64 getLookupHash(const std::string& purpose,
+                                const std::string& entryPoint,
+                                const TCHAR * shaderProfile,
+                                const ShaderDefines& defines)
     {
-        auto res = SUCCEEDED(m_d3dDevice->CreateVertexShader(data->GetBufferPointer(),
-                                                             data->GetBufferSize(),
-                                                             nullptr,
-                                                             &result->shaderObject));
-        result->shaderCode = data;
-        return res;
+        ClientUtils::Hasher hasher;
+        hasher.update(purpose);
+        hasher.update(entryPoint);
+        hasher.update(shaderProfile);
+        for (const auto& define : defines) {
+            hasher.update(define.first);
+            hasher.update(define.second);
+        }
+        return hasher.finish().low;
     }
-    template<> bool createShaderObject(const std::string& key, ID3DBlobPtr &data, ShaderInfo<ID3D11PixelShaderPtr>* result)
+
+    /*
+     * The slot registered with exactly these, without a lock. Defines in another order than
+     * they were registered with are not found here, registerShader() finds those under the
+     * lock.
+     */
+    template<typename T>
+    static UINT findSlot(const ShaderTable<T>& table,
+                         UINT64 lookupHash,
+                         const std::string& purpose,
+                         const std::string& entryPoint,
+                         const TCHAR * shaderProfile,
+                         const ShaderDefines& defines)
+    {
+        const SlotLookupTable *lookup = table.slotLookup.current.load(std::memory_order_acquire);
+        if (!lookup) {
+            return ShaderHandle<T>::sInvalidIndex;
+        }
+        for (UINT i = (UINT)lookupHash & lookup->mask; ; i = (i + 1) & lookup->mask) {
+            const auto& entry = lookup->entries[i];
+            UINT slot = entry.slot.load(std::memory_order_acquire);
+            if (slot == SlotLookupTable::sEmpty) {
+                return ShaderHandle<T>::sInvalidIndex;
+            }
+            if (entry.hash.load(std::memory_order_relaxed) != lookupHash) {
+                continue;
+            }
+            const ShaderRegistration& registration = table.slots[slot].registration;
+            if (registration.purpose == purpose &&
+                    registration.entryPoint == entryPoint &&
+                    registration.shaderProfile == shaderProfile &&
+                    registration.defines == defines) {
+                return slot;
+            }
+        }
+    }
+
+    // Under m_memoryCacheMutex, once the slot is published
+    static void addSlotLookup(SlotLookup& lookup, UINT64 lookupHash, UINT slot);
+    static void addSlotLookup(SlotLookupTable& table, UINT64 lookupHash, UINT slot);
+
+    /*
+     * Under m_memoryCacheMutex, the slot is neither loaded nor failed. The load of the slot
+     * in flight in this process, or a new one the caller is to run (promise is set then) and
+     * finish with finishLoad(). This keeps two threads from loading the same shader: lockKey()
+     * only keeps other processes out, the threads of this one share its lock file.
+     */
+    template <typename T>
+    static std::shared_future<T> joinLoad(ShaderSlot<T>& slot, std::shared_ptr<std::promise<T>>& promise)
+    {
+        if (!slot.pending.valid()) {
+            promise = std::make_shared<std::promise<T>>();
+            slot.pending = promise->get_future().share();
+        }
+        return slot.pending;
+    }
+
+    // Ends a load joinLoad() handed out, the threads that joined it get the result
+    template <typename T>
+    void finishLoad(ShaderHandle<T> handle, std::promise<T>& promise, bool loaded, const T& result)
     {
-        auto res = SUCCEEDED(m_d3dDevice->CreatePixelShader(data->GetBufferPointer(),
-                                                            data->GetBufferSize(),
-                                                            nullptr,
-                                                            &result->shaderObject));
-        if (m_bKeepAllBytecode)
         {
-            result->shaderCode = data;
+            std::lock_guard<std::mutex> lock(m_memoryCacheMutex);
+            getTable<T>().slots[handle.index].pending = std::shared_future<T>();
         }
-        return res;
+        promise.set_value(loaded ? result : T());
+    }
+
+    // The miss path of getShader(): loads the shader, or waits for the thread loading it
+    template <typename T>
+    bool loadOrJoin(ShaderHandle<T> handle, T &result)
+    {
+        auto startTime = std::chrono::steady_clock::now();
+        auto& slot = getTable<T>().slots[handle.index];
+        std::shared_ptr<std::promise<T>> promise;
+        std::shared_future<T> pending;
+        {
+            std::lock_guard<std::mutex> lock(m_memoryCacheMutex);
+            if (slot.loaded.load(std::memory_order_relaxed)) {
+                result = slot.shaderObject;
+                m_stats.recordMemoryHit(slot.registration.purposeId);
+                return true;
+            }
+            if (slot.failed.load(std::memory_order_relaxed)) {
+                m_stats.recordFailure(slot.registration.purposeId);
+                return false;
+            }
+            pending = joinLoad(slot, promise);
+        }
+        if (promise) {
+            auto loaded = loadShader(handle, result, startTime);
+            finishLoad(handle, *promise, loaded, result);
+            return loaded;
+        }
+
+        // Loaded by another thread, the tier it came from is counted there
+        result = pending.get();
+        if (!result) {
+            m_stats.recordFailure(slot.registration.purposeId);
+            return false;
+        }
+        m_stats.recordMemoryHit(slot.registration.purposeId);
+        return true;
+    }
+
+    // The slow path of getShader(), the shader is not in memory yet. Only run by the thread
+    // joinLoad() handed the load to, so never twice at once for a slot.
+    template <typename T>
+    bool loadShader(ShaderHandle<T> handle, T &result, std::chrono::steady_clock::time_point startTime)
+    {
+        auto& table = getTable<T>();
+
+        // Slots do not move and registrations do not change, no need to lock or copy
+        const ShaderRegistration& slot = table.slots[handle.index].registration;
+
+        // Look up the shader file name using for the required purpose
+        const std::string& shaderFileName =
+            ShaderCatalog::m_shaderPurposeVsFileNameMap.find(slot.purpose)->second;
+
+        // The disk cache is keyed by a hash of the source and everything else
+        // that goes into the compile, so an unchanged shader is never recompiled
+        std::string diskCacheKey;
+        if (!m_keyBuilder.createKey(shaderFileName, slot.entryPoint, slot.shaderProfile,
+                                    slot.definesStr, diskCacheKey)) {
+            return loadFailed(handle);
+        }
+
+        // Not in memory, the bytecode either comes from disk as a view into the
+        // mapped cache file or is compiled into a buffer here
+        std::vector<BYTE> compiled;
+        const void *bytecode = nullptr;
+        SIZE_T bytecodeLength = 0;
+        auto tier = SHADER_TIER_DISK;
+        CacheEntry entry;
+        entry.keyLength = (UINT)diskCacheKey.length();
+        entry.key = diskCacheKey.c_str();
+
+        // Look in the disk cache archive, the entry is only good if none of the
+        // files it included have changed since it was compiled
+        bool found = m_pShaderDiskCacheMgr->searchForEntry(entry) &&
+                     m_keyBuilder.dependenciesUnchanged(entry.dependencies);
+        if (!found) {
+            // Another Orbiter sharing the cache may be compiling it right now, wait for
+            // it and look again. If it is still missing the lock is kept till the entry
+            // compiled here is written, so the others wait for this one instead.
+            m_pShaderDiskCacheMgr->lockKey(entry);
+            found = m_pShaderDiskCacheMgr->searchForEntry(entry) &&
+                    m_keyBuilder.dependenciesUnchanged(entry.dependencies);
+            if (found) {
+                entry.keyLock.reset();
+            }
+        }
+        if (found) {
+            // Compiled shader found in disk cache, so just load it
+            // entry will point to the shader bytecode in the mapped cache file
+            // after the call to searchForEntry()
+            bytecode = entry.bytecode;
+            bytecodeLength = entry.bytecodeLength;
+        }
+        else {
+            // The shader is not in the disk cache - recompile from file
+            tier = SHADER_TIER_COMPILE;
+            if (compileShaderFromFile(shaderFileName,
+                                      slot.entryPoint,
+                                      slot.shaderProfile,
+                                      slot.defines,
+                                      compiled,
+                                      entry.dependencies)) {
+                // point entry at the compiled bytecode to create entry
+                // to memory cache
+                entry.bytecodeLength = (UINT)compiled.size();
+                entry.bytecode = compiled.data();
+                bytecode = entry.bytecode;
+                bytecodeLength = entry.bytecodeLength;
+                // queue for the disk cache, written out off this thread, the key lock
+                // goes along
+                m_pShaderDiskCacheMgr->addCacheEntry(entry);
+                entry.keyLock.reset();
+            }
+            else {
+                return loadFailed(handle);
+            }
+        }
+
+        // Create the shader object, entry keeps the bytecode alive till it goes
+        // out of scope
+        T shaderObject;
+        ID3DBlobPtr shaderCode;
+        if (!createShaderObject(bytecode, bytecodeLength, shaderObject, shaderCode)) {
+            return loadFailed(handle);
+        }
+        {
+            std::lock_guard<std::mutex> lock(m_memoryCacheMutex);
+            auto& cached = table.slots[handle.index];
+            if (!cached.loaded.load(std::memory_order_relaxed)) {
+                cached.shaderObject = shaderObject;
+                if (shaderCode) {
+                    table.bytecodeIndex[shaderObject.GetInterfacePtr()] = shaderCode;
+                }
+                // Publishes shaderObject to the lock-free readers in getShader()
+                cached.loaded.store(true, std::memory_order_release);
+            }
+            // else loaded before the load was joined, use that one
+            result = cached.shaderObject;
+        }
+        recordLookup(slot.purposeId, tier, startTime);
+        return true;
+    }
+
+    // Marks the slot failed, so it is not loaded again till resetFailedShaders()
+    template <typename T>
+    bool loadFailed(ShaderHandle<T> handle)
+    {
+        auto& slot = getTable<T>().slots[handle.index];
+        slot.failed.store(true, std::memory_order_relaxed);
+        m_stats.recordFailure(slot.registration.purposeId);
+        return false;
+    }
+
+    template <typename T>
+    void resetFailed()
+    {
+        auto& table = getTable<T>();
+        for (UINT index = 0; index < table.slots.size(); ++index) {
+            table.slots[index].failed.store(false, std::memory_order_relaxed);
+        }
+    }
+
+    // Compiles and returns the files pulled in through #include in dependencies
+    bool compileShaderFromFile(const std::string& shaderFileName,
+                               const std::string& entryPoint,
+                               const std::string& shaderProfile,
+                               const ShaderDefines& defines,
+                               std::vector<BYTE>& bytecode,
+                               std::vector<ShaderDependency>& dependencies);
+
+    void recordLookup(UINT purposeId, ShaderCacheTier tier,
+                      std::chrono::steady_clock::time_point startTime)
+    {
+        auto elapsed = std::chrono::steady_clock::now() - startTime;
+        m_stats.recordLookup(purposeId, tier,
+            (UINT64)std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count());
+    }
+
+    // Loads one ShaderCatalog permutation through the getShader() for its stage
+    bool loadPermutation(const ShaderPermutation& permutation);
+
+    /*
+     * Creates the shader object straight from bytecode which may be a view into the mapped
+     * disk cache. A blob is only made when the bytecode has to be kept around.
+     */
+    template<typename T>
+    bool createShaderObject(const void *bytecode, SIZE_T bytecodeLength, T &shaderObject,
+                            ID3DBlobPtr &shaderCode)
+    {
+        if (!m_pObjectFactory->createShader(bytecode, bytecodeLength, shaderObject)) {
+            return false;
+        }
+        if (m_bKeepAllBytecode) {
+            keepBytecode(bytecode, bytecodeLength, shaderCode);
+        }
+        else if (std::is_same<T, ID3D11VertexShaderPtr>::value) {
+            // Input layout creation only needs the input signature, a fraction of the size
+            m_pObjectFactory->getInputSignature(bytecode, bytecodeLength, shaderCode);
+        }
+        return true;
+    }
+
+    // Bytecode is in the mapped disk cache or a compile buffer, copy it out
+    void keepBytecode(const void *bytecode, SIZE_T bytecodeLength, ID3DBlobPtr &shaderCode)
+    {
+        m_pObjectFactory->createBlob(bytecode, bytecodeLength, shaderCode);
     }
 
-    ID3D11Device *m_d3dDevice;
     bool m_bKeepAllBytecode;
 
+    // Disk cache keys, knows D3D11Config::iShaderCompileFlag
+    ShaderCacheKeyBuilder m_keyBuilder;
+
+    std::unique_ptr<IShaderCompiler> m_pCompiler;
+    std::unique_ptr<IShaderObjectFactory> m_pObjectFactory;
+
     // The manager for shader compiled code on disk
     std::unique_ptr<ShaderDiskCache> m_pShaderDiskCacheMgr;
 
+    ShaderCacheStats m_stats;
+
+    // Input layouts by hash of the element descriptions and the input signature
+    std::map<std::pair<UINT64, UINT64>, ID3D11InputLayoutPtr> m_inputLayouts;
+    // Pipelines by the objects they are made of
+    std::map<std::tuple<ID3D11VertexShader*, ID3D11PixelShader*, ID3D11InputLayout*>,
+             std::unique_ptr<ShaderPipeline>> m_pipelines;
+    // Guards both
+    std::mutex m_pipelineMutex;
+
+    // Runs getShaderAsync() loads
+    std::unique_ptr<ClientUtils::WorkerPool> m_pCompilePool;
+    std::atomic<bool> m_bShuttingDown;
+
 };
 
 } // namespace Rendering
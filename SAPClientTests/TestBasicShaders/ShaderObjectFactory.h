@@ -0,0 +1,47 @@
+/*
+ * The IShaderObjectFactory interface turns bytecode into the D3D objects that use it: shader
+ * objects of each stage, the input signature kept for vertex shaders, input layouts and the
+ * blobs bytecode is kept in. It is
+ * the other half of IShaderCompiler; with both swapped for the stubs the ShaderManager caches
+ * run without a GPU:
+ *   D3DShaderObjectFactory  - the real thing, calls on the ID3D11Device
+ *   StubShaderObjectFactory - objects that only hold a hash of their bytecode, no device
+ *                             needed, pairs with StubShaderCompiler
+ * Implementations must be safe to call from several threads at once.
+ * Like ShaderManager this has no dependence on Orbiter headers.
+ */
+
+#pragma once
+
+// Local
+#include "DxTypes.h"
+
+namespace Rendering {
+
+class IShaderObjectFactory
+{
+public:
+    virtual ~IShaderObjectFactory() {}
+
+    // One per shader type so ShaderManager templates pick the right one by overloading
+    virtual bool createShader(const void *bytecode, SIZE_T bytecodeLength, ID3D11VertexShaderPtr& result) = 0;
+    virtual bool createShader(const void *bytecode, SIZE_T bytecodeLength, ID3D11PixelShaderPtr& result) = 0;
+    virtual bool createShader(const void *bytecode, SIZE_T bytecodeLength, ID3D11GeometryShaderPtr& result) = 0;
+    virtual bool createShader(const void *bytecode, SIZE_T bytecodeLength, ID3D11HullShaderPtr& result) = 0;
+    virtual bool createShader(const void *bytecode, SIZE_T bytecodeLength, ID3D11DomainShaderPtr& result) = 0;
+    virtual bool createShader(const void *bytecode, SIZE_T bytecodeLength, ID3D11ComputeShaderPtr& result) = 0;
+
+    // A blob holding a copy of data, for bytecode kept past the buffer it came in
+    virtual bool createBlob(const void *data, SIZE_T length, ID3DBlobPtr& result) = 0;
+
+    // The part of vertex shader bytecode createInputLayout() needs
+    virtual bool getInputSignature(const void *bytecode, SIZE_T bytecodeLength, ID3DBlobPtr& signature) = 0;
+
+    virtual bool createInputLayout(const D3D11_INPUT_ELEMENT_DESC *layout,
+                                   UINT numElements,
+                                   const void *signature,
+                                   SIZE_T signatureLength,
+                                   ID3D11InputLayoutPtr& result) = 0;
+};
+
+} // namespace Rendering
@@ -0,0 +1,246 @@
+/*
+ * Impl
+ */
+
+// Self
+#include "StarVertexBuilder.h"
+
+// Local
+#include "WorkerPool.h"
+
+// std
+#include <algorithm>
+#include <cmath>
+
+#if defined(_M_X64) || defined(__SSE2__) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define STAR_VERTEX_SSE2 1
+#include <emmintrin.h>
+#endif
+
+#define STAR_VERTEX_BATCH 4096			// stars per task when spread over a pool
+
+using namespace Rendering;
+
+const float StarVertexBuilder::sStarPositionTolerance = 1e-6f;
+const float StarVertexBuilder::sStarBrightnessTolerance = 1e-6f;
+
+namespace {
+
+#if STAR_VERTEX_SSE2
+
+// Cephes style single precision sin and cos of 4 angles at once: reduce to within pi/4 of a
+// multiple of pi/2, then a polynomial each. Good to about 1 ulp for angles of a few turns.
+inline void sinCos4(__m128 x, __m128 &sinResult, __m128 &cosResult)
+{
+    const __m128 signMask = _mm_castsi128_ps(_mm_set1_epi32(0x80000000));
+    auto sinSign = _mm_and_ps(x, signMask);
+    x = _mm_andnot_ps(signMask, x);
+
+    // Octant, rounded up to even
+    auto octant = _mm_cvttps_epi32(_mm_mul_ps(x, _mm_set1_ps(1.27323954473516f)));
+    octant = _mm_and_si128(_mm_add_epi32(octant, _mm_set1_epi32(1)), _mm_set1_epi32(~1));
+    auto y = _mm_cvtepi32_ps(octant);
+
+    // Which polynomial goes where and the signs, from the octant
+    sinSign = _mm_xor_ps(sinSign,
+        _mm_castsi128_ps(_mm_slli_epi32(_mm_and_si128(octant, _mm_set1_epi32(4)), 29)));
+    auto cosSign = _mm_castsi128_ps(_mm_slli_epi32(
+        _mm_andnot_si128(_mm_sub_epi32(octant, _mm_set1_epi32(2)), _mm_set1_epi32(4)), 29));
+    auto swap = _mm_castsi128_ps(_mm_cmpeq_epi32(_mm_and_si128(octant, _mm_set1_epi32(2)),
+                                                 _mm_setzero_si128()));
+
+    // x - y * pi/4 in three parts, so the reduction loses no precision
+    x = _mm_sub_ps(x, _mm_mul_ps(y, _mm_set1_ps(0.78515625f)));
+    x = _mm_sub_ps(x, _mm_mul_ps(y, _mm_set1_ps(2.4187564849853515625e-4f)));
+    x = _mm_sub_ps(x, _mm_mul_ps(y, _mm_set1_ps(3.77489497744594108e-8f)));
+    auto z = _mm_mul_ps(x, x);
+
+    auto cosPoly = _mm_set1_ps(2.443315711809948e-5f);
+    cosPoly = _mm_add_ps(_mm_mul_ps(cosPoly, z), _mm_set1_ps(-1.388731625493765e-3f));
+    cosPoly = _mm_add_ps(_mm_mul_ps(cosPoly, z), _mm_set1_ps(4.166664568298827e-2f));
+    cosPoly = _mm_mul_ps(_mm_mul_ps(cosPoly, z), z);
+    cosPoly = _mm_sub_ps(cosPoly, _mm_mul_ps(z, _mm_set1_ps(0.5f)));
+    cosPoly = _mm_add_ps(cosPoly, _mm_set1_ps(1.0f));
+
+    auto sinPoly = _mm_set1_ps(-1.9515295891e-4f);
+    sinPoly = _mm_add_ps(_mm_mul_ps(sinPoly, z), _mm_set1_ps(8.3321608736e-3f));
+    sinPoly = _mm_add_ps(_mm_mul_ps(sinPoly, z), _mm_set1_ps(-1.6666654611e-1f));
+    sinPoly = _mm_add_ps(_mm_mul_ps(_mm_mul_ps(sinPoly, z), x), x);
+
+    auto sinValue = _mm_or_ps(_mm_and_ps(swap, sinPoly), _mm_andnot_ps(swap, cosPoly));
+    auto cosValue = _mm_or_ps(_mm_and_ps(swap, cosPoly), _mm_andnot_ps(swap, sinPoly));
+    sinResult = _mm_xor_ps(sinValue, sinSign);
+    cosResult = _mm_xor_ps(cosValue, cosSign);
+}
+
+// Cephes style single precision exp of 4 values: 2^n * e^r with |r| <= ln(2)/2
+inline __m128 exp4(__m128 x)
+{
+    x = _mm_min_ps(x, _mm_set1_ps(88.3762626647949f));
+    x = _mm_max_ps(x, _mm_set1_ps(-88.3762626647949f));
+
+    // n = floor(x / ln(2) + 0.5)
+    auto fx = _mm_add_ps(_mm_mul_ps(x, _mm_set1_ps(1.44269504088896341f)), _mm_set1_ps(0.5f));
+    auto truncated = _mm_cvtepi32_ps(_mm_cvttps_epi32(fx));
+    fx = _mm_sub_ps(truncated, _mm_and_ps(_mm_cmpgt_ps(truncated, fx), _mm_set1_ps(1.0f)));
+
+    x = _mm_sub_ps(x, _mm_mul_ps(fx, _mm_set1_ps(0.693359375f)));
+    x = _mm_sub_ps(x, _mm_mul_ps(fx, _mm_set1_ps(-2.12194440e-4f)));
+    auto z = _mm_mul_ps(x, x);
+
+    auto y = _mm_set1_ps(1.9875691500e-4f);
+    y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(1.3981999507e-3f));
+    y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(8.3334519073e-3f));
+    y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(4.1665795894e-2f));
+    y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(1.6666665459e-1f));
+    y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(5.0000001201e-1f));
+    y = _mm_add_ps(_mm_add_ps(_mm_mul_ps(y, z), x), _mm_set1_ps(1.0f));
+
+    // 2^n built straight in the exponent bits
+    auto pow2n = _mm_slli_epi32(_mm_add_epi32(_mm_cvttps_epi32(fx), _mm_set1_epi32(0x7f)), 23);
+    return _mm_mul_ps(y, _mm_castsi128_ps(pow2n));
+}
+
+#endif // STAR_VERTEX_SSE2
+
+} // namespace
+
+StarVertexBuilder::StarVertexBuilder(
+    double radius,
+    double magLo,
+    double magHi,
+    double brtMin,
+    bool mapLog)
+    : m_radius(radius)
+    , m_magLo(magLo)
+    , m_magHi(magHi)
+    , m_brtMin(brtMin)
+    , m_bMapLog(mapLog)
+    , m_a(0.0)
+    , m_b(0.0)
+{
+    if (isConsistent()) {
+        if (mapLog) {
+            m_a = -log(brtMin) / (magLo - magHi);
+        }
+        else {
+            m_a = (1.0 - brtMin) / (magHi - magLo);
+            m_b = brtMin - magLo * m_a;
+        }
+    }
+}
+
+double
+StarVertexBuilder::brightness(float mag) const
+{
+    // As CelSphere had it, clamped to brtMin first then to 1
+    auto value = m_bMapLog ? exp(-(mag - m_magHi) * m_a) : m_a * mag + m_b;
+    value = value > m_brtMin ? value : m_brtMin;
+    return value < 1.0 ? value : 1.0;
+}
+
+void
+StarVertexBuilder::buildReference(const StarRec *stars, UINT count, STARVERTEX *vertices) const
+{
+    for (UINT index = 0; index < count; ++index) {
+        const StarRec &rec = stars[index];
+        STARVERTEX &v = vertices[index];
+
+        double xz = m_radius * cos(rec.lat);
+        v.pos.x = (float)(xz * cos(rec.lng));
+        v.pos.y = (float)(xz * sin(rec.lng));
+        v.pos.z = (float)(m_radius * sin(rec.lat));
+        v.col = (float)brightness(rec.mag);
+    }
+}
+
+void
+StarVertexBuilder::buildBatch(const StarRec *stars, UINT count, STARVERTEX *vertices) const
+{
+#if STAR_VERTEX_SSE2
+    const auto radius = _mm_set1_ps((float)m_radius);
+    const auto a = _mm_set1_ps((float)m_a);
+    const auto b = _mm_set1_ps((float)m_b);
+    const auto magHi = _mm_set1_ps((float)m_magHi);
+    const auto brtMin = _mm_set1_ps((float)m_brtMin);
+    const auto one = _mm_set1_ps(1.0f);
+
+    for (UINT index = 0; index < count; index += 4) {
+        const StarRec *rec = stars + index;
+        auto lng = _mm_setr_ps(rec[0].lng, rec[1].lng, rec[2].lng, rec[3].lng);
+        auto lat = _mm_setr_ps(rec[0].lat, rec[1].lat, rec[2].lat, rec[3].lat);
+        auto mag = _mm_setr_ps(rec[0].mag, rec[1].mag, rec[2].mag, rec[3].mag);
+
+        __m128 sinLng, cosLng, sinLat, cosLat;
+        sinCos4(lng, sinLng, cosLng);
+        sinCos4(lat, sinLat, cosLat);
+        auto xz = _mm_mul_ps(radius, cosLat);
+        auto x = _mm_mul_ps(xz, cosLng);
+        auto y = _mm_mul_ps(xz, sinLng);
+        auto z = _mm_mul_ps(radius, sinLat);
+
+        auto col = m_bMapLog ? exp4(_mm_mul_ps(_mm_sub_ps(magHi, mag), a))
+                             : _mm_add_ps(_mm_mul_ps(a, mag), b);
+        col = _mm_min_ps(one, _mm_max_ps(brtMin, col));
+
+        // Four vertices of x, y, z, col each
+        _MM_TRANSPOSE4_PS(x, y, z, col);
+        auto out = (float*)(vertices + index);
+        _mm_storeu_ps(out, x);
+        _mm_storeu_ps(out + 4, y);
+        _mm_storeu_ps(out + 8, z);
+        _mm_storeu_ps(out + 12, col);
+    }
+#else
+    buildReference(stars, count, vertices);
+#endif
+}
+
+void
+StarVertexBuilder::build(
+    const StarRec *stars,
+    UINT count,
+    STARVERTEX *vertices,
+    ClientUtils::WorkerPool *pool) const
+{
+    auto buildRange = [this](const StarRec *stars, UINT count, STARVERTEX *vertices) {
+        // Whole groups of 4, then the rest through a padded group so every star goes the
+        // same way
+        UINT whole = count & ~3u;
+        buildBatch(stars, whole, vertices);
+        if (whole < count) {
+            StarRec tailStars[4];
+            STARVERTEX tailVertices[4];
+            for (UINT index = 0; index < 4; ++index) {
+                tailStars[index] = stars[whole + index < count ? whole + index : count - 1];
+            }
+            buildBatch(tailStars, 4, tailVertices);
+            std::copy(tailVertices, tailVertices + (count - whole), vertices + whole);
+        }
+    };
+
+    // Small catalogues are not worth waking the threads for
+    if (!pool || count < 2 * STAR_VERTEX_BATCH) {
+        buildRange(stars, count, vertices);
+        return;
+    }
+    for (UINT first = 0; first < count; first += STAR_VERTEX_BATCH) {
+        UINT batch = count - first < STAR_VERTEX_BATCH ? count - first : STAR_VERTEX_BATCH;
+        pool->submit([=]() { buildRange(stars + first, batch, vertices + first); });
+    }
+    pool->waitIdle();
+}
+
+void
+StarVertexBuilder::fillLevelTable(const StarRec *stars, UINT count, int levels[256]) const
+{
+    // The brightness falls with the magnitude, so the stars above a level are a prefix of
+    // the array. The level is taken from the brightness as rounded for the vertex.
+    for (int level = 0; level < 256; ++level) {
+        auto end = std::partition_point(stars, stars + count, [this, level](const StarRec &rec) {
+            int starLevel = (int)((float)brightness(rec.mag) * 256.0 * 0.5);
+            return (starLevel > 255 ? 255 : starLevel) > level;
+        });
+        levels[level] = (int)(end - stars);
+    }
+}
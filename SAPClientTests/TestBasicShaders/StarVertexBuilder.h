@@ -0,0 +1,82 @@
+/*
+ * The StarVertexBuilder class turns Star.bin records (longitude, latitude, magnitude) into the
+ * star vertices CelSphere draws: a position on the celestial sphere and a brightness mapped
+ * from the magnitude as set by StarRenderPrm, linear or logarithmic between mag_hi and mag_lo.
+ *
+ * build() is the fast path used at load time. Where SSE2 is available (every x64 compiler,
+ * x86 ones targeting SSE2) it converts 4 stars at a time in single precision with polynomial
+ * sin, cos and exp, otherwise it is buildReference(). Big catalogues are split in batches over
+ * a WorkerPool if one is passed. buildReference() is the double precision code CelSphere used
+ * per star before; the SSE2 results are within sStarPositionTolerance (relative to the sphere
+ * radius) and sStarBrightnessTolerance of it.
+ *
+ * The brightness level table CelSphere cuts stars off against the sky background with does
+ * not depend on the vertices, fillLevelTable() finds it from the magnitudes by binary search
+ * using the double precision mapping, so it comes out the same whichever path built them.
+ * Like ShaderManager this has no dependence on Orbiter headers.
+ */
+
+#pragma once
+
+// Local
+#include "Platform.h" // for the Win32 types
+
+namespace ClientUtils {
+class WorkerPool;
+}
+
+namespace Rendering {
+
+// A Star.bin record, angles in radians. The file is sorted by increasing magnitude.
+struct StarRec {
+	float lng, lat, mag;
+};
+
+struct STARVERTEX {
+	struct {
+		float x, y, z;		// laid out as a D3DXVECTOR3
+	} pos;
+	float col;			//16
+};
+
+class StarVertexBuilder
+{
+public:
+    static const float sStarPositionTolerance;
+    static const float sStarBrightnessTolerance;
+
+    // The magnitude limits and brightness mapping from StarRenderPrm. Stars at magHi or
+    // brighter get 1, the brightness falls to brtMin at magLo.
+    StarVertexBuilder(double radius, double magLo, double magHi, double brtMin, bool mapLog);
+
+    // magLo must be fainter (greater) than magHi, else all stars get the same brightness
+    bool isConsistent() const { return m_magLo > m_magHi; }
+
+    // Converts count stars into count vertices. With a pool the work is spread over its
+    // threads in batches and the call waits for them, the pool must not be busy otherwise.
+    void build(const StarRec *stars, UINT count, STARVERTEX *vertices,
+               ClientUtils::WorkerPool *pool = nullptr) const;
+
+    // The per star double precision conversion, for checking build() against
+    void buildReference(const StarRec *stars, UINT count, STARVERTEX *vertices) const;
+
+    // The brightness of one star, double precision
+    double brightness(float mag) const;
+
+    // Level k (0 - 255) gets the number of stars from the front of the array that are
+    // brighter than level k, the level of a star being its brightness * 128.
+    // The stars must be sorted by magnitude as Star.bin is.
+    void fillLevelTable(const StarRec *stars, UINT count, int levels[256]) const;
+
+private:
+    // Stars count must be a multiple of 4 in the SSE2 kernel
+    void buildBatch(const StarRec *stars, UINT count, STARVERTEX *vertices) const;
+
+    double m_radius;
+    double m_magLo, m_magHi, m_brtMin;
+    bool m_bMapLog;
+    // brightness = exp(-(mag - magHi) * a) or a * mag + b
+    double m_a, m_b;
+};
+
+} // namespace Rendering
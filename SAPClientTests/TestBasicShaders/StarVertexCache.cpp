@@ -0,0 +1,123 @@
+/*
+ * Impl
+ */
+
+// Self
+#include "StarVertexCache.h"
+
+// std
+#include <cstdio>
+
+#define STAR_CACHE_FILE_NAME _T("Stars.cache")
+#define STAR_CACHE_FILE_MAGIC 0x43525453		// "STRC"
+#define STAR_CACHE_FORMAT_VERSION 1
+#define STAR_CACHE_TEMP_SUFFIX _T(".tmp")
+
+using namespace Rendering;
+
+StarVertexCache::StarVertexCache(const std::string &directory)
+    : m_fileName(directory)
+    , m_pHeader(nullptr)
+{
+    if (!m_fileName.empty() && m_fileName[m_fileName.length() - 1] != PATH_SEPARATOR) {
+        m_fileName += PATH_SEPARATOR;
+    }
+    m_fileName += STAR_CACHE_FILE_NAME;
+}
+
+ClientUtils::Hash128
+StarVertexCache::makeKey(
+    const StarRec *stars,
+    UINT count,
+    double radius,
+    double magLo,
+    double magHi,
+    double brtMin,
+    bool mapLog)
+{
+    // The format version too, so vertices made by older code are not picked up
+    ClientUtils::Hasher hasher;
+    hasher.updateValue((UINT)STAR_CACHE_FORMAT_VERSION);
+    hasher.updateValue(count);
+    hasher.update(stars, count * sizeof(StarRec));
+    hasher.updateValue(radius);
+    hasher.updateValue(magLo);
+    hasher.updateValue(magHi);
+    hasher.updateValue(brtMin);
+    hasher.updateValue((UINT)mapLog);
+    return hasher.finish();
+}
+
+bool
+StarVertexCache::open(const ClientUtils::Hash128 &key)
+{
+    close();
+    if (!m_file.open(m_fileName.c_str())) {
+        return false;
+    }
+
+    auto header = (const StarCacheHeader*)m_file.data();
+    auto ok = m_file.size() >= sizeof(StarCacheHeader) &&
+              header->magic == STAR_CACHE_FILE_MAGIC &&
+              header->version == STAR_CACHE_FORMAT_VERSION &&
+              header->key == key &&
+              m_file.size() == sizeof(StarCacheHeader) + (UINT64)header->vertexCount * sizeof(STARVERTEX);
+    if (!ok) {
+        m_file.close();
+        return false;
+    }
+    m_pHeader = header;
+    return true;
+}
+
+void
+StarVertexCache::close()
+{
+    m_pHeader = nullptr;
+    m_file.close();
+}
+
+bool
+StarVertexCache::store(
+    const ClientUtils::Hash128 &key,
+    const STARVERTEX *vertices,
+    UINT count,
+    const int levels[256])
+{
+    // The old file cannot be replaced while it is mapped here
+    close();
+
+    StarCacheHeader header;
+    ZeroMemory(&header, sizeof(header));
+    header.magic = STAR_CACHE_FILE_MAGIC;
+    header.version = STAR_CACHE_FORMAT_VERSION;
+    header.key = key;
+    header.vertexCount = count;
+    CopyMemory(header.levels, levels, sizeof(header.levels));
+
+    // A name of its own per process, two launches may store at once
+    char suffix[32];
+    sprintf(suffix, ".%u", (UINT)::GetCurrentProcessId());
+    std::string tempFileName = m_fileName + suffix + STAR_CACHE_TEMP_SUFFIX;
+
+    HANDLE hFile = ::CreateFile(tempFileName.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS,
+                                FILE_ATTRIBUTE_NORMAL, 0);
+    if (hFile == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+    DWORD headerWritten = 0, verticesWritten = 0;
+    DWORD verticesSize = count * sizeof(STARVERTEX);
+    auto ok = ::WriteFile(hFile, &header, sizeof(header), &headerWritten, nullptr) &&
+              headerWritten == sizeof(header) &&
+              (!count || ::WriteFile(hFile, vertices, verticesSize, &verticesWritten, nullptr)) &&
+              verticesWritten == verticesSize;
+    ::CloseHandle(hFile);
+
+    // On Windows the move fails while another process has the old file mapped, it is
+    // replaced at a later launch then
+    if (!ok || !::MoveFileEx(tempFileName.c_str(), m_fileName.c_str(), MOVEFILE_REPLACE_EXISTING)) {
+        ::DeleteFile(tempFileName.c_str());
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,73 @@
+/*
+ * The StarVertexCache keeps the star vertices CelSphere built at an earlier launch, and the
+ * brightness level table that goes with them, in one file in the client's disk cache
+ * directory. The file is keyed by a hash of the visible stars of the catalogue and of the
+ * StarRenderPrm settings StarVertexBuilder maps them with. A change to either misses and
+ * the file is written anew. A hit maps the file, and the vertices can be uploaded straight
+ * from the mapping.
+ *
+ * The file is
+ *     StarCacheHeader            - magic, format version, key, vertex count, level table
+ *     STARVERTEX[vertex count]
+ * It is written under a temporary name and then moved over the old one, so another process
+ * starting at the same time sees the old file, the new one or none - never half of one.
+ * Like ShaderManager this has no dependence on Orbiter headers.
+ */
+
+#pragma once
+
+// Local
+#include "Platform.h" // for the Win32 types
+#include "Hasher.h"
+#include "MappedFile.h"
+#include "StarVertexBuilder.h"
+
+// std
+#include <string>
+
+namespace Rendering {
+
+class StarVertexCache
+{
+public:
+    // The cache file goes in directory, which must exist
+    StarVertexCache(const std::string &directory);
+
+    // The key for count stars from the front of the catalogue converted with the given
+    // StarVertexBuilder settings
+    static ClientUtils::Hash128 makeKey(const StarRec *stars, UINT count, double radius,
+                                        double magLo, double magHi, double brtMin, bool mapLog);
+
+    // Maps the cache file if it was made for key. False if there is none, it is for another
+    // key or it is damaged.
+    bool open(const ClientUtils::Hash128 &key);
+    void close();
+
+    // Valid while open
+    UINT vertexCount() const { return m_pHeader->vertexCount; }
+    const STARVERTEX *vertices() const { return (const STARVERTEX*)(m_pHeader + 1); }
+    const int *levels() const { return m_pHeader->levels; }
+
+    // Replaces the cache file with one for key, closing this one first
+    bool store(const ClientUtils::Hash128 &key, const STARVERTEX *vertices, UINT count,
+               const int levels[256]);
+
+    const std::string &getFileName() const { return m_fileName; }
+
+private:
+    struct StarCacheHeader
+    {
+        UINT magic;
+        UINT version;
+        ClientUtils::Hash128 key;
+        UINT vertexCount;
+        UINT reserved;			// 0, keeps the vertices 16 byte aligned
+        int levels[256];		// as StarVertexBuilder::fillLevelTable() makes it
+    };
+
+    std::string m_fileName;
+    ClientUtils::MappedFile m_file;
+    const StarCacheHeader *m_pHeader;
+};
+
+} // namespace Rendering
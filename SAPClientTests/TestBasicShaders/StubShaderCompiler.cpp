@@ -0,0 +1,177 @@
+/*
+ * Impl
+ */
+
+// Self
+#include "StubShaderCompiler.h"
+
+// std
+#include <fstream>
+#include <iterator>
+#include <algorithm>
+#include <thread>
+#include <chrono>
+
+using namespace Rendering;
+
+namespace {
+
+// Laid out at the start of the stub bytecode
+struct StubBytecodeHeader
+{
+    UINT magic;
+    UINT length;            // of the whole bytecode
+    ClientUtils::Hash128 inputHash;
+};
+
+} // namespace
+
+const UINT StubShaderCompiler::sBytecodeMagic;
+
+bool
+StubShaderCompiler::readFile(const std::string& fileName, std::string& contents)
+{
+    std::ifstream file(ClientUtils::nativePath(fileName), std::ios::binary);
+    if (!file) {
+        return false;
+    }
+    contents.assign((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    return true;
+}
+
+std::string
+StubShaderCompiler::directoryOf(const std::string& fileName)
+{
+    auto index = fileName.find_last_of("\\/");
+    return index == std::string::npos ? std::string() : fileName.substr(0, index + 1);
+}
+
+bool
+StubShaderCompiler::followIncludes(
+    const std::string& contents,
+    const std::string& fileDirectory,
+    const std::string& sourceDirectory,
+    ClientUtils::Hasher& hasher,
+    SIZE_T& totalLength,
+    std::vector<ShaderDependency>& dependencies)
+{
+    SIZE_T lineStart = 0;
+    while (lineStart < contents.length()) {
+        auto lineEnd = contents.find('\n', lineStart);
+        if (lineEnd == std::string::npos) {
+            lineEnd = contents.length();
+        }
+        auto pos = contents.find_first_not_of(" \t", lineStart);
+        lineStart = lineEnd + 1;
+
+        // # include "file" or # include <file>
+        if (pos >= lineEnd || contents[pos] != '#') {
+            continue;
+        }
+        pos = contents.find_first_not_of(" \t", pos + 1);
+        if (pos >= lineEnd || contents.compare(pos, 7, "include") != 0) {
+            continue;
+        }
+        pos = contents.find_first_not_of(" \t", pos + 7);
+        if (pos >= lineEnd || (contents[pos] != '"' && contents[pos] != '<')) {
+            continue;
+        }
+        auto isLocal = contents[pos] == '"';
+        auto nameEnd = contents.find(isLocal ? '"' : '>', pos + 1);
+        if (nameEnd >= lineEnd) {
+            continue;
+        }
+
+        // Resolved like ShaderIncludeRecorder does, local includes relative to the includer
+        auto fileName = (isLocal ? fileDirectory : sourceDirectory) +
+                        contents.substr(pos + 1, nameEnd - pos - 1);
+        auto seen = false;
+        for (const auto& dependency : dependencies) {
+            if (dependency.fileName == fileName) {
+                seen = true;
+                break;
+            }
+        }
+        if (seen) {
+            continue;
+        }
+
+        std::string included;
+        if (!readFile(fileName, included)) {
+            return false;
+        }
+        ClientUtils::Hasher contentHasher;
+        contentHasher.update(included.data(), included.length());
+        ShaderDependency dependency;
+        dependency.fileName = fileName;
+        dependency.contentHash = contentHasher.finish();
+        dependencies.push_back(dependency);
+
+        hasher.updateValue(dependency.contentHash);
+        totalLength += included.length();
+        if (!followIncludes(included, directoryOf(fileName), sourceDirectory, hasher, totalLength,
+                            dependencies)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool
+StubShaderCompiler::compile(
+    const std::string& shaderFileName,
+    const std::string& entryPoint,
+    const std::string& shaderProfile,
+    const ShaderDefines& defines,
+    UINT flags,
+    std::vector<BYTE>& bytecode,
+    std::vector<ShaderDependency>& dependencies)
+{
+    if (m_latencyMicroseconds) {
+        std::this_thread::sleep_for(std::chrono::microseconds(m_latencyMicroseconds));
+    }
+
+    std::string source;
+    if (!readFile(shaderFileName, source) || source.find(entryPoint) == std::string::npos) {
+        return false;
+    }
+
+    // The order defines are passed in makes no difference to a real compile either
+    ShaderDefines sortedDefines = defines;
+    std::sort(sortedDefines.begin(), sortedDefines.end());
+
+    ClientUtils::Hasher hasher;
+    hasher.update(source.data(), source.length());
+    hasher.update(entryPoint);
+    hasher.update(shaderProfile);
+    for (const auto& define : sortedDefines) {
+        hasher.update(define.first);
+        hasher.update(define.second);
+    }
+    hasher.updateValue(flags);
+
+    dependencies.clear();
+    SIZE_T totalLength = source.length();
+    auto sourceDirectory = directoryOf(shaderFileName);
+    if (!followIncludes(source, sourceDirectory, sourceDirectory, hasher, totalLength,
+                        dependencies)) {
+        return false;
+    }
+
+    StubBytecodeHeader header;
+    header.magic = sBytecodeMagic;
+    header.length = (UINT)(sizeof(header) + totalLength);
+    header.inputHash = hasher.finish();
+    bytecode.resize(header.length);
+    CopyMemory(bytecode.data(), &header, sizeof(header));
+
+    // Filler from the hash, xorshift64
+    UINT64 state = header.inputHash.low | 1;
+    for (SIZE_T i = sizeof(header); i < bytecode.size(); ++i) {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        bytecode[i] = (BYTE)state;
+    }
+    return true;
+}
@@ -0,0 +1,55 @@
+/*
+ * The StubShaderCompiler class stands in for the HLSL compiler where there is none (the pack
+ * builder on Linux, cache tests). It does read the source and follow #include "file" and
+ * #include <file> lines the way the real include handler resolves them, so dependencies come
+ * out as they would from D3DShaderCompiler. The "bytecode" is a small header with a hash of
+ * everything that went in, padded with filler to about the size of the sources, so the same
+ * inputs always give the same bytes. Fails if the source is missing or never mentions the
+ * entry point. The result cannot be handed to a D3D device, StubShaderObjectFactory takes it.
+ * A compile can be made to take a fixed time on top, to stand in for the real compiler when
+ * profiling the caches.
+ */
+
+#pragma once
+
+// Local
+#include "ShaderCompiler.h"
+
+namespace Rendering {
+
+class StubShaderCompiler : public IShaderCompiler
+{
+public:
+    // Starts every stub bytecode, "STUB"
+    static const UINT sBytecodeMagic = 0x42555453;
+
+    // latencyMicroseconds is slept in every compile
+    explicit StubShaderCompiler(UINT latencyMicroseconds = 0)
+        : m_latencyMicroseconds(latencyMicroseconds)
+    {}
+
+    virtual bool compile(const std::string& shaderFileName,
+                         const std::string& entryPoint,
+                         const std::string& shaderProfile,
+                         const ShaderDefines& defines,
+                         UINT flags,
+                         std::vector<BYTE>& bytecode,
+                         std::vector<ShaderDependency>& dependencies);
+
+private:
+    static bool readFile(const std::string& fileName, std::string& contents);
+    static std::string directoryOf(const std::string& fileName);
+
+    // Reads the files contents includes, adds them to hasher and totalLength, then does the
+    // same for what they include. Each file is added to dependencies and followed once.
+    static bool followIncludes(const std::string& contents,
+                               const std::string& fileDirectory,
+                               const std::string& sourceDirectory,
+                               ClientUtils::Hasher& hasher,
+                               SIZE_T& totalLength,
+                               std::vector<ShaderDependency>& dependencies);
+
+    UINT m_latencyMicroseconds;
+};
+
+} // namespace Rendering
@@ -0,0 +1,159 @@
+/*
+ * Impl
+ */
+
+// Self
+#include "StubShaderObjectFactory.h"
+
+// std
+#include <thread>
+#include <chrono>
+#include <vector>
+
+using namespace Rendering;
+
+namespace {
+
+// What createBlob() makes, D3DCreateBlob() is not there without the DirectX SDK
+class StubBlob : public ID3DBlob
+{
+public:
+    StubBlob(const void *data, SIZE_T length)
+        : m_refCount(1)
+        , m_data((const BYTE*)data, (const BYTE*)data + length)
+    {}
+    virtual ~StubBlob() {}
+
+    // IUnknown
+    virtual HRESULT STDMETHODCALLTYPE QueryInterface(REFIID riid, void **ppvObject)
+    {
+        if (riid == __uuidof(ID3DBlob) || riid == __uuidof(IUnknown)) {
+            AddRef();
+            *ppvObject = static_cast<ID3DBlob*>(this);
+            return S_OK;
+        }
+        *ppvObject = nullptr;
+        return E_NOINTERFACE;
+    }
+    virtual ULONG STDMETHODCALLTYPE AddRef() { return ++m_refCount; }
+    virtual ULONG STDMETHODCALLTYPE Release()
+    {
+        ULONG count = --m_refCount;
+        if (!count) {
+            delete this;
+        }
+        return count;
+    }
+
+    // ID3DBlob
+    virtual LPVOID STDMETHODCALLTYPE GetBufferPointer() { return m_data.data(); }
+    virtual SIZE_T STDMETHODCALLTYPE GetBufferSize() { return m_data.size(); }
+
+private:
+    std::atomic<ULONG> m_refCount;
+    std::vector<BYTE> m_data;
+};
+
+} // namespace
+
+void
+StubShaderObjectFactory::simulateLatency()
+{
+    if (m_latencyMicroseconds) {
+        std::this_thread::sleep_for(std::chrono::microseconds(m_latencyMicroseconds));
+    }
+}
+
+template<typename T>
+bool
+StubShaderObjectFactory::createObject(const void *bytecode, SIZE_T bytecodeLength, T& result)
+{
+    simulateLatency();
+    if (!bytecode || !bytecodeLength) {
+        return false;
+    }
+    ClientUtils::Hasher hasher;
+    hasher.update(bytecode, bytecodeLength);
+    // The smart pointer takes over the reference the object starts with
+    result.Attach(new StubDeviceChild<typename T::Interface>(hasher.finish()));
+    m_createCount++;
+    return true;
+}
+
+bool
+StubShaderObjectFactory::createShader(const void *bytecode, SIZE_T bytecodeLength, ID3D11VertexShaderPtr& result)
+{
+    return createObject(bytecode, bytecodeLength, result);
+}
+
+bool
+StubShaderObjectFactory::createShader(const void *bytecode, SIZE_T bytecodeLength, ID3D11PixelShaderPtr& result)
+{
+    return createObject(bytecode, bytecodeLength, result);
+}
+
+bool
+StubShaderObjectFactory::createShader(const void *bytecode, SIZE_T bytecodeLength, ID3D11GeometryShaderPtr& result)
+{
+    return createObject(bytecode, bytecodeLength, result);
+}
+
+bool
+StubShaderObjectFactory::createShader(const void *bytecode, SIZE_T bytecodeLength, ID3D11HullShaderPtr& result)
+{
+    return createObject(bytecode, bytecodeLength, result);
+}
+
+bool
+StubShaderObjectFactory::createShader(const void *bytecode, SIZE_T bytecodeLength, ID3D11DomainShaderPtr& result)
+{
+    return createObject(bytecode, bytecodeLength, result);
+}
+
+bool
+StubShaderObjectFactory::createShader(const void *bytecode, SIZE_T bytecodeLength, ID3D11ComputeShaderPtr& result)
+{
+    return createObject(bytecode, bytecodeLength, result);
+}
+
+bool
+StubShaderObjectFactory::createBlob(const void *data, SIZE_T length, ID3DBlobPtr& result)
+{
+    result.Attach(new StubBlob(data, length));
+    return true;
+}
+
+bool
+StubShaderObjectFactory::getInputSignature(const void *bytecode, SIZE_T bytecodeLength, ID3DBlobPtr& signature)
+{
+    ClientUtils::Hasher hasher;
+    hasher.update(bytecode, bytecodeLength);
+    auto hash = hasher.finish();
+    return createBlob(&hash, sizeof(hash), signature);
+}
+
+bool
+StubShaderObjectFactory::createInputLayout(
+    const D3D11_INPUT_ELEMENT_DESC *layout,
+    UINT numElements,
+    const void *signature,
+    SIZE_T signatureLength,
+    ID3D11InputLayoutPtr& result)
+{
+    simulateLatency();
+    ClientUtils::Hasher hasher;
+    for (UINT element = 0; element < numElements; ++element) {
+        const auto& desc = layout[element];
+        hasher.update(desc.SemanticName);
+        hasher.updateValue(desc.SemanticIndex);
+        hasher.updateValue(desc.Format);
+        hasher.updateValue(desc.InputSlot);
+        hasher.updateValue(desc.AlignedByteOffset);
+        hasher.updateValue(desc.InputSlotClass);
+        hasher.updateValue(desc.InstanceDataStepRate);
+    }
+    hasher.update(signature, signatureLength);
+    result.Attach(new StubDeviceChild<ID3D11InputLayout>(hasher.finish()));
+    m_createCount++;
+    return true;
+}
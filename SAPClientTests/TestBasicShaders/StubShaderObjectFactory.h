@@ -0,0 +1,127 @@
+/*
+ * The StubShaderObjectFactory class stands in for the D3D device when the ShaderManager runs
+ * without one (profiling and load testing the caches, see ShaderObjectFactory.h). The objects
+ * it makes implement the D3D interfaces only as far as IUnknown and ID3D11DeviceChild go and
+ * hold a hash of the bytecode they were made from, so they cannot be bound to a real device
+ * context. The input signature of a vertex shader is that hash, an input layout holds the hash
+ * of its element descriptions and signature. Blobs are plain copies in memory, this builds
+ * without the DirectX SDK.
+ * Each call can be made to take a fixed time, to stand in for the driver's own work.
+ */
+
+#pragma once
+
+// Local
+#include "ShaderObjectFactory.h"
+#include "Hasher.h"
+
+// std
+#include <atomic>
+
+namespace Rendering {
+
+class StubShaderObjectFactory : public IShaderObjectFactory
+{
+public:
+    // latencyMicroseconds is slept in every create call
+    explicit StubShaderObjectFactory(UINT latencyMicroseconds = 0)
+        : m_latencyMicroseconds(latencyMicroseconds)
+        , m_createCount(0)
+    {}
+
+    virtual bool createShader(const void *bytecode, SIZE_T bytecodeLength, ID3D11VertexShaderPtr& result);
+    virtual bool createShader(const void *bytecode, SIZE_T bytecodeLength, ID3D11PixelShaderPtr& result);
+    virtual bool createShader(const void *bytecode, SIZE_T bytecodeLength, ID3D11GeometryShaderPtr& result);
+    virtual bool createShader(const void *bytecode, SIZE_T bytecodeLength, ID3D11HullShaderPtr& result);
+    virtual bool createShader(const void *bytecode, SIZE_T bytecodeLength, ID3D11DomainShaderPtr& result);
+    virtual bool createShader(const void *bytecode, SIZE_T bytecodeLength, ID3D11ComputeShaderPtr& result);
+
+    virtual bool createBlob(const void *data, SIZE_T length, ID3DBlobPtr& result);
+
+    virtual bool getInputSignature(const void *bytecode, SIZE_T bytecodeLength, ID3DBlobPtr& signature);
+
+    virtual bool createInputLayout(const D3D11_INPUT_ELEMENT_DESC *layout,
+                                   UINT numElements,
+                                   const void *signature,
+                                   SIZE_T signatureLength,
+                                   ID3D11InputLayoutPtr& result);
+
+    // Shader objects and input layouts made so far
+    UINT getCreateCount() const { return m_createCount; }
+
+    // The hash a stub object was made with, for checking what came out of a cache
+    template<typename T>
+    static bool getObjectHash(const T& object, ClientUtils::Hash128& hash);
+
+private:
+    template<typename T>
+    bool createObject(const void *bytecode, SIZE_T bytecodeLength, T& result);
+
+    void simulateLatency();
+
+    UINT m_latencyMicroseconds;
+    std::atomic<UINT> m_createCount;
+};
+
+/*
+ * What the stub factory makes. I is the D3D interface, every one it makes derives straight
+ * from ID3D11DeviceChild with nothing of its own to implement.
+ */
+template<typename I>
+class StubDeviceChild : public I
+{
+public:
+    explicit StubDeviceChild(const ClientUtils::Hash128& hash) : m_refCount(1), m_hash(hash) {}
+    virtual ~StubDeviceChild() {}
+
+    const ClientUtils::Hash128& getHash() const { return m_hash; }
+
+    // IUnknown
+    virtual HRESULT STDMETHODCALLTYPE QueryInterface(REFIID riid, void **ppvObject)
+    {
+        if (riid == __uuidof(I) || riid == __uuidof(ID3D11DeviceChild) || riid == __uuidof(IUnknown)) {
+            AddRef();
+            *ppvObject = static_cast<I*>(this);
+            return S_OK;
+        }
+        *ppvObject = nullptr;
+        return E_NOINTERFACE;
+    }
+    virtual ULONG STDMETHODCALLTYPE AddRef() { return ++m_refCount; }
+    virtual ULONG STDMETHODCALLTYPE Release()
+    {
+        ULONG count = --m_refCount;
+        if (!count) {
+            delete this;
+        }
+        return count;
+    }
+
+    // ID3D11DeviceChild, there is no device and no private data
+    virtual void STDMETHODCALLTYPE GetDevice(ID3D11Device **ppDevice) { *ppDevice = nullptr; }
+    virtual HRESULT STDMETHODCALLTYPE GetPrivateData(REFGUID, UINT *pDataSize, void *)
+    {
+        *pDataSize = 0;
+        return DXGI_ERROR_NOT_FOUND;
+    }
+    virtual HRESULT STDMETHODCALLTYPE SetPrivateData(REFGUID, UINT, const void *) { return E_NOTIMPL; }
+    virtual HRESULT STDMETHODCALLTYPE SetPrivateDataInterface(REFGUID, const IUnknown *) { return E_NOTIMPL; }
+
+private:
+    std::atomic<ULONG> m_refCount;
+    ClientUtils::Hash128 m_hash;
+};
+
+template<typename T>
+bool
+StubShaderObjectFactory::getObjectHash(const T& object, ClientUtils::Hash128& hash)
+{
+    auto stub = dynamic_cast<StubDeviceChild<typename T::Interface>*>(object.GetInterfacePtr());
+    if (!stub) {
+        return false;
+    }
+    hash = stub->getHash();
+    return true;
+}
+
+} // namespace Rendering
@@ -0,0 +1,282 @@
+/*
+ * CacheLookupBench times a shader disk cache lookup in the indexed archive (ShaderDiskCache)
+ * against the linear scan of the per source cache files it replaced, at 10, 100 and 1000
+ * entries. The old scan is reimplemented here as it was: per lookup the file is checked and
+ * opened, then every record is read up to the key (a new char[] each, which the old code
+ * leaked and this one frees) and its bytecode skipped with a seek. The indexed archive is
+ * opened once, as the client does at startup, and each lookup probes its mapped index.
+ * Keys are 128 bit hashes as ShaderCacheKeyBuilder makes them, the bytecode is random.
+ * Hits cycle through the keys in a random order, misses look up keys that are not there -
+ * the worst case of the scan, which reads the whole file.
+ */
+
+// std
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <random>
+#include <algorithm>
+
+// Local
+#include "Platform.h"
+#include "Hasher.h"
+#include "ShaderDiskCache.h"
+
+#define BENCH_DEFAULT_BYTECODE 2048		// bytes per entry
+#define BENCH_DEFAULT_LOOKUPS 1000		// per run
+#define BENCH_RUNS 3					// best of
+#define BENCH_LINEAR_FILE_NAME "Linear.cache"
+#define BENCH_INDEXED_DIRECTORY_NAME "Indexed"
+
+using namespace Rendering;
+
+namespace {
+
+const UINT sEntryCounts[] = { 10, 100, 1000 };
+
+struct Options
+{
+    UINT bytecodeLength;
+    UINT lookups;
+    std::string directory;
+};
+
+void
+printUsage()
+{
+    printf("Usage: CacheLookupBench [options]\n"
+           "Times indexed shader disk cache lookups against the old linear scan.\n"
+           "  --bytecode <n>  bytes of bytecode per entry (%u)\n"
+           "  --lookups <n>   lookups per run (%u)\n"
+           "  --dir <dir>     where the cache files go (the temp directory)\n",
+           BENCH_DEFAULT_BYTECODE, BENCH_DEFAULT_LOOKUPS);
+}
+
+bool
+parseOptions(int argc, char * argv[], Options& options)
+{
+    options.bytecodeLength = BENCH_DEFAULT_BYTECODE;
+    options.lookups = BENCH_DEFAULT_LOOKUPS;
+
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        auto hasValue = i + 1 < argc;
+        if (arg == "--bytecode" && hasValue) {
+            options.bytecodeLength = (UINT)strtoul(argv[++i], nullptr, 0);
+        }
+        else if (arg == "--lookups" && hasValue) {
+            options.lookups = (UINT)strtoul(argv[++i], nullptr, 0);
+        }
+        else if (arg == "--dir" && hasValue) {
+            options.directory = argv[++i];
+        }
+        else {
+            return false;
+        }
+    }
+    if (options.directory.empty()) {
+        TCHAR path[MAX_PATH + 1];
+        ::GetTempPath(MAX_PATH, path);
+        options.directory = std::string(path) + "CacheLookupBench";
+    }
+    if (options.directory[options.directory.length() - 1] != PATH_SEPARATOR) {
+        options.directory += PATH_SEPARATOR;
+    }
+    return options.bytecodeLength > 0 && options.lookups > 0;
+}
+
+std::string
+makeKey(UINT index)
+{
+    ClientUtils::Hasher hasher;
+    hasher.updateValue(index);
+    return hasher.finish().toString();
+}
+
+// The old on disk record: key length, bytecode length, key, bytecode
+void
+writeLinearEntry(HANDLE hFile, const std::string& key, const std::vector<BYTE>& bytecode)
+{
+    UINT lengths[2] = { (UINT)key.length(), (UINT)bytecode.size() };
+    DWORD dwWritten;
+    ::WriteFile(hFile, lengths, sizeof(lengths), &dwWritten, nullptr);
+    ::WriteFile(hFile, key.c_str(), (DWORD)key.length(), &dwWritten, nullptr);
+    ::WriteFile(hFile, bytecode.data(), (DWORD)bytecode.size(), &dwWritten, nullptr);
+}
+
+// The old ShaderDiskCache::readCacheEntry() without the bytecode
+bool
+readLinearKey(HANDLE hFile, UINT& keyLength, UINT& bytecodeLength, char *& key)
+{
+    UINT lengths[2];
+    DWORD dwRead;
+    if (!::ReadFile(hFile, lengths, sizeof(lengths), &dwRead, nullptr) || dwRead != sizeof(lengths)) {
+        return false;
+    }
+    keyLength = lengths[0];
+    bytecodeLength = lengths[1];
+    key = new char[keyLength + 1];
+    key[keyLength] = '\0';
+    ::ReadFile(hFile, key, keyLength, &dwRead, nullptr);
+
+    LARGE_INTEGER skip;
+    skip.QuadPart = bytecodeLength;
+    ::SetFilePointerEx(hFile, skip, nullptr, FILE_CURRENT);
+    return true;
+}
+
+// The old ShaderDiskCache::searchForEntry(), the source timestamp check is two attribute
+// reads here as well
+bool
+searchLinear(const std::string& fileName, const std::string& key, std::vector<BYTE>& bytecode)
+{
+    if (::GetFileAttributes(fileName.c_str()) == INVALID_FILE_ATTRIBUTES ||
+            ::GetFileAttributes(fileName.c_str()) == INVALID_FILE_ATTRIBUTES) {
+        return false;
+    }
+    HANDLE hFile = ::CreateFile(fileName.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ,
+                                nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0);
+    if (hFile == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+    UINT keyLength, bytecodeLength;
+    char * currentKey;
+    auto found = false;
+    while (!found && readLinearKey(hFile, keyLength, bytecodeLength, currentKey)) {
+        if (!strcmp(currentKey, key.c_str())) {
+            // Back to the bytecode and read it
+            LARGE_INTEGER back;
+            back.QuadPart = -(LONGLONG)bytecodeLength;
+            ::SetFilePointerEx(hFile, back, nullptr, FILE_CURRENT);
+            bytecode.resize(bytecodeLength);
+            DWORD dwRead;
+            found = ::ReadFile(hFile, bytecode.data(), bytecodeLength, &dwRead, nullptr) &&
+                    dwRead == bytecodeLength;
+        }
+        delete[] currentKey;
+    }
+    ::CloseHandle(hFile);
+    return found;
+}
+
+bool
+searchIndexed(ShaderDiskCache& cache, const std::string& key)
+{
+    CacheEntry entry;
+    entry.keyLength = (UINT)key.length();
+    entry.key = key.c_str();
+    return cache.searchForEntry(entry) && entry.bytecodeLength > 0;
+}
+
+// Best of BENCH_RUNS, in microseconds per lookup. Fails if a lookup does not come out as
+// expected.
+template<typename F>
+bool
+timeLookups(const std::vector<std::string>& keys, UINT lookups, bool expectFound, F lookup,
+            double& result)
+{
+    result = 1e30;
+    for (int run = 0; run < BENCH_RUNS; ++run) {
+        auto start = std::chrono::steady_clock::now();
+        for (UINT i = 0; i < lookups; ++i) {
+            if (lookup(keys[i % keys.size()]) != expectFound) {
+                return false;
+            }
+        }
+        auto us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+        us /= lookups;
+        result = us < result ? us : result;
+    }
+    return true;
+}
+
+} // namespace
+
+int
+main(int argc, char * argv[])
+{
+    Options options;
+    if (!parseOptions(argc, argv, options)) {
+        printUsage();
+        return 1;
+    }
+
+    std::string indexedDirectory = options.directory + BENCH_INDEXED_DIRECTORY_NAME;
+    ::CreateDirectory(options.directory.c_str(), nullptr);
+    ::CreateDirectory(indexedDirectory.c_str(), nullptr);
+    if (::GetFileAttributes(indexedDirectory.c_str()) == INVALID_FILE_ATTRIBUTES) {
+        fprintf(stderr, "Cannot create %s\n", indexedDirectory.c_str());
+        return 1;
+    }
+    std::string linearFileName = options.directory + BENCH_LINEAR_FILE_NAME;
+    std::string archiveFileName = ShaderDiskCache::getArchiveFileName(indexedDirectory);
+
+    std::mt19937 random(1);
+    printf("%u bytes of bytecode per entry, %u lookups per run, best of %u\n",
+           options.bytecodeLength, options.lookups, BENCH_RUNS);
+    printf("entries   scan hit    index hit   speedup   scan miss   index miss  speedup\n");
+    auto ok = true;
+    for (auto entryCount : sEntryCounts) {
+        std::vector<std::string> keys, missingKeys;
+        for (UINT index = 0; index < entryCount; ++index) {
+            keys.push_back(makeKey(index));
+            missingKeys.push_back(makeKey(index + entryCount));
+        }
+
+        // Both start from scratch with the same entries
+        ::DeleteFile(linearFileName.c_str());
+        ::DeleteFile(archiveFileName.c_str());
+        HANDLE hLinear = ::CreateFile(linearFileName.c_str(), GENERIC_READ | GENERIC_WRITE,
+                                      FILE_SHARE_READ, nullptr, CREATE_ALWAYS,
+                                      FILE_ATTRIBUTE_NORMAL, 0);
+        if (hLinear == INVALID_HANDLE_VALUE) {
+            fprintf(stderr, "Cannot create %s\n", linearFileName.c_str());
+            return 1;
+        }
+        {
+            ShaderDiskCache writer(indexedDirectory, 1024 * 1024 * 1024);
+            std::vector<BYTE> bytecode(options.bytecodeLength);
+            for (const auto& key : keys) {
+                for (auto& b : bytecode) {
+                    b = (BYTE)random();
+                }
+                writeLinearEntry(hLinear, key, bytecode);
+
+                CacheEntry entry;
+                entry.keyLength = (UINT)key.length();
+                entry.key = key.c_str();
+                entry.bytecodeLength = (UINT)bytecode.size();
+                entry.bytecode = bytecode.data();
+                writer.addCacheEntry(entry);
+            }
+            writer.compact();
+        }
+        ::CloseHandle(hLinear);
+
+        // A fresh cache maps the archive once, as at client startup
+        ShaderDiskCache cache(indexedDirectory, 1024 * 1024 * 1024);
+        std::vector<BYTE> bytecode;
+        auto linear = [&](const std::string& key) { return searchLinear(linearFileName, key, bytecode); };
+        auto indexed = [&](const std::string& key) { return searchIndexed(cache, key); };
+
+        std::shuffle(keys.begin(), keys.end(), random);
+        double scanHit, indexHit, scanMiss, indexMiss;
+        if (!timeLookups(keys, options.lookups, true, linear, scanHit) ||
+                !timeLookups(keys, options.lookups, true, indexed, indexHit) ||
+                !timeLookups(missingKeys, options.lookups, false, linear, scanMiss) ||
+                !timeLookups(missingKeys, options.lookups, false, indexed, indexMiss)) {
+            fprintf(stderr, "%u entries: a lookup did not find what was stored\n", entryCount);
+            ok = false;
+            continue;
+        }
+        printf("%7u %9.2f us %9.2f us %8.0fx %9.2f us %9.2f us %8.0fx\n", entryCount,
+               scanHit, indexHit, scanHit / indexHit, scanMiss, indexMiss, scanMiss / indexMiss);
+    }
+
+    ::DeleteFile(linearFileName.c_str());
+    ::DeleteFile(archiveFileName.c_str());
+    return ok ? 0 : 1;
+}
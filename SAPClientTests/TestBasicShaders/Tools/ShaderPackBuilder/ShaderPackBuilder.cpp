@@ -0,0 +1,779 @@
+/*
+ * ShaderPackBuilder compiles the shaders the client expects (ShaderCatalog) ahead of time into
+ * a shader disk cache archive, so an install can ship with a warm cache and nothing has to be
+ * compiled on first launch. It goes through the same ShaderCacheKeyBuilder and ShaderDiskCache
+ * as ShaderManager, so the client finds the entries as long as the sources and the compile
+ * flags are the same. Ship the archive in Modules\D3D11Shaders\Cache\ of the install, where
+ * the client searches it read-only below its own cache, or copy it into the client's cache
+ * directory (%TEMP%\D3D11Client_ShadersCache\).
+ *
+ * The compiler is D3DShaderCompiler on Windows. The stub compiler (the only one elsewhere)
+ * makes fake bytecode, so a stub pack is only good for testing the tool, the archive format
+ * and the throughput - never ship one. --bench adds synthetic variants of every permutation
+ * to give the throughput figures something to chew on.
+ *
+ * The archive is called Shaders.cache, or Shaders.debug.cache when the tool itself is a
+ * debug build, the same names the client uses.
+ *
+ * Each shader is compiled with the profile the client uses at each of the feature levels in
+ * --levels (ShaderCatalog::getProfileName()), all of them by default, so the pack has what
+ * the client looks up on any device. Stages a level does not have are left out at that level.
+ *
+ * --verify loads every shader back from the finished archive through a ShaderManager, the
+ * client's own lookup path, with StubShaderObjectFactory in place of the device, once per
+ * level. Anything it has to compile the client would have to compile too, and the tool fails.
+ *
+ * --bench-decode weighs compressing the archive's bytecode (ClientUtils::LZCodec, as
+ * ShaderDiskCache does) against storing it raw: the bytecode just compiled is written out both
+ * ways, read back and decoded, and the times are printed. The files are read from the system
+ * cache, so the cold start estimate divides the sizes by PACK_BENCH_DISK_MB_S instead. Only
+ * d3d compiler bytecode says anything about the sizes. Stub bytecode is pseudo random and
+ * does not compress, so with the stub compiler this is only a bench of the codec's speed on
+ * such data and the sizes, what is worth storing compressed and the cold estimate are left out.
+ *
+ * --bench-lookup times what a getShader() that hits the memory cache costs per call, by
+ * purpose, entry point and defines against by a registered handle, over every shader loaded
+ * back from the archive.
+ *
+ * --bench-threads stresses ShaderManager's concurrent read path for each of a list of thread
+ * counts. Both lookup benches run at the first of the levels. All the threads load every shader into a fresh ShaderManager at once, each in its
+ * own order, and must all end up with the same shader objects. Then they hammer getShader()
+ * by handle and the lookups per second are printed.
+ */
+
+// std
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <random>
+#include <algorithm>
+
+// Local
+#include "Platform.h"
+#include "ShaderDiskCache.h"
+#include "ShaderCatalog.h"
+#include "ShaderCacheKeyBuilder.h"
+#include "StubShaderCompiler.h"
+#include "WorkerPool.h"
+#include "ShaderManager.h"
+#include "StubShaderObjectFactory.h"
+#include "LZCodec.h"
+#ifdef _WIN32
+#include "D3DShaderCompiler.h"
+#endif
+
+// D3D10_SHADER_ENABLE_STRICTNESS | D3D10_SHADER_OPTIMIZATION_LEVEL3, what D3D11Config sets
+#define PACK_DEFAULT_COMPILE_FLAGS 0x8800
+// As the "Shader cache size MB" default in D3D11Config
+#define PACK_DEFAULT_BUDGET_MB 64
+#define PACK_BENCH_DEFINE "SHADER_PACK_BENCH_VARIANT"
+// A slow hard disk, for the cold start estimate of --bench-decode
+#define PACK_BENCH_DISK_MB_S 100
+#define PACK_BENCH_RAW_FILE_NAME "DecodeBench.raw"
+#define PACK_BENCH_COMPRESSED_FILE_NAME "DecodeBench.lz"
+// getShader() calls by handle per thread for --bench-threads
+#define PACK_BENCH_THREAD_LOOKUPS 200000
+
+using namespace Rendering;
+
+namespace {
+
+struct Options
+{
+    std::string outputDirectory;
+    std::string rootDirectory;
+    bool useStubCompiler;
+    UINT compileFlags;
+    UINT budgetMB;
+    UINT threadCount;
+    UINT benchVariants;
+    UINT benchDecodeRounds;
+    UINT benchLookupCalls;
+    std::vector<UINT> benchThreadCounts;
+    std::vector<ShaderLevel> levels;
+    bool verify;
+};
+
+void
+printUsage()
+{
+    printf("Usage: ShaderPackBuilder [options] <output directory>\n"
+           "Compiles the shaders in the ShaderCatalog into a shader cache archive.\n"
+           "  --root <dir>         Orbiter directory the shader file names are relative to,\n"
+           "                       a relative output directory is taken from there too\n"
+           "  --compiler d3d|stub  compiler backend (d3d on Windows, stub elsewhere)\n"
+           "  --flags <n>          compile flags, as iShaderCompileFlag in the client (0x%x)\n"
+           "  --budget <MB>        archive size budget (%u)\n"
+           "  --threads <n>        compile threads (0 = one per core)\n"
+           "  --levels <l,..>      feature levels to compile the profiles of, 11_0, 10_0,\n"
+           "                       9_3 or 9_1 (all of them)\n"
+           "  --bench <n>          add n synthetic variants of each shader, for measuring\n"
+           "                       throughput - do not ship the result\n"
+           "  --bench-decode <n>   read the compiled bytecode back n times, raw and\n"
+           "                       compressed, and time decoding it (codec speed only\n"
+           "                       with the stub compiler)\n"
+           "  --bench-lookup <n>   time n cached getShader() calls per shader, by name\n"
+           "                       and by handle\n"
+           "  --bench-threads <n,..> load and look up the shaders from n threads at once,\n"
+           "                       for each n in the list\n"
+           "  --verify             load every shader back through a ShaderManager and fail\n"
+           "                       if any is not found in the archive\n",
+           PACK_DEFAULT_COMPILE_FLAGS, PACK_DEFAULT_BUDGET_MB);
+}
+
+bool
+parseOptions(int argc, char * argv[], Options& options)
+{
+#ifdef _WIN32
+    options.useStubCompiler = false;
+#else
+    options.useStubCompiler = true;
+#endif
+    options.compileFlags = PACK_DEFAULT_COMPILE_FLAGS;
+    options.budgetMB = PACK_DEFAULT_BUDGET_MB;
+    options.threadCount = 0;
+    options.benchVariants = 0;
+    options.benchDecodeRounds = 0;
+    options.benchLookupCalls = 0;
+    options.verify = false;
+
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        auto hasValue = i + 1 < argc;
+        if (arg == "--root" && hasValue) {
+            options.rootDirectory = argv[++i];
+        }
+        else if (arg == "--compiler" && hasValue) {
+            std::string compiler = argv[++i];
+            if (compiler == "stub") {
+                options.useStubCompiler = true;
+            }
+#ifdef _WIN32
+            else if (compiler == "d3d") {
+                options.useStubCompiler = false;
+            }
+#endif
+            else {
+                fprintf(stderr, "Unknown or unavailable compiler: %s\n", compiler.c_str());
+                return false;
+            }
+        }
+        else if (arg == "--flags" && hasValue) {
+            options.compileFlags = (UINT)strtoul(argv[++i], nullptr, 0);
+        }
+        else if (arg == "--budget" && hasValue) {
+            options.budgetMB = (UINT)strtoul(argv[++i], nullptr, 0);
+        }
+        else if (arg == "--threads" && hasValue) {
+            options.threadCount = (UINT)strtoul(argv[++i], nullptr, 0);
+        }
+        else if (arg == "--bench" && hasValue) {
+            options.benchVariants = (UINT)strtoul(argv[++i], nullptr, 0);
+        }
+        else if (arg == "--bench-decode" && hasValue) {
+            options.benchDecodeRounds = (UINT)strtoul(argv[++i], nullptr, 0);
+        }
+        else if (arg == "--bench-lookup" && hasValue) {
+            options.benchLookupCalls = (UINT)strtoul(argv[++i], nullptr, 0);
+        }
+        else if (arg == "--bench-threads" && hasValue) {
+            for (auto list = argv[++i]; *list; ) {
+                char * end;
+                auto threadCount = (UINT)strtoul(list, &end, 0);
+                if (end == list || threadCount == 0) {
+                    fprintf(stderr, "Bad thread count list: %s\n", argv[i]);
+                    return false;
+                }
+                options.benchThreadCounts.push_back(threadCount);
+                list = *end == ',' ? end + 1 : end;
+            }
+        }
+        else if (arg == "--levels" && hasValue) {
+            std::string list = argv[++i];
+            for (size_t start = 0; start <= list.length(); ) {
+                auto end = list.find(',', start);
+                if (end == std::string::npos) {
+                    end = list.length();
+                }
+                ShaderLevel level;
+                if (!ShaderCatalog::getLevel(list.substr(start, end - start), level)) {
+                    fprintf(stderr, "Bad feature level list: %s\n", list.c_str());
+                    return false;
+                }
+                options.levels.push_back(level);
+                start = end + 1;
+            }
+        }
+        else if (arg == "--verify") {
+            options.verify = true;
+        }
+        else if (arg[0] != '-' && options.outputDirectory.empty()) {
+            options.outputDirectory = arg;
+        }
+        else {
+            return false;
+        }
+    }
+    if (options.levels.empty()) {
+        for (int level = SHADER_LEVEL_COUNT - 1; level >= 0; --level) {
+            options.levels.push_back((ShaderLevel)level);
+        }
+    }
+    if (options.budgetMB < 1 || options.budgetMB > 1024) {
+        fprintf(stderr, "The budget must be 1 to 1024 MB\n");
+        return false;
+    }
+    return !options.outputDirectory.empty();
+}
+
+// The catalog's permutations, each followed by its bench variants if any
+std::vector<ShaderPermutation>
+collectPermutations(UINT benchVariants)
+{
+    std::vector<ShaderPermutation> permutations;
+    for (const auto& permutation : ShaderCatalog::m_expectedPermutations) {
+        if (ShaderCatalog::m_shaderPurposeVsFileNameMap.find(permutation.purpose) ==
+                ShaderCatalog::m_shaderPurposeVsFileNameMap.end()) {
+            fprintf(stderr, "Skipping %s: unknown purpose %s\n", permutation.entryPoint.c_str(),
+                    permutation.purpose.c_str());
+            continue;
+        }
+        permutations.push_back(permutation);
+        for (UINT variant = 0; variant < benchVariants; ++variant) {
+            ShaderPermutation benchPermutation = permutation;
+            benchPermutation.defines.push_back(std::make_pair(PACK_BENCH_DEFINE,
+                                                              std::to_string(variant)));
+            permutations.push_back(benchPermutation);
+        }
+    }
+    return permutations;
+}
+
+// The permutations whose stage the level has
+std::vector<ShaderPermutation>
+getLevelPermutations(const std::vector<ShaderPermutation>& permutations, ShaderLevel level)
+{
+    std::vector<ShaderPermutation> levelPermutations;
+    for (const auto& permutation : permutations) {
+        if (ShaderCatalog::getProfileName(permutation.stage, level)) {
+            levelPermutations.push_back(permutation);
+        }
+    }
+    return levelPermutations;
+}
+
+std::unique_ptr<IShaderCompiler>
+createCompiler(const Options& options)
+{
+#ifdef _WIN32
+    if (!options.useStubCompiler) {
+        return std::unique_ptr<IShaderCompiler>(new D3DShaderCompiler());
+    }
+#else
+    // The stub is the only compiler here, parseOptions() takes no other
+    (void)options;
+#endif
+    return std::unique_ptr<IShaderCompiler>(new StubShaderCompiler());
+}
+
+// A ShaderManager as the client has, on the archive in outputDirectory, with stand ins for
+// the device's shader objects
+std::unique_ptr<ShaderManager>
+createManager(const Options& options, const std::string& outputDirectory)
+{
+    return std::unique_ptr<ShaderManager>(new ShaderManager(
+        createCompiler(options),
+        std::unique_ptr<IShaderObjectFactory>(new StubShaderObjectFactory()),
+        options.compileFlags,
+        options.budgetMB,
+        false,
+        outputDirectory));
+}
+
+// Calls f with a null shader smart pointer of the type for stage and returns what it does,
+// generic lambdas take it to pick the getShader() to call
+template<typename F>
+bool
+withShaderType(ShaderStage stage, F f)
+{
+    switch (stage) {
+    case SHADER_STAGE_VERTEX:
+        return f(ID3D11VertexShaderPtr());
+    case SHADER_STAGE_PIXEL:
+        return f(ID3D11PixelShaderPtr());
+    case SHADER_STAGE_GEOMETRY:
+        return f(ID3D11GeometryShaderPtr());
+    case SHADER_STAGE_COMPUTE:
+        return f(ID3D11ComputeShaderPtr());
+    case SHADER_STAGE_HULL:
+        return f(ID3D11HullShaderPtr());
+    case SHADER_STAGE_DOMAIN:
+        return f(ID3D11DomainShaderPtr());
+    default:
+        return false;
+    }
+}
+
+// Loads the permutations from the archive in outputDirectory the way the client does at the
+// level. False if any failed or had to be compiled, those are added to the archive as in the
+// client.
+bool
+verifyArchive(const Options& options, const std::string& outputDirectory, ShaderLevel level,
+              const std::vector<ShaderPermutation>& permutations)
+{
+    InitShaderProfiles(level);
+    auto levelPermutations = getLevelPermutations(permutations, level);
+    auto pManager = createManager(options, outputDirectory);
+    auto& manager = *pManager;
+    auto loadedCount = manager.warmUp(levelPermutations);
+
+    auto totals = manager.getStats().getTotals();
+    auto compiledCount = totals.tiers[SHADER_TIER_COMPILE].getCount();
+    printf("Verify %s: %u of %u shaders loaded, %llu from the archive, %llu compiled\n",
+           ShaderCatalog::getLevelName(level), loadedCount, (UINT)levelPermutations.size(),
+           (unsigned long long)totals.tiers[SHADER_TIER_DISK].getCount(),
+           (unsigned long long)compiledCount);
+    std::vector<std::string> lines;
+    manager.getStatsReport(lines);
+    for (const auto& line : lines) {
+        printf("  %s\n", line.c_str());
+    }
+    return loadedCount == levelPermutations.size() && compiledCount == 0;
+}
+
+SIZE_T
+getFileSize(const std::string& fileName)
+{
+    HANDLE hFile = ::CreateFile(fileName.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+                                OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0);
+    if (hFile == INVALID_HANDLE_VALUE) {
+        return 0;
+    }
+    LARGE_INTEGER fileSize;
+    auto ok = ::GetFileSizeEx(hFile, &fileSize);
+    ::CloseHandle(hFile);
+    return ok ? (SIZE_T)fileSize.QuadPart : 0;
+}
+
+bool
+writeWholeFile(const std::string& fileName, const std::vector<BYTE>& data)
+{
+    HANDLE hFile = ::CreateFile(fileName.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS,
+                                FILE_ATTRIBUTE_NORMAL, 0);
+    if (hFile == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+    DWORD written = 0;
+    auto ok = ::WriteFile(hFile, data.data(), (DWORD)data.size(), &written, nullptr) &&
+              written == data.size();
+    ::CloseHandle(hFile);
+    return ok != FALSE;
+}
+
+bool
+readWholeFile(const std::string& fileName, std::vector<BYTE>& data)
+{
+    HANDLE hFile = ::CreateFile(fileName.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+                                OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0);
+    if (hFile == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+    DWORD read = 0;
+    auto ok = ::ReadFile(hFile, data.data(), (DWORD)data.size(), &read, nullptr) &&
+              read == data.size();
+    ::CloseHandle(hFile);
+    return ok != FALSE;
+}
+
+double
+millisecondsSince(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Times reading the samples raw against reading them compressed and decoding them. Stub
+// samples get no figures that depend on how well they compress.
+bool
+benchDecode(const std::string& outputDirectory, const std::vector<std::vector<BYTE>>& samples,
+            UINT rounds, bool stubSamples)
+{
+    // Every sample is compressed on its own, as the writer does per record
+    std::vector<BYTE> raw;
+    std::vector<BYTE> compressed;
+    std::vector<SIZE_T> compressedLengths;
+    UINT worthStoringCount = 0;
+    for (const auto& sample : samples) {
+        raw.insert(raw.end(), sample.begin(), sample.end());
+        auto offset = compressed.size();
+        compressed.resize(offset + ClientUtils::LZCodec::compressBound(sample.size()));
+        auto length = ClientUtils::LZCodec::compress(sample.data(), sample.size(),
+                                                     compressed.data() + offset,
+                                                     compressed.size() - offset);
+        compressed.resize(offset + length);
+        compressedLengths.push_back(length);
+        // The same test as ShaderDiskCache::compressEntry()
+        if (length <= sample.size() - sample.size() / 8) {
+            worthStoringCount++;
+        }
+    }
+
+    std::string rawFileName = outputDirectory + PATH_SEPARATOR + PACK_BENCH_RAW_FILE_NAME;
+    std::string compressedFileName = outputDirectory + PATH_SEPARATOR + PACK_BENCH_COMPRESSED_FILE_NAME;
+    if (!writeWholeFile(rawFileName, raw) || !writeWholeFile(compressedFileName, compressed)) {
+        fprintf(stderr, "Cannot write the decode bench files to %s\n", outputDirectory.c_str());
+        return false;
+    }
+
+    std::vector<BYTE> rawRead(raw.size());
+    std::vector<BYTE> compressedRead(compressed.size());
+    std::vector<BYTE> decoded(raw.size());
+    double rawReadMs = 0.0, compressedReadMs = 0.0, decodeMs = 0.0;
+    auto ok = true;
+    for (UINT round = 0; round < rounds && ok; ++round) {
+        auto start = std::chrono::steady_clock::now();
+        ok = readWholeFile(rawFileName, rawRead);
+        rawReadMs += millisecondsSince(start);
+
+        start = std::chrono::steady_clock::now();
+        ok = ok && readWholeFile(compressedFileName, compressedRead);
+        compressedReadMs += millisecondsSince(start);
+
+        start = std::chrono::steady_clock::now();
+        SIZE_T source = 0, dest = 0;
+        for (size_t i = 0; i < samples.size() && ok; ++i) {
+            ok = ClientUtils::LZCodec::decompress(compressedRead.data() + source, compressedLengths[i],
+                                                  decoded.data() + dest, samples[i].size());
+            source += compressedLengths[i];
+            dest += samples[i].size();
+        }
+        decodeMs += millisecondsSince(start);
+    }
+    ::DeleteFile(rawFileName.c_str());
+    ::DeleteFile(compressedFileName.c_str());
+    if (!ok || decoded != raw) {
+        fprintf(stderr, "Decode bench: the bytecode did not read back or decode intact\n");
+        return false;
+    }
+
+    auto rawMB = raw.size() / (1024.0 * 1024.0);
+    auto compressedMB = compressed.size() / (1024.0 * 1024.0);
+    decodeMs = decodeMs > 0.0 ? decodeMs : 1e-6;
+    if (stubSamples) {
+        printf("Decode bench on stub bytecode, codec speed only: %u shaders, %.2f MB\n",
+               (UINT)samples.size(), rawMB);
+    }
+    else {
+        printf("Decode bench: %u shaders, %.2f MB raw, %.2f MB compressed (%.1f%%), %u worth storing compressed\n",
+               (UINT)samples.size(), rawMB, compressedMB, raw.empty() ? 0.0 : 100.0 * compressed.size() / raw.size(),
+               worthStoringCount);
+    }
+    printf("  Per round of %u: raw read %.3f ms, compressed read %.3f ms + decode %.3f ms (%.0f MB/s)\n",
+           rounds, rawReadMs / rounds, compressedReadMs / rounds, decodeMs / rounds,
+           rawMB * rounds / (decodeMs / 1000.0));
+    if (!stubSamples) {
+        printf("  Cold at %u MB/s: raw read %.3f ms, compressed read + decode %.3f ms\n",
+               PACK_BENCH_DISK_MB_S, rawMB * 1000.0 / PACK_BENCH_DISK_MB_S,
+               compressedMB * 1000.0 / PACK_BENCH_DISK_MB_S + decodeMs / rounds);
+    }
+    return true;
+}
+
+// Times cached getShader() calls by name against by handle, each shader is loaded first. A
+// copy of the shader smart pointer, the AddRef() and Release() every lookup pays for, is timed
+// alone as the floor.
+bool
+benchLookup(const Options& options, const std::string& outputDirectory,
+            const std::vector<ShaderPermutation>& permutations)
+{
+    auto pManager = createManager(options, outputDirectory);
+    auto& manager = *pManager;
+    auto calls = options.benchLookupCalls;
+    double byNameMs = 0.0, byHandleMs = 0.0, copyMs = 0.0;
+    auto ok = true;
+    for (const auto& permutation : permutations) {
+        ok = ok && withShaderType(permutation.stage, [&](auto shader) {
+            typedef decltype(shader) ShaderPtr;
+            auto handle = manager.registerShader<ShaderPtr>(permutation.purpose,
+                                                            permutation.entryPoint,
+                                                            permutation.defines);
+            ShaderPtr result;
+            if (!manager.getShader(handle, result)) {
+                return false;
+            }
+
+            auto found = true;
+            auto start = std::chrono::steady_clock::now();
+            for (UINT call = 0; call < calls; ++call) {
+                found = manager.getShader(permutation.purpose, permutation.entryPoint, result,
+                                          permutation.defines) && found;
+            }
+            byNameMs += millisecondsSince(start);
+
+            start = std::chrono::steady_clock::now();
+            for (UINT call = 0; call < calls; ++call) {
+                found = manager.getShader(handle, result) && found;
+            }
+            byHandleMs += millisecondsSince(start);
+
+            ShaderPtr loaded = result;
+            start = std::chrono::steady_clock::now();
+            for (UINT call = 0; call < calls; ++call) {
+                result = loaded;
+                found = result && found;
+            }
+            copyMs += millisecondsSince(start);
+            return found;
+        });
+    }
+    if (!ok) {
+        fprintf(stderr, "Lookup bench: a shader did not load\n");
+        return false;
+    }
+
+    auto totalCalls = (double)calls * permutations.size();
+    auto byNameNs = totalCalls > 0 ? byNameMs * 1e6 / totalCalls : 0.0;
+    auto byHandleNs = totalCalls > 0 ? byHandleMs * 1e6 / totalCalls : 0.0;
+    auto copyNs = totalCalls > 0 ? copyMs * 1e6 / totalCalls : 0.0;
+    printf("Lookup bench: %u shaders, %u cached getShader() calls each\n",
+           (UINT)permutations.size(), calls);
+    printf("  by name %.1f ns per call, by handle %.1f ns per call (%.1fx)\n",
+           byNameNs, byHandleNs, byHandleNs > 0 ? byNameNs / byHandleNs : 0.0);
+    printf("  smart pointer copy alone %.1f ns\n", copyNs);
+    return true;
+}
+
+// Loads every shader into a fresh ShaderManager from threadCount threads at once, then times
+// them all looking the shaders up by handle. False if the threads disagree on a shader.
+bool
+benchThreads(const Options& options, const std::string& outputDirectory,
+             const std::vector<ShaderPermutation>& permutations, UINT threadCount,
+             double& lookupsPerSecond)
+{
+    auto pManager = createManager(options, outputDirectory);
+    auto& manager = *pManager;
+
+    // What each thread got for each permutation, and the handle it was registered as
+    std::vector<std::vector<const void *>> objects(threadCount,
+                                                   std::vector<const void *>(permutations.size()));
+    std::vector<std::vector<UINT>> handleIndices(threadCount, std::vector<UINT>(permutations.size()));
+    std::vector<std::thread> threads;
+    for (UINT thread = 0; thread < threadCount; ++thread) {
+        threads.emplace_back([&, thread] {
+            std::vector<size_t> order(permutations.size());
+            for (size_t i = 0; i < order.size(); ++i) {
+                order[i] = i;
+            }
+            std::shuffle(order.begin(), order.end(), std::mt19937(thread));
+            for (auto i : order) {
+                const auto& permutation = permutations[i];
+                withShaderType(permutation.stage, [&](auto shader) {
+                    typedef decltype(shader) ShaderPtr;
+                    auto handle = manager.registerShader<ShaderPtr>(permutation.purpose,
+                                                                    permutation.entryPoint,
+                                                                    permutation.defines);
+                    ShaderPtr result;
+                    manager.getShader(permutation.purpose, permutation.entryPoint, result,
+                                      permutation.defines);
+                    objects[thread][i] = result.GetInterfacePtr();
+                    handleIndices[thread][i] = handle.index;
+                    return true;
+                });
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    threads.clear();
+    for (size_t i = 0; i < permutations.size(); ++i) {
+        for (UINT thread = 0; thread < threadCount; ++thread) {
+            if (!objects[thread][i] || objects[thread][i] != objects[0][i] ||
+                    handleIndices[thread][i] != handleIndices[0][i]) {
+                fprintf(stderr, "Thread bench: %u threads got different shaders for %s %s\n",
+                        threadCount, permutations[i].purpose.c_str(),
+                        permutations[i].entryPoint.c_str());
+                return false;
+            }
+        }
+    }
+
+    // Everything is loaded, from here on every call is a memory cache hit
+    std::atomic<UINT> misses(0);
+    auto start = std::chrono::steady_clock::now();
+    for (UINT thread = 0; thread < threadCount; ++thread) {
+        threads.emplace_back([&, thread] {
+            for (UINT call = 0; call < PACK_BENCH_THREAD_LOOKUPS; ++call) {
+                auto i = (call + thread * 7) % permutations.size();
+                auto found = withShaderType(permutations[i].stage, [&](auto shader) {
+                    typedef decltype(shader) ShaderPtr;
+                    ShaderHandle<ShaderPtr> handle;
+                    handle.index = handleIndices[0][i];
+                    ShaderPtr result;
+                    return manager.getShader(handle, result) && result.GetInterfacePtr() == objects[0][i];
+                });
+                if (!found) {
+                    misses++;
+                }
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    auto seconds = millisecondsSince(start) / 1000.0;
+    lookupsPerSecond = (double)PACK_BENCH_THREAD_LOOKUPS * threadCount / (seconds > 0.0 ? seconds : 1e-9);
+    if (misses) {
+        fprintf(stderr, "Thread bench: %u lookups by handle with %u threads went wrong\n",
+                (UINT)misses, threadCount);
+        return false;
+    }
+    return true;
+}
+
+} // namespace
+
+int
+main(int argc, char * argv[])
+{
+    Options options;
+    if (!parseOptions(argc, argv, options)) {
+        printUsage();
+        return 2;
+    }
+
+    // The shader file names in the catalog are relative to the Orbiter directory, and the
+    // names recorded for included files have to be what the client will see
+    if (!options.rootDirectory.empty() &&
+            !::SetCurrentDirectory(options.rootDirectory.c_str())) {
+        fprintf(stderr, "Cannot change to %s\n", options.rootDirectory.c_str());
+        return 1;
+    }
+
+    std::string outputDirectory = options.outputDirectory;
+    if (::GetFileAttributes(outputDirectory.c_str()) == INVALID_FILE_ATTRIBUTES &&
+            !::CreateDirectory(outputDirectory.c_str(), nullptr)) {
+        fprintf(stderr, "Cannot create %s\n", outputDirectory.c_str());
+        return 1;
+    }
+
+    // Always a fresh archive, entries left from older sources would only take up room
+    std::string archiveFileName = ShaderDiskCache::getArchiveFileName(outputDirectory);
+    ::DeleteFile(archiveFileName.c_str());
+
+    auto compiler = createCompiler(options);
+    auto permutations = collectPermutations(options.benchVariants);
+    ShaderCacheKeyBuilder keyBuilder(options.compileFlags);
+    std::atomic<UINT> compiledCount(0);
+    std::atomic<UINT> failedCount(0);
+    std::atomic<UINT64> bytecodeBytes(0);
+    std::mutex samplesMutex;
+    std::vector<std::vector<BYTE>> decodeSamples;
+
+    auto startTime = std::chrono::steady_clock::now();
+    {
+        std::unique_ptr<ShaderDiskCache> cache(new ShaderDiskCache(outputDirectory,
+                                                                   options.budgetMB * 1024 * 1024));
+        ClientUtils::WorkerPool pool(options.threadCount);
+        for (auto level : options.levels) {
+            for (const auto& permutation : permutations) {
+                const TCHAR * shaderProfile = ShaderCatalog::getProfileName(permutation.stage, level);
+                if (!shaderProfile) {
+                    // Not a stage of the level, the client never asks for it there
+                    continue;
+                }
+                pool.submit([&, shaderProfile] {
+                    const std::string& shaderFileName =
+                        ShaderCatalog::m_shaderPurposeVsFileNameMap.find(permutation.purpose)->second;
+                    std::string definesStr;
+                    ShaderCacheKeyBuilder::createDefinesString(permutation.defines, definesStr);
+
+                    std::string key;
+                    std::vector<BYTE> bytecode;
+                    CacheEntry entry;
+                    if (!keyBuilder.createKey(shaderFileName, permutation.entryPoint, shaderProfile,
+                                              definesStr, key) ||
+                            !compiler->compile(shaderFileName, permutation.entryPoint, shaderProfile,
+                                               permutation.defines, options.compileFlags, bytecode,
+                                               entry.dependencies)) {
+                        fprintf(stderr, "Failed: %s %s %s %s\n", permutation.purpose.c_str(),
+                                permutation.entryPoint.c_str(), shaderProfile,
+                                definesStr.c_str());
+                        failedCount++;
+                        return;
+                    }
+
+                    entry.keyLength = (UINT)key.length();
+                    entry.key = key.c_str();
+                    entry.bytecodeLength = (UINT)bytecode.size();
+                    entry.bytecode = bytecode.data();
+                    // Waits for the writer when it falls behind
+                    cache->addCacheEntry(entry);
+                    compiledCount++;
+                    bytecodeBytes += bytecode.size();
+                    if (options.benchDecodeRounds) {
+                        std::lock_guard<std::mutex> lock(samplesMutex);
+                        decodeSamples.push_back(std::move(bytecode));
+                    }
+                });
+            }
+        }
+        pool.waitIdle();
+
+        // Every batch the writer put out left an old copy of the index behind
+        cache->compact();
+    }
+    auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+    if (seconds <= 0.0) {
+        seconds = 1e-9;
+    }
+
+    auto megabytes = bytecodeBytes / (1024.0 * 1024.0);
+    printf("%u shaders compiled, %u failed, %.2f MB of bytecode in %.3f s\n",
+           (UINT)compiledCount, (UINT)failedCount, megabytes, seconds);
+    printf("%.1f shaders/s, %.2f MB/s\n", compiledCount / seconds, megabytes / seconds);
+    printf("%s: %llu bytes\n", archiveFileName.c_str(),
+           (unsigned long long)getFileSize(archiveFileName));
+    if (failedCount) {
+        return 1;
+    }
+    if (options.benchDecodeRounds &&
+            !benchDecode(outputDirectory, decodeSamples, options.benchDecodeRounds,
+                         options.useStubCompiler)) {
+        return 1;
+    }
+
+    // The lookup benches load through a ShaderManager, as the client at the first level does
+    InitShaderProfiles(options.levels[0]);
+    auto benchPermutations = getLevelPermutations(permutations, options.levels[0]);
+    if (options.benchLookupCalls && !benchLookup(options, outputDirectory, benchPermutations)) {
+        return 1;
+    }
+    if (!options.benchThreadCounts.empty()) {
+        printf("Thread bench: %u shaders at %s, %u cached lookups by handle per thread\n",
+               (UINT)benchPermutations.size(), ShaderCatalog::getLevelName(options.levels[0]),
+               PACK_BENCH_THREAD_LOOKUPS);
+        for (auto threadCount : options.benchThreadCounts) {
+            double lookupsPerSecond;
+            if (!benchThreads(options, outputDirectory, benchPermutations, threadCount, lookupsPerSecond)) {
+                return 1;
+            }
+            printf("  %3u threads: %8.2f M lookups/s, %8.2f M per thread\n", threadCount,
+                   lookupsPerSecond / 1e6, lookupsPerSecond / 1e6 / threadCount);
+        }
+    }
+    if (options.verify) {
+        for (auto level : options.levels) {
+            if (!verifyArchive(options, outputDirectory, level, permutations)) {
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
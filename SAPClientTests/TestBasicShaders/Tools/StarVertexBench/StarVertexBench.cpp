@@ -0,0 +1,181 @@
+/*
+ * StarVertexBench times StarVertexBuilder on a synthetic star catalogue (1M stars by default)
+ * and checks the fast path against the double precision reference: the largest position and
+ * brightness differences against the stated tolerances, and that the level table comes out
+ * the same. The stars are spread evenly over the sphere with magnitudes rising from -1.5 like
+ * Star.bin, the brightness mapping is the log one with the StarRenderPrm defaults unless
+ * --linear is given. Exits with 1 if a difference is out of tolerance.
+ */
+
+// std
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <random>
+
+// Local
+#include "Platform.h"
+#include "StarVertexBuilder.h"
+#include "WorkerPool.h"
+
+#define BENCH_DEFAULT_STARS 1000000
+#define BENCH_RUNS 5					// best of
+#define BENCH_RADIUS 1e3				// as CelSphere
+#define BENCH_MAG_HI 1.0				// the StarRenderPrm defaults, mag_lo past the faintest
+#define BENCH_MAG_LO 15.0
+#define BENCH_BRT_MIN 0.1
+
+using namespace Rendering;
+
+namespace {
+
+struct Options
+{
+    UINT starCount;
+    UINT threadCount;
+    bool mapLog;
+};
+
+void
+printUsage()
+{
+    printf("Usage: StarVertexBench [options]\n"
+           "Times star vertex generation on a synthetic catalogue and checks its accuracy.\n"
+           "  --stars <n>    stars in the catalogue (%u)\n"
+           "  --threads <n>  worker threads for the pooled run (0 = one per core)\n"
+           "  --linear       linear brightness mapping instead of the log one\n",
+           BENCH_DEFAULT_STARS);
+}
+
+bool
+parseOptions(int argc, char * argv[], Options& options)
+{
+    options.starCount = BENCH_DEFAULT_STARS;
+    options.threadCount = 0;
+    options.mapLog = true;
+
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        auto hasValue = i + 1 < argc;
+        if (arg == "--stars" && hasValue) {
+            options.starCount = (UINT)strtoul(argv[++i], nullptr, 0);
+        }
+        else if (arg == "--threads" && hasValue) {
+            options.threadCount = (UINT)strtoul(argv[++i], nullptr, 0);
+        }
+        else if (arg == "--linear") {
+            options.mapLog = false;
+        }
+        else {
+            return false;
+        }
+    }
+    return options.starCount > 0;
+}
+
+// Evenly over the sphere, sorted by magnitude as Star.bin is
+void
+makeCatalogue(UINT starCount, std::vector<StarRec>& stars)
+{
+    std::mt19937 random(1);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    stars.resize(starCount);
+    for (UINT index = 0; index < starCount; ++index) {
+        auto& rec = stars[index];
+        rec.lng = unit(random) * 6.2831853f;
+        rec.lat = asin(unit(random) * 2.0f - 1.0f);
+        rec.mag = -1.5f + (float)(BENCH_MAG_LO + 1.5) * index / starCount;
+    }
+}
+
+// Best of BENCH_RUNS, in milliseconds
+template<typename F>
+double
+timeBest(F run)
+{
+    double best = 1e30;
+    for (int i = 0; i < BENCH_RUNS; ++i) {
+        auto start = std::chrono::steady_clock::now();
+        run();
+        auto ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        best = ms < best ? ms : best;
+    }
+    return best;
+}
+
+} // namespace
+
+int
+main(int argc, char * argv[])
+{
+    Options options;
+    if (!parseOptions(argc, argv, options)) {
+        printUsage();
+        return 1;
+    }
+
+    std::vector<StarRec> stars;
+    makeCatalogue(options.starCount, stars);
+    StarVertexBuilder builder(BENCH_RADIUS, BENCH_MAG_LO, BENCH_MAG_HI, BENCH_BRT_MIN, options.mapLog);
+
+    std::vector<STARVERTEX> reference(stars.size()), fast(stars.size()), pooled(stars.size());
+    ClientUtils::WorkerPool pool(options.threadCount);
+    auto referenceMs = timeBest([&] { builder.buildReference(stars.data(), options.starCount, reference.data()); });
+    auto fastMs = timeBest([&] { builder.build(stars.data(), options.starCount, fast.data()); });
+    auto pooledMs = timeBest([&] { builder.build(stars.data(), options.starCount, pooled.data(), &pool); });
+
+    // Positions relative to the radius
+    double positionError = 0.0, brightnessError = 0.0;
+    UINT pooledMismatches = 0;
+    for (UINT index = 0; index < options.starCount; ++index) {
+        const auto& r = reference[index];
+        const auto& f = fast[index];
+        double dx = f.pos.x - r.pos.x, dy = f.pos.y - r.pos.y, dz = f.pos.z - r.pos.z;
+        double position = sqrt(dx * dx + dy * dy + dz * dz) / BENCH_RADIUS;
+        double brightness = fabs((double)f.col - r.col);
+        positionError = position > positionError ? position : positionError;
+        brightnessError = brightness > brightnessError ? brightness : brightnessError;
+        if (memcmp(&f, &pooled[index], sizeof(f))) {
+            pooledMismatches++;
+        }
+    }
+
+    // The table as CelSphere used to build it from the vertices, against fillLevelTable()
+    int expectedLevels[256], levels[256];
+    int previousLevel = 256;
+    for (UINT index = 0; index < options.starCount; ++index) {
+        int level = (int)(reference[index].col * 256.0 * 0.5);
+        level = level > 255 ? 255 : level;
+        for (int k = level; k < previousLevel; ++k) {
+            expectedLevels[k] = (int)index;
+        }
+        previousLevel = level;
+    }
+    for (int k = 0; k < previousLevel; ++k) {
+        expectedLevels[k] = (int)options.starCount;
+    }
+    auto levelsMs = timeBest([&] { builder.fillLevelTable(stars.data(), options.starCount, levels); });
+    auto levelsMatch = !memcmp(levels, expectedLevels, sizeof(levels));
+
+    auto megastars = options.starCount / 1e6;
+    printf("%u stars, %s brightness, %u threads in the pool\n", options.starCount,
+           options.mapLog ? "log" : "linear", pool.threadCount());
+    printf("reference: %8.2f ms, %6.1f M stars/s\n", referenceMs, megastars / referenceMs * 1e3);
+    printf("build:     %8.2f ms, %6.1f M stars/s\n", fastMs, megastars / fastMs * 1e3);
+    printf("pooled:    %8.2f ms, %6.1f M stars/s\n", pooledMs, megastars / pooledMs * 1e3);
+    printf("levels:    %8.2f ms, %s\n", levelsMs, levelsMatch ? "same" : "DIFFERENT");
+    printf("max position error %.3g (tolerance %.3g), max brightness error %.3g (tolerance %.3g)\n",
+           positionError, StarVertexBuilder::sStarPositionTolerance,
+           brightnessError, StarVertexBuilder::sStarBrightnessTolerance);
+    if (pooledMismatches) {
+        printf("%u pooled vertices differ from the single threaded ones\n", pooledMismatches);
+    }
+
+    auto ok = positionError <= StarVertexBuilder::sStarPositionTolerance &&
+              brightnessError <= StarVertexBuilder::sStarBrightnessTolerance &&
+              levelsMatch && !pooledMismatches;
+    return ok ? 0 : 1;
+}
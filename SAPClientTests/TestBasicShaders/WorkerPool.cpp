@@ -0,0 +1,75 @@
+/*
+ * Impl
+ */
+
+// Self
+#include "WorkerPool.h"
+
+using namespace ClientUtils;
+
+WorkerPool::WorkerPool(UINT threadCount)
+    : m_busyCount(0)
+    , m_bStop(false)
+{
+    if (threadCount == 0) {
+        threadCount = std::thread::hardware_concurrency();
+        threadCount = threadCount > 1 ? threadCount - 1 : 1;
+    }
+    for (UINT i = 0; i < threadCount; ++i) {
+        m_threads.push_back(std::thread(&WorkerPool::workerMain, this));
+    }
+}
+
+WorkerPool::~WorkerPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_bStop = true;
+    }
+    m_taskAvailable.notify_all();
+    for (auto& thread : m_threads) {
+        thread.join();
+    }
+}
+
+void
+WorkerPool::submit(std::function<void()> task)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_tasks.push_back(std::move(task));
+    }
+    m_taskAvailable.notify_one();
+}
+
+void
+WorkerPool::waitIdle()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_idle.wait(lock, [this] { return m_tasks.empty() && m_busyCount == 0; });
+}
+
+void
+WorkerPool::workerMain()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    for (;;) {
+        m_taskAvailable.wait(lock, [this] { return m_bStop || !m_tasks.empty(); });
+        if (m_tasks.empty()) {
+            // Asked to stop and nothing left to run
+            break;
+        }
+
+        auto task = std::move(m_tasks.front());
+        m_tasks.pop_front();
+        m_busyCount++;
+        lock.unlock();
+        task();
+        lock.lock();
+        m_busyCount--;
+
+        if (m_tasks.empty() && m_busyCount == 0) {
+            m_idle.notify_all();
+        }
+    }
+}
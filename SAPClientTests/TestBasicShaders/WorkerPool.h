@@ -0,0 +1,57 @@
+/*
+ * The WorkerPool class runs submitted tasks on a fixed set of threads. It is meant for
+ * load time work that can be spread over the cores (shader warm-up etc.), not for per frame
+ * jobs. Tasks run in no particular order and must not throw.
+ * Like ShaderManager this has no dependence on Orbiter headers.
+ */
+
+#pragma once
+
+// Local
+#include "Platform.h" // for the Win32 types
+
+// std
+#include <vector>
+#include <deque>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+namespace ClientUtils {
+
+class WorkerPool
+{
+public:
+    // 0 threads means one per hardware thread less the one submitting, but at least 1
+    explicit WorkerPool(UINT threadCount = 0);
+
+    // Runs whatever is still queued, then joins the threads
+    ~WorkerPool();
+
+    void submit(std::function<void()> task);
+
+    // Blocks till every task submitted so far has run
+    void waitIdle();
+
+    UINT threadCount() const { return (UINT)m_threads.size(); }
+
+private:
+    // Not copyable, the threads are owned
+    WorkerPool(const WorkerPool&);
+    WorkerPool& operator=(const WorkerPool&);
+
+    void workerMain();
+
+    std::vector<std::thread> m_threads;
+
+    // Guarded by m_mutex
+    std::mutex m_mutex;
+    std::condition_variable m_taskAvailable;
+    std::condition_variable m_idle;
+    std::deque<std::function<void()>> m_tasks;
+    UINT m_busyCount;
+    bool m_bStop;
+};
+
+} // namespace ClientUtils